@@ -0,0 +1,44 @@
+#ifndef __ACTIVITY_H__
+#define __ACTIVITY_H__
+
+#include <time.h>
+#include <stddef.h>
+
+// Rollup bucket lengths (s), buckets start on a multiple of their length (UTC)
+#define ACTIVITY_HOUR  3600
+#define ACTIVITY_DAY   86400
+
+// Nick id for a channel's daily total
+#define ACTIVITY_CHANNEL  -1
+
+// Messages by one nick in one hour of a channel, or by everyone in one day
+struct activity_entry
+{
+	int channel;
+	int nick;                       // Nick id or ACTIVITY_CHANNEL, 0 for empty slots
+	time_t start;                   // Start of the hour or day
+	int messages;
+};
+
+// Message counts waiting to be added to the rollup tables when the transaction
+// they were counted in commits. Hash table of (channel, hour, nick) and
+// (channel, day) => count, which stays small since a transaction only covers a
+// short stretch of log.
+// Only the writer thread uses it.
+struct activity_table
+{
+	struct activity_entry* entries; // Open addressed
+	size_t len;                     // Always a power of two
+	size_t count;
+};
+
+struct activity_table activity_create();
+void activity_destroy(struct activity_table* table);
+
+// Forget every count
+void activity_clear(struct activity_table* table);
+
+// Count count messages from the nick with id nick at time, towards its hour and the channel's day
+void activity_add(struct activity_table* table, int channel, int nick, time_t time, int count);
+
+#endif /* __ACTIVITY_H__ */
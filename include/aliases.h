@@ -0,0 +1,45 @@
+#ifndef __ALIASES_H__
+#define __ALIASES_H__
+
+#include <stddef.h>
+#include <sqlite3.h>
+
+#include "logline.h"
+
+// An alias and the main nick it is attributed to
+struct alias_entry
+{
+	char* alias;
+	size_t alias_len;
+	char* nick;
+	size_t nick_len;
+};
+
+// Case insensitive (like collate nocase) hash table of alias => main nick
+// Built once at startup and only read afterwards, so it can be shared between threads
+struct alias_table
+{
+	struct alias_entry* entries;    // Open addressed, NULL alias for empty slots
+	size_t len;                     // Always a power of two
+	size_t count;
+};
+
+struct alias_table alias_create();
+void alias_destroy(struct alias_table* table);
+
+// Add an alias, the first mapping added for an alias wins
+void alias_add(struct alias_table* table, const char* alias, const char* nick);
+
+// Add every alias in the aliases table
+// Returns the number of aliases loaded
+int alias_load(struct alias_table* table, sqlite3* db);
+
+// Make the aliases table hold exactly the aliases in wanted, in one transaction,
+// printing each alias added, changed or removed
+// Returns the number of changes, or -1 if nothing could be changed
+int alias_sync(sqlite3* db, const struct alias_table* wanted);
+
+// Get the main nick for nick, or nick itself if it isn't an alias
+struct logline_slice alias_resolve(const struct alias_table* table, struct logline_slice nick);
+
+#endif /* __ALIASES_H__ */
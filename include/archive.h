@@ -0,0 +1,139 @@
+#ifndef __ARCHIVE_H__
+#define __ARCHIVE_H__
+
+#include <time.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sqlite3.h>
+
+#include "logline.h"
+
+#define ARCHIVE_DEFAULT_CACHE_BLOCKS  64
+
+// Messages are packed into blocks of about this many bytes before compressing
+#define ARCHIVE_BLOCK_SIZE            65536
+
+// Message text read back is truncated to this length
+#define ARCHIVE_MESSAGE_LEN           1024
+
+// Days are UTC, like the activity rollups
+#define ARCHIVE_DAY                   86400
+
+// Segment files a reader has open at once, while it loads a block
+#define ARCHIVE_READER_FDS            1
+
+// Where a compressed block is, a row of archive_blocks
+struct archive_block
+{
+	int channel;
+	time_t day;                     // Day of the segment holding it
+	long long segment;              // First message id in the segment, which names its file
+	long long offset;               // Where the block starts in the segment file
+	int size;                       // Compressed length
+	int length;                     // Decompressed length
+	long long first_id;             // Range of message ids in the block
+	long long last_id;
+};
+
+// A message read back from a block
+struct archive_message
+{
+	long long id;
+	time_t time;
+	long long userid;
+	int nick;                       // Nick id
+	char message[ARCHIVE_MESSAGE_LEN];
+};
+
+// A decompressed block kept for reuse
+struct archive_cache_entry
+{
+	int channel;                    // Channel and segment, 0 for an empty entry
+	long long segment;
+	long long offset;
+	char* data;
+	int length;
+	unsigned long long used;        // Cache clock when last used, the least recent entry is replaced
+};
+
+// Old messages moved out of the messages table into immutable segment files,
+// one for each run of a day's messages in a channel, made of zlib compressed
+// blocks. The database indexes them (archive_segments, archive_blocks and
+// archive_users), and readers go through a small cache of decompressed blocks
+// shared by every thread.
+struct archive
+{
+	char* directory;                // Where segment files go, NULL if messages aren't archived
+	int age;                        // Days messages stay in the database before they're archived
+
+	pthread_mutex_t lock;           // Guards the cache
+	struct archive_cache_entry* cache;
+	int cache_len;
+	unsigned long long clock;
+	unsigned long hits;             // Statistics
+	unsigned long misses;
+};
+
+// A segment file being written, a block at a time
+struct archive_segment
+{
+	struct archive* archive;
+	int channel;
+	time_t day;
+	long long first_id;             // Of the segment
+	char path[FILENAME_MAX];        // Where the file goes once it's finished
+	char temp_path[FILENAME_MAX];   // Where it's written until then
+	FILE* file;
+	long long offset;               // Where the next block goes
+
+	char* buffer;                   // Block being filled
+	size_t buffer_len;
+	size_t buffer_size;
+	long long block_first_id;
+	long long block_last_id;
+	time_t block_last_time;
+
+	struct archive_block* blocks;   // Blocks written so far
+	int block_count;
+};
+
+// Archive messages older than age days into directory, creating it if needed
+// directory may be NULL to leave messages in the database
+struct archive archive_create(const char* directory, int age, int cache_blocks);
+void archive_destroy(struct archive* archive);
+
+// Check if messages are being archived
+int archive_enabled(const struct archive* archive);
+
+// Fill in a block from a statement's columns day, segment, offset, size, length, first_id, last_id
+// starting at column
+void archive_block_column(sqlite3_stmt* statement, int column, int channel, struct archive_block* block);
+
+// Start writing a channel's segment for day, whose first message is first_id
+// Returns 1 on success
+int archive_segment_open(struct archive* archive, struct archive_segment* segment, int channel, time_t day, long long first_id);
+
+// Add the next message, in id order
+// Returns 1 on success
+int archive_segment_add(struct archive_segment* segment, long long id, time_t time, long long userid, int nick,
+                        struct logline_slice message);
+
+// Write the last block and move the file into place, segment->blocks then lists every block
+// Returns 1 on success
+int archive_segment_finish(struct archive_segment* segment);
+
+// Free a segment, removing its file if it wasn't finished
+void archive_segment_destroy(struct archive_segment* segment);
+
+// Read the first message in a block with an id of at least id
+// Returns 1 if there was one
+int archive_read_at_id(struct archive* archive, const struct archive_block* block, long long id,
+                       struct archive_message* message);
+
+// Read a user's message with userid from a block
+// Returns 1 if it was there
+int archive_read_user(struct archive* archive, const struct archive_block* block, int nick, long long userid,
+                      struct archive_message* message);
+
+#endif /* __ARCHIVE_H__ */
@@ -0,0 +1,60 @@
+#ifndef __CHANNEL_H__
+#define __CHANNEL_H__
+
+#include <time.h>
+#include <pthread.h>
+
+#include "store.h"
+#include "writer.h"
+#include "ingest.h"
+#include "tail.h"
+
+// File descriptors a channel's worker keeps open, the logfile, inotify and epoll,
+// with two more copies of the logfile while it's imported
+#define CHANNEL_FDS                 5
+
+// How channel workers import their logfiles
+struct channel_settings
+{
+	const char* import_mode;        // "mmap", "stream" or "parallel"
+	int import_threads;             // Threads for parallel import
+};
+
+// A logged channel, parsed and followed by its own worker thread, which
+// queues everything it parses for the writer thread
+struct channel
+{
+	int id;                         // Row in the channels table
+	const char* name;
+	const char* network;
+	const char* logfile;
+
+	time_t current_day;             // Current day (last encountered in log)
+	time_t latest_time_at_load;     // Latest time in the database at load
+	int messages_skipped;           // Messages skipped at this time
+	int messages_to_skip;           // Messages to skip at this time
+	int messages;                   // Messages in message table
+
+	struct store* store;            // For reading where the channel is up to
+	struct writer* writer;          // Writes everything the worker parses
+	struct ingest_batch ingest;     // Feeds parsed lines to the writer
+	struct tail tail;               // Follows the logfile
+	struct channel_settings settings;
+	pthread_t thread;
+};
+
+// Look up (or add) the channel and find where its logfile is up to in the database
+// id is -1 on failure
+struct channel channel_create(struct store* store, struct writer* writer,
+                              const char* network, const char* name, const char* logfile);
+void channel_destroy(struct channel* channel);
+
+// Start the worker, which imports the logfile then follows it
+// channel must stay at the same address until the worker exits
+// Returns 0, or an error id from errors.h
+int channel_start(struct channel* channel, const struct channel_settings* settings);
+
+// Wait for the worker to exit
+void channel_join(struct channel* channel);
+
+#endif /* __CHANNEL_H__ */
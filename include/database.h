@@ -0,0 +1,66 @@
+#ifndef __DATABASE_H__
+#define __DATABASE_H__
+
+#include <pthread.h>
+#include <sqlite3.h>
+
+// What a shared in-memory database is opened as, names starting with / are
+// shared by every connection in the process
+#define DATABASE_SHARED_MEMORY_URI  "file:/logwatcher?vfs=memdb"
+
+// How big a shared in-memory database can grow (memdb stops at 1GB by default)
+#define DATABASE_MEMORY_LIMIT       ((sqlite3_int64)1 << 40)
+
+// How long a connection waits for another to release a lock (ms)
+#define DATABASE_BUSY_TIMEOUT       5000
+
+// File descriptors a reader connection to a file database keeps open, the database and its WAL
+#define DATABASE_READER_FDS         2
+
+// A read only connection, held by one thread at a time
+struct database_reader
+{
+	struct database* database;
+	sqlite3* db;
+	int idle;                       // Left behind by a thread that has exited
+	struct database_reader* next;
+};
+
+// The database, with one connection for writing and a read only connection
+// for each thread that reads from it, so readers don't queue on the writer's
+// connection. File databases use WAL journaling so reads carry on while the
+// writer commits, and :memory: can be shared between connections through
+// the memdb VFS. A private :memory: database only has the one connection,
+// which readers share.
+struct database
+{
+	const char* filename;           // From the config file
+	const char* uri;                // What each connection opens
+	int open_flags;                 // Extra flags for every connection
+	int memory;                     // Whether the database is in memory
+	int separate_readers;           // Whether readers get their own connections
+	int wal;                        // Whether the journal is in WAL mode
+
+	sqlite3* writer;                // Setup, ingest and every other write
+
+	pthread_key_t reader_key;       // Calling thread's reader
+	pthread_mutex_t lock;           // Guards readers
+	struct database_reader* readers;
+	int reader_count;               // Read connections opened
+};
+
+// shared_memory shares a :memory: database between connections
+struct database database_create(const char* filename, int shared_memory);
+
+// Open the writer connection, database must stay at the same address until database_close
+// Returns an sqlite return code, see sqlite3_errmsg(database->writer) on failure
+int database_open(struct database* database);
+
+// Close every connection, once nothing is reading or writing
+void database_close(struct database* database);
+
+// Get the calling thread's read only connection, opening it on first use
+// Returns the writer connection if readers can't have their own
+sqlite3* database_reader(struct database* database);
+
+#endif /* __DATABASE_H__ */
@@ -31,4 +31,55 @@
 #define CONFIG_LOAD_FAILURE                     "Failed to load config file: %s at line %d\n"
 #define CONFIG_LOAD_FAILURE_ID                  10
 
+#define CHANNEL_CREATION_FAILURE                "Failed to add channel %s to database\n"
+#define CHANNEL_CREATION_FAILURE_ID             11
+
+#define CHANNEL_THREAD_FAILURE                  "Failed to start worker for channel %s\n"
+#define CHANNEL_THREAD_FAILURE_ID               12
+
+#define WRITER_THREAD_FAILURE                   "Failed to start writer thread\n"
+#define WRITER_THREAD_FAILURE_ID                13
+
+#define SEARCH_BACKFILL_FAILURE                 "Failed to index older messages for search, messages before id %lld won't be found\n"
+#define SEARCH_BACKFILL_FAILURE_ID              14
+
+#define ARCHIVE_DIRECTORY_FAILURE               "Failed to create archive directory %s: %s\n"
+#define ARCHIVE_DIRECTORY_FAILURE_ID            15
+
+#define ARCHIVE_WRITE_FAILURE                   "Failed to write archive segment %s: %s\n"
+#define ARCHIVE_WRITE_FAILURE_ID                16
+
+#define ARCHIVE_READ_FAILURE                    "Failed to read archive segment %s: %s\n"
+#define ARCHIVE_READ_FAILURE_ID                 17
+
+#define ARCHIVE_FAILURE                         "Failed to archive messages from channel %d, trying again in %ds\n"
+#define ARCHIVE_FAILURE_ID                      18
+
+#define SNAPSHOT_RESTORE_FAILURE                "Failed to restore snapshot %s: %s, starting from an empty database\n"
+#define SNAPSHOT_RESTORE_FAILURE_ID             19
+
+#define SNAPSHOT_FAILURE                        "Failed to write snapshot %s: %s, trying again later\n"
+#define SNAPSHOT_FAILURE_ID                     20
+
+#define REATTRIBUTE_FAILURE                     "Failed to move messages from alias %s in channel %d to its main nick, leaving them until the next restart\n"
+#define REATTRIBUTE_FAILURE_ID                  21
+
+#define HTTPD_MODE_INVALID                      "Unknown httpd_mode %s, expected epoll, poll, select or thread_per_connection\n"
+#define HTTPD_MODE_INVALID_ID                   22
+
+#define DATABASE_WAL_FAILURE                    "Warning: couldn't switch %s to WAL journaling, readers will wait for commits\n"
+#define DATABASE_WAL_FAILURE_ID                 23
+
+#define WRITER_COMMIT_BUSY                      "Commit held up by readers, trying again (%d tries so far)\n"
+#define WRITER_COMMIT_BUSY_ID                   24
+
+#define WRITER_COMMIT_REPLAYED                  "Failed to commit %d lines (%s), writing them again in %dms\n"
+#define WRITER_COMMIT_REPLAYED_ID               25
+
+#define WRITER_COMMIT_DROPPED                   "Failed to commit %d lines while stopping, they'll be read again from the logfiles at the next start\n"
+#define WRITER_COMMIT_DROPPED_ID                27
+
+#define SNAPSHOT_RESTARTED                      "Snapshot %s was restarted by a commit, copying the rest in one step\n"
+#define SNAPSHOT_RESTARTED_ID                   26
+
 #endif /* __ERRORS_H__ */
@@ -0,0 +1,69 @@
+#ifndef __HTTPD_H__
+#define __HTTPD_H__
+
+#include <stdatomic.h>
+#include <microhttpd.h>
+
+#define HTTPD_DEFAULT_CONNECTION_LIMIT  10000
+#define HTTPD_DEFAULT_TIMEOUT           120
+#define HTTPD_DEFAULT_MAX_RENDERING     32
+
+// File descriptors kept back from the connection limit on top of the configured reserved_fds,
+// for stdio, the writer's database, the snapshot and libraries
+#define HTTPD_RESERVED_FDS              32
+
+// File descriptors each pool thread keeps open to wait on its connections
+#define HTTPD_THREAD_FDS                2
+
+// Seconds clients turned away are asked to wait before trying again
+#define HTTPD_RETRY_AFTER               "1"
+
+// How the httpd is configured
+struct httpd_settings
+{
+	const char* mode;               // "epoll", "poll", "select" or "thread_per_connection"
+	int threads;                    // Thread pool size, 0 for one per core (not thread_per_connection)
+	int connection_limit;           // Most open connections, 0 for HTTPD_DEFAULT_CONNECTION_LIMIT
+	int per_ip_connection_limit;    // Most open connections from one address, 0 for no limit
+	int timeout;                    // Seconds an idle connection is kept open, 0 to keep it forever
+	int max_rendering;              // Most pages rendered at once before requests are turned away, 0 for no limit
+	int reserved_fds;               // File descriptors the rest of the program keeps open
+	int reader_fds;                 // File descriptors each thread's database reader keeps open
+};
+
+// The stats httpd. Idle keep-alive connections only cost a file descriptor and
+// a little memory, so the connection limit can be in the thousands, while pages
+// rendered at once are limited separately: past max_rendering, requests needing
+// a page rendered are answered with a 503 straight away, and pages the page
+// cache still has are served as usual.
+struct httpd
+{
+	struct MHD_Daemon* daemon;
+	struct MHD_Response* unavailable; // Shared 503 response
+	atomic_int rendering;           // Pages being rendered
+	int max_rendering;
+	atomic_ulong shed;              // Requests turned away, for statistics
+};
+
+struct httpd httpd_create();
+void httpd_destroy(struct httpd* httpd);
+
+// Start serving on port, handing every request to handler
+// Returns 0, or an error id from errors.h
+int httpd_start(struct httpd* httpd, const struct httpd_settings* settings, int port,
+                MHD_AccessHandlerCallback handler, void* handler_cls);
+
+// Stop serving
+void httpd_stop(struct httpd* httpd);
+
+// Count a page starting to render
+// Returns 0, counting nothing, if max_rendering pages are already being rendered
+int httpd_render_begin(struct httpd* httpd);
+
+// Count a page finished rendering
+void httpd_render_end(struct httpd* httpd);
+
+// Turn a request away with a 503
+int httpd_queue_unavailable(struct httpd* httpd, struct MHD_Connection* connection);
+
+#endif /* __HTTPD_H__ */
@@ -0,0 +1,29 @@
+#ifndef __IMPORT_H__
+#define __IMPORT_H__
+
+#include <time.h>
+#include <sys/types.h>
+
+#include "ingest.h"
+
+#define IMPORT_BLOCK_SIZE    (1024 * 1024)
+#define IMPORT_SHARD_SIZE    (8 * 1024 * 1024)
+#define IMPORT_SHARDS_AHEAD  2
+
+// Feed every complete line of fd from offset onwards into the ingest batch,
+// reading the file through mmap (or large blocks if it can't be mapped)
+// Returns the offset just past the last complete line, an incomplete last
+// line is left for the streaming reader
+off_t import_file(int fd, off_t offset, struct ingest_batch* batch);
+
+// Import into an empty database using a pool of threads
+// The file is split into shards at day markers, each shard is parsed by a
+// worker with its own current day, and shards are queued in file order for the
+// writer thread, which writes each with one message count update per user
+// day is the current day at offset, and is set to the current day at the end
+// messages is increased by the number of messages queued
+// Returns the offset just past the last complete line
+off_t import_parallel(int fd, off_t offset, int threads, struct ingest_batch* batch,
+                      time_t* day, int* messages);
+
+#endif /* __IMPORT_H__ */
@@ -0,0 +1,50 @@
+#ifndef __INGEST_H__
+#define __INGEST_H__
+
+#include <time.h>
+#include <sys/types.h>
+
+#include "store.h"
+#include "writer.h"
+#include "logline.h"
+
+// Feeds one channel's logfile into the writer, keeping track of how far
+// through the logfile each queued record is so the writer can checkpoint it
+struct ingest_batch
+{
+	struct writer* writer;
+	int channel;                   // Channel lines are written to
+	void (*parse)(void* context, const char* line, size_t len);
+	void* context;                 // Passed to parse
+
+	long long inode;               // Logfile being read, 0 if not checkpointing
+	off_t position;                // Offset just past the last line counted
+	const time_t* day;             // Parser's current day
+
+	unsigned long lines;           // Lines read
+	int unqueued;                  // Lines read since the last record was queued
+};
+
+struct ingest_batch ingest_create(struct writer* writer, int channel,
+                                  void (*parse)(void* context, const char* line, size_t len), void* context);
+
+// Checkpoint fd's position (and the parser's current day) with every record
+// offset is where the next line counted starts
+void ingest_track(struct ingest_batch* batch, int fd, off_t offset, const time_t* day);
+
+// Count a line and parse it
+void ingest_line(struct ingest_batch* batch, const char* line, size_t len);
+
+// Count lines (bytes long in total) read without ingest_line
+void ingest_count(struct ingest_batch* batch, int lines, size_t bytes);
+
+// Queue a topic or message from the line being parsed
+void ingest_topic(struct ingest_batch* batch, time_t time, struct logline_slice nick, struct logline_slice topic);
+void ingest_message(struct ingest_batch* batch, time_t time, struct logline_slice nick, struct logline_slice message);
+
+// Queue a call to write the lines counted since the last record on the writer thread
+// call is run again if its transaction is rolled back, and done (which may be NULL) once it's committed
+void ingest_call(struct ingest_batch* batch, void (*call)(struct store* store, void* arg),
+                 void (*done)(void* arg), void* arg);
+
+#endif /* __INGEST_H__ */
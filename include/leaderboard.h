@@ -0,0 +1,79 @@
+#ifndef __LEADERBOARD_H__
+#define __LEADERBOARD_H__
+
+#include <time.h>
+#include <stdatomic.h>
+
+// Users in each published snapshot
+#define LEADERBOARD_SNAPSHOT_SIZE  100
+
+// Longer nicks are cut short in snapshots
+#define LEADERBOARD_NICK_LEN       64
+
+// A user, as the writer thread keeps them
+struct leaderboard_user
+{
+	int nick;                       // Nick id
+	const char* name;               // Nick, owned by whoever added the user
+	int messages;
+	time_t lastseen;
+	int rank;                       // Position in order
+};
+
+// A user, as readers see them
+struct leaderboard_entry
+{
+	int nick;                       // Nick id
+	char name[LEADERBOARD_NICK_LEN];
+	int messages;
+	time_t lastseen;
+};
+
+struct leaderboard_snapshot
+{
+	int count;
+	struct leaderboard_entry entries[LEADERBOARD_SNAPSHOT_SIZE];
+};
+
+// A channel's users ranked by message count, kept up to date by the writer
+// thread as messages are written. The top of the ranking is published to
+// readers as an immutable snapshot, so reading it never touches the database
+// or blocks the writer. There are two snapshots: readers count themselves in
+// to the current one, and the writer fills the other once its last reader
+// has left, then makes it current.
+struct leaderboard
+{
+	// Writer thread only
+	struct leaderboard_user* users;
+	int user_count, user_max;
+	int* order;                     // User indexes, most messages first
+	int* by_nick;                   // Nick id => user index + 1, 0 for nicks without a user
+	int by_nick_len;
+	int changed;                    // The top of the ranking changed since it was published
+
+	struct leaderboard_snapshot snapshots[2];
+	atomic_int current;             // Snapshot readers should use
+	atomic_int readers[2];          // Readers using each snapshot
+};
+
+struct leaderboard leaderboard_create();
+void leaderboard_destroy(struct leaderboard* leaderboard);
+
+// Forget every user (writer thread only)
+void leaderboard_clear(struct leaderboard* leaderboard);
+
+// Count count messages towards the nick with id nick, lastseen being the latest of them (writer thread only)
+// name is only read when publishing, and must stay valid until the leaderboard is cleared
+// count can be negative to take messages away, and users left without any are dropped
+// Returns the user's message count before, or -1 if the user is new
+int leaderboard_add(struct leaderboard* leaderboard, int nick, const char* name, int count, time_t lastseen);
+
+// Make changes visible to readers (writer thread only)
+// leaderboard must stay at the same address from the first publish
+void leaderboard_publish(struct leaderboard* leaderboard);
+
+// Copy up to count users, starting offset users from the top, from the latest snapshot
+// Returns the number copied, which stops at LEADERBOARD_SNAPSHOT_SIZE
+int leaderboard_read(struct leaderboard* leaderboard, struct leaderboard_entry* entries, int count, int offset);
+
+#endif /* __LEADERBOARD_H__ */
@@ -0,0 +1,64 @@
+#ifndef __LOGLINE_H__
+#define __LOGLINE_H__
+
+#include <stddef.h>
+#include <time.h>
+
+// Kinds of irssi log line we care about
+enum logline_kind
+{
+	LOGLINE_OTHER,          // Anything else (joins, parts, modes...)
+	LOGLINE_LOG_OPENED,     // --- Log opened Mon Jan 04 10:00:00 2010
+	LOGLINE_DAY_CHANGED,    // --- Day changed Mon Jan 04 2010
+	LOGLINE_TOPIC,          // 10:00 -!- nick changed the topic of #chan to: topic
+	LOGLINE_MESSAGE,        // 10:00 <@nick> message
+	LOGLINE_BAD_DATE        // A log opened or day changed line with a date we can't read
+};
+
+// A view into the line being tokenized (not null terminated)
+struct logline_slice
+{
+	const char* ptr;
+	size_t len;
+};
+
+// A tokenized line, slices point into the original buffer
+struct logline
+{
+	enum logline_kind kind;
+
+	// Date, set for LOG_OPENED and DAY_CHANGED
+	int year;
+	int month;              // 0-11
+	int day;
+
+	// Time of day, set for TOPIC and MESSAGE
+	int hour;
+	int minute;
+
+	// Set for TOPIC and MESSAGE, the nick of a message includes its mode character
+	struct logline_slice nick;
+	struct logline_slice message;
+};
+
+// Classify and split a line in a single pass without allocating
+// len may include the trailing newline
+// Returns the kind of line, which is also stored in out->kind
+enum logline_kind logline_tokenize(const char* line, size_t len, struct logline* out);
+
+// Whether a line is a log opened or day changed marker, without tokenizing it
+int logline_is_day_marker(const char* line, size_t len);
+
+// Unix time of midnight (local time) on the date of a LOG_OPENED or DAY_CHANGED line
+time_t logline_day(const struct logline* line);
+
+// Unix time of a TOPIC or MESSAGE line, given the day it was logged on
+time_t logline_time(const struct logline* line, time_t day);
+
+// FNV-1a hash of a nick ignoring ASCII case, matching sqlite's nocase collation
+unsigned int logline_nick_hash(const char* nick, size_t len);
+
+// Whether two nicks are the same ignoring ASCII case
+int logline_nick_equal(const char* a, size_t a_len, const char* b, size_t b_len);
+
+#endif /* __LOGLINE_H__ */
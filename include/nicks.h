@@ -0,0 +1,41 @@
+#ifndef __NICKS_H__
+#define __NICKS_H__
+
+#include <stddef.h>
+#include <sqlite3.h>
+
+#include "logline.h"
+
+// Case insensitive (like collate nocase) table of nick => id, mirroring the nicks table
+// so ids can be found without a query. Only the writer thread uses it once loaded.
+struct nick_table
+{
+	char** nicks;                   // Nick for each id, NULL for ids not in use
+	size_t* nick_lens;
+	int nick_max;                   // Length of nicks, ids are always below it
+	int* table;                     // Open addressed, id for each slot, 0 for empty slots
+	size_t table_len;               // Always a power of two
+	size_t count;
+};
+
+struct nick_table nick_create();
+void nick_destroy(struct nick_table* table);
+
+// Forget every nick
+void nick_clear(struct nick_table* table);
+
+// Add a nick with the id the nicks table gave it
+void nick_add(struct nick_table* table, int id, struct logline_slice nick);
+
+// Add every nick in the nicks table
+// Returns the number of nicks loaded
+int nick_load(struct nick_table* table, sqlite3* db);
+
+// Get a nick's id, or 0 if it isn't in the table (ids start at 1)
+int nick_find(const struct nick_table* table, struct logline_slice nick);
+
+// Get the nick with an id, or NULL if there isn't one
+// The nick stays valid until the table is cleared
+const char* nick_name(const struct nick_table* table, int id);
+
+#endif /* __NICKS_H__ */
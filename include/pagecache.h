@@ -0,0 +1,98 @@
+#ifndef __PAGECACHE_H__
+#define __PAGECACHE_H__
+
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "stringstream.h"
+
+#define PAGE_CACHE_DEFAULT_ENTRIES  64
+#define PAGE_CACHE_KEY_LEN          512
+
+// Content codings pages can be sent in
+enum page_encoding
+{
+	PAGE_IDENTITY,
+	PAGE_GZIP,
+	PAGE_DEFLATE,
+};
+
+// What a page was rendered from, for telling clients whether theirs is still current
+struct page_version
+{
+	unsigned long generation;       // Store generation
+	time_t modified;                // When that generation could first be seen, or earlier
+};
+
+// A rendered page kept for reuse
+struct page_cache_entry
+{
+	char key[PAGE_CACHE_KEY_LEN];   // Channel, mode and arguments, empty for an empty entry
+	char* data;
+	size_t length;
+	char* deflated;                 // Raw deflate blocks of data ending in a sync flush, NULL if it couldn't be compressed
+	size_t deflated_length;
+	unsigned long crc;              // crc32 and adler32 of data, for gzip and deflate trailers
+	unsigned long adler;
+	struct page_version version;    // What the page was rendered from
+	struct timespec built;          // When it was rendered
+	unsigned long long used;        // Cache clock when last used, the least recent entry is replaced
+};
+
+// A response being built from a cached page, which more text can be added to
+// before it's finished
+struct page_encoder
+{
+	enum page_encoding encoding;
+	unsigned long check;            // crc32 (gzip) or adler32 (deflate) of the text so far
+	size_t length;                  // Bytes of text so far
+};
+
+// Pages rendered by generate_statistics, shared by every httpd thread. A page
+// stays current until the store's generation moves on, meaning the writer has
+// committed something readers can see, and is then still served for up to
+// min_refresh ms so pages aren't rebuilt after every batch under constant load.
+// Pages are compressed once as they're cached, leaving the stream open so the
+// html footer can be added uncompressed to each response without compressing
+// anything per request.
+struct page_cache
+{
+	int min_refresh;                // ms a page is served for after it's out of date, 0 to always rebuild
+
+	pthread_mutex_t lock;           // Guards the entries
+	struct page_cache_entry* entries;
+	int len;                        // 0 if pages aren't cached
+	unsigned long long clock;
+	atomic_ulong hits;              // Statistics
+	atomic_ulong misses;
+};
+
+// entries may be 0 to not cache pages
+struct page_cache page_cache_create(int entries, int min_refresh);
+void page_cache_destroy(struct page_cache* cache);
+
+// Add the page cached for key to ss in encoder's encoding if it's still current at version's
+// generation, and set version to what the page was rendered from
+// encoder is set to identity if the page couldn't be compressed, finish the response with page_encoder_finish
+// Returns 1 if it was
+int page_cache_get(struct page_cache* cache, const char* key, struct page_version* version,
+                   struct page_encoder* encoder, struct stringstream* ss);
+
+// page_cache_get without counting a hit or miss, for the request that has just put the page
+int page_cache_read(struct page_cache* cache, const char* key, struct page_version* version,
+                    struct page_encoder* encoder, struct stringstream* ss);
+
+// Keep a copy of the page for key, rendered from version, in place of the least recently used one
+void page_cache_put(struct page_cache* cache, const char* key, const struct page_version* version, const char* data, size_t length);
+
+// Pick the encoding to send from an Accept-Encoding header, which may be NULL
+enum page_encoding page_encoding_accepted(const char* accept_encoding);
+
+// Content-Encoding for an encoding, NULL for identity
+const char* page_encoding_name(enum page_encoding encoding);
+
+// Add text to a response started by page_cache_get and finish it
+void page_encoder_finish(struct page_encoder* encoder, struct stringstream* ss, const char* text);
+
+#endif /* __PAGECACHE_H__ */
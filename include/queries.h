@@ -1,32 +1,173 @@
 #ifndef __QUERIES_H__
 #define __QUERIES_H__
 
-#define TABLE_CREATION                   "CREATE TABLE IF NOT EXISTS messages(id INTEGER PRIMARY KEY, userid INTEGER, nick text collate nocase, message text, time DATE);" \
-                                         "CREATE TABLE IF NOT EXISTS users(id INTEGER PRIMARY KEY, nick text collate nocase, messages int, lastseen DATE);" \
-                                         "CREATE TABLE IF NOT EXISTS topics(id INTEGER PRIMARY KEY, time DATE, nick text, topic text);" \
+#define TABLE_CREATION                   "CREATE TABLE IF NOT EXISTS channels(id INTEGER PRIMARY KEY, network text, name text collate nocase);" \
+                                         "CREATE TABLE IF NOT EXISTS nicks(id INTEGER PRIMARY KEY, nick text collate nocase UNIQUE);" \
+                                         "CREATE TABLE IF NOT EXISTS messages(id INTEGER PRIMARY KEY AUTOINCREMENT, channel INTEGER, userid INTEGER, nickid INTEGER, message text, time DATE);" \
+                                         "CREATE TABLE IF NOT EXISTS users(id INTEGER PRIMARY KEY, channel INTEGER, nickid INTEGER, messages int, lastseen DATE);" \
+                                         "CREATE TABLE IF NOT EXISTS topics(id INTEGER PRIMARY KEY, channel INTEGER, time DATE, nickid INTEGER, topic text);" \
                                          "CREATE TABLE IF NOT EXISTS aliases(id INTEGER PRIMARY KEY, nick text collate nocase, alias text);" \
-                                         "CREATE TEMPORARY TABLE IF NOT EXISTS top_users(id INTEGER PRIMARY KEY, userid INTEGER, nick text collate nocase, messages INTEGER, lastseen DATE);" \
-                                         "CREATE INDEX IF NOT EXISTS messages_index ON messages (userid);" \
-                                         "CREATE INDEX IF NOT EXISTS users_index ON users (messages);" \
-                                         "CREATE INDEX IF NOT EXISTS aliases_index ON aliases (alias);"
-#define INSERT_MESSAGE                   "INSERT INTO messages (userid, nick, message, time) " \
-                                         "SELECT (SELECT messages FROM users WHERE nick=(IFNULL((SELECT alias FROM aliases WHERE nick=$nick), $nick))), " \
-                                         "(IFNULL((SELECT alias FROM aliases WHERE nick=$nick), $nick)), $message, #time;"
-#define INSERT_TOPIC                     "INSERT INTO topics (time, nick, topic) SELECT #time, IFNULL((SELECT alias FROM aliases WHERE nick=$nick), $nick), $message;"
-#define INSERT_MESSAGE_COUNT             "INSERT INTO users (nick, messages, lastseen) SELECT IFNULL((SELECT alias FROM aliases WHERE nick=$nick), $nick), 1, #lastseen;"
-#define INCREMENT_MESSAGE_COUNT          "UPDATE users SET messages=messages+1, lastseen=#lastseen WHERE nick=IFNULL((SELECT alias FROM aliases WHERE nick=$nick), $nick);"
+                                         "CREATE TABLE IF NOT EXISTS checkpoint(id INTEGER PRIMARY KEY, inode INTEGER, size INTEGER, offset INTEGER, day DATE);" \
+                                         "CREATE TABLE IF NOT EXISTS activity_hours(channel INTEGER, hour DATE, nickid INTEGER, messages int, PRIMARY KEY (channel, hour, nickid)) WITHOUT ROWID;" \
+                                         "CREATE TABLE IF NOT EXISTS activity_days(channel INTEGER, day DATE, messages int, PRIMARY KEY (channel, day)) WITHOUT ROWID;" \
+                                         "CREATE VIRTUAL TABLE IF NOT EXISTS messages_search USING fts5(message, content='messages', content_rowid='id');" \
+                                         "CREATE TABLE IF NOT EXISTS search_backfill(id INTEGER PRIMARY KEY, next INTEGER, last INTEGER);" \
+                                         "CREATE TABLE IF NOT EXISTS archive_segments(channel INTEGER, first_id INTEGER, last_id INTEGER, day DATE, messages int, last_time DATE, last_count int, PRIMARY KEY (channel, first_id)) WITHOUT ROWID;" \
+                                         "CREATE TABLE IF NOT EXISTS archive_blocks(channel INTEGER, last_id INTEGER, first_id INTEGER, day DATE, segment INTEGER, offset INTEGER, size int, length int, PRIMARY KEY (channel, last_id)) WITHOUT ROWID;" \
+                                         "CREATE TABLE IF NOT EXISTS archive_users(channel INTEGER, nickid INTEGER, userid INTEGER, block INTEGER, PRIMARY KEY (channel, nickid, userid)) WITHOUT ROWID;" \
+                                         "CREATE TABLE IF NOT EXISTS archive_user_records(channel INTEGER, nickid INTEGER, userid INTEGER, record_nickid INTEGER, record_userid INTEGER, PRIMARY KEY (channel, nickid, userid)) WITHOUT ROWID;" \
+                                         "CREATE TABLE IF NOT EXISTS archive_messages(id INTEGER PRIMARY KEY, channel INTEGER, nickid INTEGER);"
+// Fails on new databases, which are created at the latest schema version
+#define SELECT_MESSAGES_TABLE            "SELECT id FROM messages LIMIT 0;"
+// Readers carry on while the writer commits
+#define ENABLE_WAL                       "PRAGMA journal_mode=WAL;"
+#define WAL_SYNCHRONOUS                  "PRAGMA synchronous=NORMAL;"
+// Databases from before channels were added have everything in channel 1
+#define SELECT_CHANNEL_COLUMN            "SELECT channel FROM messages LIMIT 0;"
+#define ADD_CHANNEL_COLUMNS              "ALTER TABLE messages ADD COLUMN channel INTEGER NOT NULL DEFAULT 1;" \
+                                         "ALTER TABLE users ADD COLUMN channel INTEGER NOT NULL DEFAULT 1;" \
+                                         "ALTER TABLE topics ADD COLUMN channel INTEGER NOT NULL DEFAULT 1;"
+#define INDEX_CREATION                   "CREATE UNIQUE INDEX IF NOT EXISTS channels_index ON channels (network, name);" \
+                                         "CREATE INDEX IF NOT EXISTS messages_user_index ON messages (channel, nickid, userid);" \
+                                         "CREATE INDEX IF NOT EXISTS messages_id_index ON messages (channel, id);" \
+                                         "CREATE INDEX IF NOT EXISTS messages_time_index ON messages (channel, time);" \
+                                         "CREATE INDEX IF NOT EXISTS topics_channel_index ON topics (channel, time);" \
+                                         "CREATE INDEX IF NOT EXISTS users_channel_index ON users (channel, messages);" \
+                                         "CREATE INDEX IF NOT EXISTS users_channel_nick_index ON users (channel, nickid);" \
+                                         "CREATE INDEX IF NOT EXISTS aliases_index ON aliases (alias);" \
+                                         "CREATE UNIQUE INDEX IF NOT EXISTS aliases_nick_index ON aliases (nick);" \
+                                         "CREATE INDEX IF NOT EXISTS activity_hours_nick_index ON activity_hours (channel, nickid, hour);"
+// Schema changes that existing databases are brought up to once, in order
+#define SELECT_SCHEMA_VERSION            "PRAGMA user_version;"
+#define SET_SCHEMA_VERSION               "PRAGMA user_version=%d;"
+// A message's userid is its position among its user's messages in the channel, from 0
+#define MIGRATE_USER_SEQUENCES           "UPDATE messages SET userid=sequences.userid FROM (SELECT id, row_number() OVER (PARTITION BY channel, nick ORDER BY id) - 1 AS userid FROM messages) AS sequences WHERE messages.id=sequences.id;" \
+                                         "UPDATE users SET messages=counts.messages FROM (SELECT channel, nick, Count(*) AS messages FROM messages GROUP BY channel, nick) AS counts WHERE users.channel=counts.channel AND users.nick=counts.nick;" \
+                                         "DROP INDEX IF EXISTS messages_channel_index;" \
+                                         "PRAGMA user_version=1;"
+// Nicks are stored once in nicks, and referred to by id
+#define MIGRATE_NICK_IDS                 "INSERT OR IGNORE INTO nicks (nick) SELECT nick FROM users WHERE nick IS NOT NULL ORDER BY id;" \
+                                         "INSERT OR IGNORE INTO nicks (nick) SELECT nick FROM messages WHERE nick IS NOT NULL ORDER BY id;" \
+                                         "INSERT OR IGNORE INTO nicks (nick) SELECT nick FROM topics WHERE nick IS NOT NULL ORDER BY id;" \
+                                         "CREATE TABLE messages_nickid(id INTEGER PRIMARY KEY, channel INTEGER, userid INTEGER, nickid INTEGER, message text, time DATE);" \
+                                         "INSERT INTO messages_nickid SELECT id, channel, userid, (SELECT id FROM nicks WHERE nicks.nick=messages.nick), message, time FROM messages ORDER BY id;" \
+                                         "DROP TABLE messages;" \
+                                         "ALTER TABLE messages_nickid RENAME TO messages;" \
+                                         "CREATE TABLE users_nickid(id INTEGER PRIMARY KEY, channel INTEGER, nickid INTEGER, messages int, lastseen DATE);" \
+                                         "INSERT INTO users_nickid SELECT id, channel, (SELECT id FROM nicks WHERE nicks.nick=users.nick), messages, lastseen FROM users ORDER BY id;" \
+                                         "DROP TABLE users;" \
+                                         "ALTER TABLE users_nickid RENAME TO users;" \
+                                         "CREATE TABLE topics_nickid(id INTEGER PRIMARY KEY, channel INTEGER, time DATE, nickid INTEGER, topic text);" \
+                                         "INSERT INTO topics_nickid SELECT id, channel, time, (SELECT id FROM nicks WHERE nicks.nick=topics.nick), topic FROM topics ORDER BY id;" \
+                                         "DROP TABLE topics;" \
+                                         "ALTER TABLE topics_nickid RENAME TO topics;" \
+                                         "PRAGMA user_version=2;"
+// Hourly and daily message counts, kept up to date as messages are written
+#define MIGRATE_ACTIVITY                 "INSERT INTO activity_hours (channel, hour, nickid, messages) SELECT channel, time - time % 3600, nickid, Count(*) FROM messages WHERE nickid IS NOT NULL GROUP BY channel, time - time % 3600, nickid;" \
+                                         "INSERT INTO activity_days (channel, day, messages) SELECT channel, time - time % 86400, Count(*) FROM messages WHERE nickid IS NOT NULL GROUP BY channel, time - time % 86400;" \
+                                         "PRAGMA user_version=3;"
+// Messages already in the database are indexed for search a chunk at a time by the writer
+#define MIGRATE_SEARCH                   "INSERT INTO search_backfill (id, next, last) SELECT 1, min(id), max(id) FROM messages HAVING Count(*) > 0;" \
+                                         "PRAGMA user_version=4;"
+// Aliases are keyed by alias, keeping the first of any mappings added more than once
+#define MIGRATE_ALIAS_KEY                "DELETE FROM aliases WHERE id NOT IN (SELECT min(id) FROM aliases GROUP BY nick);" \
+                                         "PRAGMA user_version=5;"
+// Message ids are never handed out again, even once every message has been archived, and carry
+// on from the last archived one
+#define MIGRATE_MESSAGE_IDS              "CREATE TABLE messages_autoincrement(id INTEGER PRIMARY KEY AUTOINCREMENT, channel INTEGER, userid INTEGER, nickid INTEGER, message text, time DATE);" \
+                                         "INSERT INTO messages_autoincrement SELECT id, channel, userid, nickid, message, time FROM messages ORDER BY id;" \
+                                         "DROP TABLE messages;" \
+                                         "ALTER TABLE messages_autoincrement RENAME TO messages;" \
+                                         "DELETE FROM sqlite_sequence WHERE name='messages';" \
+                                         "INSERT INTO sqlite_sequence (name, seq) SELECT 'messages', ifnull(max(id), 0) FROM (SELECT max(id) AS id FROM messages UNION ALL SELECT max(last_id) FROM archive_segments UNION ALL SELECT max(id) FROM archive_messages);" \
+                                         "PRAGMA user_version=6;"
+// Gives back the space freed by a migration
+#define VACUUM                           "VACUUM;"
+#define INSERT_CHANNEL                   "INSERT OR IGNORE INTO channels (network, name) VALUES ($network, $name);"
+#define SELECT_CHANNEL                   "SELECT id FROM channels WHERE network=$network AND name=$name;"
+#define INSERT_MESSAGE                   "INSERT INTO messages (channel, userid, nickid, message, time) VALUES ($channel, $userid, $nickid, $message, #time);"
+#define INSERT_SEARCH                    "INSERT INTO messages_search (rowid, message) SELECT id, message FROM messages WHERE id>=$first AND id<=$last;"
+#define INSERT_TOPIC                     "INSERT INTO topics (channel, time, nickid, topic) VALUES ($channel, #time, $nickid, $message);"
+#define INSERT_MESSAGE_COUNT             "INSERT INTO users (channel, nickid, messages, lastseen) VALUES ($channel, $nickid, $count, #lastseen);"
+#define SELECT_USERS                     "SELECT nickid, messages, lastseen FROM users WHERE channel=?;"
+#define ADD_MESSAGE_COUNT                "UPDATE users SET messages=messages+$count, lastseen=MAX(lastseen, #lastseen) WHERE channel=$channel AND nickid=$nickid;"
 #define INSERT_ALIAS                     "INSERT INTO aliases (nick, alias) VALUES ($nick, $alias);"
-#define SELECT_TOP_USERS                 "SELECT nick, messages, lastseen FROM users ORDER BY messages DESC LIMIT ? OFFSET ?;"
-#define SELECT_RANDOM_MESSAGES           "SELECT nick, message FROM messages WHERE id IN (SELECT ABS(random() % (SELECT max(id) FROM messages)) FROM messages LIMIT ?);"
-#define SELECT_RANDOM_MESSAGES_USER      "SELECT message FROM messages WHERE nick=$nick AND userid IN (SELECT ABS(random() % (SELECT max(userid) FROM messages WHERE nick=$nick)) FROM messages LIMIT ?);"
-// TODO: make this update userids or this won't work
-// #define UPDATE_NEW_ALIASES               "UPDATE messages SET nick=(SELECT nick FROM aliases WHERE alias=messages.nick);"
-#define CLEAR_TOP_USERS_TABLE            "DELETE FROM top_users;"
-#define PREPARE_TOP_USERS_TABLE          "INSERT INTO top_users (userid, nick, messages, lastseen) SELECT abs(random() % users.messages), nick, messages, lastseen FROM users ORDER BY messages DESC LIMIT ?;"
-#define SELECT_TOP_USERS_TABLE           "SELECT top_users.nick, top_users.messages, messages.message, top_users.lastseen FROM top_users LEFT JOIN messages ON top_users.userid = messages.userid AND top_users.nick == messages.nick ORDER BY messages DESC;"
-#define SELECT_LATEST_MESSAGES           "SELECT time, nick, message FROM messages ORDER BY time DESC LIMIT ?;"
-#define SELECT_MESSAGE_COUNT_AT_TIME     "SELECT Count(*) FROM messages WHERE time=? ORDER BY id ASC;"
-#define SELECT_LATEST_TOPICS             "SELECT time, nick, topic FROM topics ORDER BY time DESC LIMIT ?;"
-#define SELECT_MESSAGE_COUNT             "SELECT Count(*) FROM messages;"
+#define SELECT_ALIASES                   "SELECT nick, alias FROM aliases ORDER BY id;"
+#define UPDATE_ALIAS                     "UPDATE aliases SET alias=$alias WHERE nick=$nick;"
+#define DELETE_ALIAS                     "DELETE FROM aliases WHERE nick=$nick;"
+#define INSERT_NICK                      "INSERT INTO nicks (nick) VALUES ($nick);"
+#define SELECT_NICKS                     "SELECT id, nick FROM nicks;"
+// Random messages are picked by id, the first message in the channel at or after a random one in its range
+// Archived messages always come before the ones left in messages
+#define SELECT_MESSAGE_ID_RANGE          "SELECT coalesce((SELECT min(first_id) FROM archive_blocks WHERE channel=$channel), (SELECT min(id) FROM messages WHERE channel=$channel)), coalesce((SELECT max(id) FROM messages WHERE channel=$channel), (SELECT max(last_id) FROM archive_blocks WHERE channel=$channel));"
+#define SELECT_MESSAGE_AT_ID             "SELECT (SELECT nick FROM nicks WHERE id=messages.nickid), message FROM messages WHERE channel=? AND id>=? ORDER BY id LIMIT 1;"
+#define SELECT_USER_MESSAGE              "SELECT message FROM messages WHERE channel=? AND userid=? AND nickid=?;"
+#define SELECT_LATEST_MESSAGES           "SELECT time, (SELECT nick FROM nicks WHERE id=messages.nickid), message FROM messages WHERE channel=? ORDER BY time DESC LIMIT ?;"
+#define SELECT_MESSAGE_COUNT_AT_TIME     "SELECT Count(*) FROM messages WHERE channel=? AND time=? ORDER BY id ASC;"
+#define ADD_ACTIVITY_HOUR                "INSERT INTO activity_hours (channel, hour, nickid, messages) VALUES ($channel, #hour, $nickid, $count) ON CONFLICT (channel, hour, nickid) DO UPDATE SET messages=messages+excluded.messages;"
+#define ADD_ACTIVITY_DAY                 "INSERT INTO activity_days (channel, day, messages) VALUES ($channel, #day, $count) ON CONFLICT (channel, day) DO UPDATE SET messages=messages+excluded.messages;"
+#define SELECT_ACTIVITY_DAYS             "SELECT day, messages FROM activity_days WHERE channel=$channel AND day>=#from AND day<#to ORDER BY day LIMIT ?;"
+#define SELECT_ACTIVITY_HOURS            "SELECT hour, Sum(messages) FROM activity_hours WHERE channel=$channel AND hour>=#from AND hour<#to GROUP BY hour ORDER BY hour LIMIT ?;"
+// Buckets of $bucket seconds (an hour or a day) from one nick's hourly counts
+#define SELECT_ACTIVITY_NICK             "SELECT hour - hour % $bucket AS bucket, Sum(messages) FROM activity_hours WHERE channel=$channel AND nickid=(SELECT id FROM nicks WHERE nick=$nick) AND hour>=#from AND hour<#to GROUP BY bucket ORDER BY bucket LIMIT ?;"
+#define SELECT_LATEST_TOPICS             "SELECT time, (SELECT nick FROM nicks WHERE id=topics.nickid), topic FROM topics WHERE channel=? ORDER BY time DESC LIMIT ?;"
+#define SELECT_MESSAGE_COUNT             "SELECT (SELECT Count(*) FROM messages WHERE channel=$channel) + (SELECT coalesce(Sum(messages), 0) FROM archive_segments WHERE channel=$channel);"
+#define SELECT_NICK                      "SELECT nick FROM nicks WHERE id=?;"
+#define SELECT_NICK_ID                   "SELECT id FROM nicks WHERE nick=?;"
+// Segments of old messages, see archive.h
+#define SELECT_ARCHIVE_LATEST            "SELECT last_time, last_count FROM archive_segments WHERE channel=? ORDER BY first_id DESC LIMIT 1;"
+#define SELECT_ARCHIVE_BLOCK_AT_ID       "SELECT day, segment, offset, size, length, first_id, last_id FROM archive_blocks WHERE channel=? AND last_id>=? ORDER BY last_id LIMIT 1;"
+// The block holding a user's message is the last one they have a message in from before it, along with
+// the nick and userid written in the block for that message (which differ once an alias is re-attributed)
+// as the record's nick, userid, and the userid it applies from
+#define SELECT_ARCHIVE_USER_BLOCK        "SELECT archive_blocks.day, archive_blocks.segment, archive_blocks.offset, archive_blocks.size, archive_blocks.length, archive_blocks.first_id, archive_blocks.last_id, ifnull(archive_user_records.record_nickid, users.nickid), ifnull(archive_user_records.record_userid, users.userid), users.userid FROM (SELECT channel, nickid, userid, block FROM archive_users WHERE channel=$channel AND nickid=$nickid AND userid<=$userid ORDER BY userid DESC LIMIT 1) AS users JOIN archive_blocks ON archive_blocks.channel=users.channel AND archive_blocks.last_id=users.block LEFT JOIN archive_user_records ON archive_user_records.channel=users.channel AND archive_user_records.nickid=users.nickid AND archive_user_records.userid=users.userid;"
+// A day of messages is archived as a run of ids from the oldest
+#define SELECT_OLDEST_MESSAGE            "SELECT id, time FROM messages WHERE channel=? ORDER BY id LIMIT 1;"
+#define SELECT_ARCHIVE_MESSAGES          "SELECT id, time, userid, nickid, message FROM messages WHERE channel=? AND id>=? ORDER BY id;"
+#define INSERT_ARCHIVE_SEGMENT           "INSERT INTO archive_segments (channel, first_id, last_id, day, messages, last_time, last_count) VALUES (?, ?, ?, ?, ?, ?, ?);"
+#define INSERT_ARCHIVE_BLOCK             "INSERT INTO archive_blocks (channel, last_id, first_id, day, segment, offset, size, length) VALUES (?, ?, ?, ?, ?, ?, ?, ?);"
+#define INSERT_ARCHIVE_USERS             "INSERT INTO archive_users (channel, nickid, userid, block) SELECT channel, nickid, min(userid), $last FROM messages WHERE channel=$channel AND id>=$first AND id<=$last GROUP BY nickid;"
+#define INSERT_ARCHIVED_MESSAGES         "INSERT INTO archive_messages (id, channel, nickid) SELECT id, channel, nickid FROM messages WHERE channel=? AND id>=? AND id<=?;"
+#define DELETE_ARCHIVED_MESSAGES         "DELETE FROM messages WHERE channel=? AND id>=? AND id<=?;"
+#define SELECT_SEARCH_BACKFILL           "SELECT next, last FROM search_backfill WHERE id=1;"
+#define BACKFILL_SEARCH                  "INSERT INTO messages_search (rowid, message) SELECT id, message FROM messages WHERE id>=$next AND id<$end AND id<=$last;"
+#define UPDATE_SEARCH_BACKFILL           "UPDATE search_backfill SET next=$next WHERE id=1;"
+#define DELETE_SEARCH_BACKFILL           "DELETE FROM search_backfill WHERE id=1;"
+#define SEARCH_NICK_FILTER               "($nickid IS NULL OR coalesce(messages.nickid, archive_messages.nickid)=$nickid OR archive_messages.nickid IN (SELECT nicks.id FROM aliases JOIN nicks ON nicks.nick=aliases.nick WHERE aliases.alias=(SELECT nick FROM nicks WHERE id=$nickid) COLLATE NOCASE))"
+// Newest matches first, before message $before, read straight off the index
+// Archived messages have no row in messages, archive_messages has their channel and the nick they were written
+// with, which matches if it's the main nick or one of its aliases, and they're read from their segments
+#define SELECT_SEARCH                    "SELECT messages_search.rowid, messages_search.rank, messages.id IS NULL, messages.time, (SELECT nick FROM nicks WHERE id=messages.nickid), messages.message FROM messages_search LEFT JOIN messages ON messages.id=messages_search.rowid LEFT JOIN archive_messages ON messages.id IS NULL AND archive_messages.id=messages_search.rowid WHERE messages_search MATCH $query AND messages_search.rowid<$before AND coalesce(messages.channel, archive_messages.channel)=$channel AND " SEARCH_NICK_FILTER " ORDER BY messages_search.rowid DESC LIMIT $count;"
+// Best matches first (bm25 ranks are negative), after the ($rank, $id) of the last result seen
+#define SELECT_SEARCH_RANKED             "SELECT messages_search.rowid, messages_search.rank, messages.id IS NULL, messages.time, (SELECT nick FROM nicks WHERE id=messages.nickid), messages.message FROM messages_search LEFT JOIN messages ON messages.id=messages_search.rowid LEFT JOIN archive_messages ON messages.id IS NULL AND archive_messages.id=messages_search.rowid WHERE messages_search MATCH $query AND (messages_search.rank>$rank OR (messages_search.rank=$rank AND messages_search.rowid>$id)) AND coalesce(messages.channel, archive_messages.channel)=$channel AND " SEARCH_NICK_FILTER " ORDER BY messages_search.rank, messages_search.rowid LIMIT $count;"
+#define SELECT_CHECKPOINT                "SELECT inode, size, offset, day FROM checkpoint WHERE id=?;"
+#define UPDATE_CHECKPOINT                "INSERT OR REPLACE INTO checkpoint (id, inode, size, offset, day) VALUES (?, ?, ?, ?, ?);"
+#define BEGIN_TRANSACTION                "BEGIN IMMEDIATE;"
+#define COMMIT_TRANSACTION               "COMMIT;"
+#define ROLLBACK_TRANSACTION             "ROLLBACK;"
+// Archiving a segment is all or nothing, inside the writer's transaction or not
+#define SAVEPOINT_ARCHIVE                "SAVEPOINT archive;"
+#define RELEASE_ARCHIVE                  "RELEASE archive;"
+#define ROLLBACK_ARCHIVE                 "ROLLBACK TO archive;"
+// Moving an alias's messages over to its main nick, see store_reattribute
+// Parameters are bound by name, $alias being the alias's nick id and $nickid the main nick's
+#define SELECT_USER_NICKS                "SELECT channel, nickid, messages FROM users;"
+#define SELECT_USER                      "SELECT messages, lastseen FROM users WHERE channel=$channel AND nickid=$alias;"
+#define DELETE_USER                      "DELETE FROM users WHERE channel=$channel AND nickid=$alias;"
+// The alias's messages from userid $first up go on the end of the main nick's
+#define MOVE_MESSAGES                    "UPDATE messages SET nickid=$nickid, userid=userid+$shift WHERE channel=$channel AND nickid=$alias AND userid>=$first;"
+#define MOVE_UNCOUNTED_MESSAGES          "UPDATE messages SET nickid=$nickid WHERE id IN (SELECT id FROM messages WHERE channel=$channel AND nickid=$alias LIMIT $limit);"
+// A block holding message $first that starts with an earlier one needs a row of its own for the main nick
+#define MOVE_ARCHIVE_BOUNDARY            "INSERT INTO archive_users (channel, nickid, userid, block) SELECT channel, $nickid, $first+$shift, block FROM (SELECT channel, userid, block FROM archive_users WHERE channel=$channel AND nickid=$alias AND userid<=$first ORDER BY userid DESC LIMIT 1) WHERE userid<$first;"
+#define MOVE_ARCHIVE_BOUNDARY_RECORD     "INSERT OR REPLACE INTO archive_user_records (channel, nickid, userid, record_nickid, record_userid) SELECT users.channel, $nickid, $first+$shift, ifnull(archive_user_records.record_nickid, users.nickid), ifnull(archive_user_records.record_userid, users.userid)+$first-users.userid FROM (SELECT channel, nickid, userid FROM archive_users WHERE channel=$channel AND nickid=$alias AND userid<=$first ORDER BY userid DESC LIMIT 1) AS users LEFT JOIN archive_user_records ON archive_user_records.channel=users.channel AND archive_user_records.nickid=users.nickid AND archive_user_records.userid=users.userid WHERE users.userid<$first;"
+#define MOVE_ARCHIVE_RECORDS             "INSERT OR REPLACE INTO archive_user_records (channel, nickid, userid, record_nickid, record_userid) SELECT archive_users.channel, $nickid, archive_users.userid+$shift, ifnull(archive_user_records.record_nickid, archive_users.nickid), ifnull(archive_user_records.record_userid, archive_users.userid) FROM archive_users LEFT JOIN archive_user_records ON archive_user_records.channel=archive_users.channel AND archive_user_records.nickid=archive_users.nickid AND archive_user_records.userid=archive_users.userid WHERE archive_users.channel=$channel AND archive_users.nickid=$alias AND archive_users.userid>=$first;"
+#define DELETE_ARCHIVE_RECORDS           "DELETE FROM archive_user_records WHERE channel=$channel AND nickid=$alias AND userid>=$first;"
+#define MOVE_ARCHIVE_USERS               "UPDATE archive_users SET nickid=$nickid, userid=userid+$shift WHERE channel=$channel AND nickid=$alias AND userid>=$first;"
+#define MOVE_ACTIVITY_HOURS              "INSERT INTO activity_hours (channel, hour, nickid, messages) SELECT channel, hour, $nickid, messages FROM activity_hours WHERE channel=$channel AND nickid=$alias ORDER BY hour LIMIT $limit ON CONFLICT (channel, hour, nickid) DO UPDATE SET messages=messages+excluded.messages;"
+#define DELETE_ACTIVITY_HOURS            "DELETE FROM activity_hours WHERE channel=$channel AND nickid=$alias AND hour IN (SELECT hour FROM activity_hours WHERE channel=$channel AND nickid=$alias ORDER BY hour LIMIT $limit);"
+#define MOVE_TOPICS                      "UPDATE topics SET nickid=$nickid WHERE id IN (SELECT id FROM topics WHERE channel=$channel AND nickid=$alias LIMIT $limit);"
+#define SAVEPOINT_REATTRIBUTE            "SAVEPOINT reattribute;"
+#define RELEASE_REATTRIBUTE              "RELEASE reattribute;"
+#define ROLLBACK_REATTRIBUTE             "ROLLBACK TO reattribute;"
 
 #endif /* __QUERIES_H__ */
@@ -0,0 +1,55 @@
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include <time.h>
+#include <sqlite3.h>
+
+#define SNAPSHOT_DEFAULT_INTERVAL    300
+#define SNAPSHOT_DEFAULT_STEP_PAGES  256
+
+// Step size that copies the whole database in one go
+#define SNAPSHOT_ALL_PAGES           -1
+
+// Periodic copies of an in-memory database to a file, made with the online
+// backup API a few pages at a time. Steps run on the writer's connection
+// between transactions, so the finished file is always a committed state,
+// checkpoints included. A shared (memdb) database carries commits made while a
+// snapshot is in progress into it, but sqlite restarts the backup of a private
+// :memory: database after every commit, so those are copied in one step
+// (SNAPSHOT_ALL_PAGES), and a snapshot seen to restart finishes in one step.
+// Each snapshot is written to a temporary file and renamed over the last one
+// once it's complete.
+// Only the writer thread uses it once the database is open.
+struct snapshot
+{
+	char* filename;                 // Where snapshots go, NULL for none
+	char* temp_filename;            // Where the one in progress is written
+	int interval;                   // Seconds from the end of one snapshot to the start of the next
+	int step_pages;                 // Pages copied per step, SNAPSHOT_ALL_PAGES for all of them
+
+	sqlite3* file;                  // Snapshot in progress, NULL if there isn't one
+	sqlite3_backup* backup;
+	int copied;                     // Pages copied by the last step, sqlite restarted the snapshot if it's no further on
+	int finish;                     // Copy the rest in one step, after a restart
+	time_t last;                    // When the last snapshot finished (or failed)
+
+	unsigned long count;            // Snapshots taken, for statistics
+	unsigned long restarts;         // Snapshots sqlite restarted part way through
+};
+
+// filename may be NULL to not take snapshots, and step_pages SNAPSHOT_ALL_PAGES to copy everything in one step
+struct snapshot snapshot_create(const char* filename, int interval, int step_pages);
+void snapshot_destroy(struct snapshot* snapshot);
+
+// Load the snapshot at filename into db, replacing everything in it, before anything else uses db
+// Returns 1 if there was a snapshot to restore
+int snapshot_restore(const char* filename, sqlite3* db);
+
+// Check if a snapshot is in progress or it's time to start one
+int snapshot_due(const struct snapshot* snapshot);
+
+// Copy the next few pages of db, starting a snapshot if there isn't one in progress
+// Call between transactions, on the connection that does every write
+void snapshot_step(struct snapshot* snapshot, sqlite3* db);
+
+#endif /* __SNAPSHOT_H__ */
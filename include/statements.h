@@ -0,0 +1,99 @@
+#ifndef __STATEMENTS_H__
+#define __STATEMENTS_H__
+
+#include <sqlite3.h>
+
+// Every query in queries.h that can be run as a single prepared statement
+enum statement_id
+{
+	STMT_INSERT_CHANNEL,
+	STMT_SELECT_CHANNEL,
+	STMT_INSERT_MESSAGE,
+	STMT_INSERT_SEARCH,
+	STMT_INSERT_TOPIC,
+	STMT_INSERT_MESSAGE_COUNT,
+	STMT_SELECT_USERS,
+	STMT_ADD_MESSAGE_COUNT,
+	STMT_INSERT_ALIAS,
+	STMT_UPDATE_ALIAS,
+	STMT_DELETE_ALIAS,
+	STMT_INSERT_NICK,
+	STMT_SELECT_MESSAGE_ID_RANGE,
+	STMT_SELECT_MESSAGE_AT_ID,
+	STMT_SELECT_USER_MESSAGE,
+	STMT_SELECT_LATEST_MESSAGES,
+	STMT_SELECT_MESSAGE_COUNT_AT_TIME,
+	STMT_ADD_ACTIVITY_HOUR,
+	STMT_ADD_ACTIVITY_DAY,
+	STMT_SELECT_ACTIVITY_DAYS,
+	STMT_SELECT_ACTIVITY_HOURS,
+	STMT_SELECT_ACTIVITY_NICK,
+	STMT_SELECT_LATEST_TOPICS,
+	STMT_SELECT_MESSAGE_COUNT,
+	STMT_SELECT_NICK,
+	STMT_SELECT_NICK_ID,
+	STMT_SELECT_ARCHIVE_LATEST,
+	STMT_SELECT_ARCHIVE_BLOCK_AT_ID,
+	STMT_SELECT_ARCHIVE_USER_BLOCK,
+	STMT_SELECT_OLDEST_MESSAGE,
+	STMT_SELECT_ARCHIVE_MESSAGES,
+	STMT_INSERT_ARCHIVE_SEGMENT,
+	STMT_INSERT_ARCHIVE_BLOCK,
+	STMT_INSERT_ARCHIVE_USERS,
+	STMT_INSERT_ARCHIVED_MESSAGES,
+	STMT_DELETE_ARCHIVED_MESSAGES,
+	STMT_SELECT_SEARCH_BACKFILL,
+	STMT_BACKFILL_SEARCH,
+	STMT_UPDATE_SEARCH_BACKFILL,
+	STMT_DELETE_SEARCH_BACKFILL,
+	STMT_SELECT_SEARCH,
+	STMT_SELECT_SEARCH_RANKED,
+	STMT_SELECT_CHECKPOINT,
+	STMT_UPDATE_CHECKPOINT,
+	STMT_BEGIN_TRANSACTION,
+	STMT_COMMIT_TRANSACTION,
+	STMT_ROLLBACK_TRANSACTION,
+	STMT_SAVEPOINT_ARCHIVE,
+	STMT_RELEASE_ARCHIVE,
+	STMT_ROLLBACK_ARCHIVE,
+	STMT_SELECT_USER_NICKS,
+	STMT_SELECT_USER,
+	STMT_DELETE_USER,
+	STMT_MOVE_MESSAGES,
+	STMT_MOVE_UNCOUNTED_MESSAGES,
+	STMT_MOVE_ARCHIVE_BOUNDARY,
+	STMT_MOVE_ARCHIVE_BOUNDARY_RECORD,
+	STMT_MOVE_ARCHIVE_RECORDS,
+	STMT_DELETE_ARCHIVE_RECORDS,
+	STMT_MOVE_ARCHIVE_USERS,
+	STMT_MOVE_ACTIVITY_HOURS,
+	STMT_DELETE_ACTIVITY_HOURS,
+	STMT_MOVE_TOPICS,
+	STMT_SAVEPOINT_REATTRIBUTE,
+	STMT_RELEASE_REATTRIBUTE,
+	STMT_ROLLBACK_REATTRIBUTE,
+
+	STMT_COUNT
+};
+
+// Prepared statements for one connection, compiled on first use and reused
+struct statement_cache
+{
+	sqlite3* db;
+	sqlite3_stmt* statements[STMT_COUNT];
+};
+
+struct statement_cache sc_create(sqlite3* db);
+void sc_destroy(struct statement_cache* sc);
+
+// Get a statement ready for binding (reset, with bindings cleared)
+// Returns NULL if the statement could not be prepared
+sqlite3_stmt* sc_get(struct statement_cache* sc, enum statement_id id);
+
+// Get the SQL text for a statement (for error messages)
+const char* sc_sql(enum statement_id id);
+
+// Get the calling thread's statement cache for db, creating it on first use
+struct statement_cache* sc_thread_cache(sqlite3* db);
+
+#endif /* __STATEMENTS_H__ */
@@ -0,0 +1,174 @@
+#ifndef __STORE_H__
+#define __STORE_H__
+
+#include <time.h>
+#include <stdatomic.h>
+#include <sqlite3.h>
+
+#include "logline.h"
+#include "aliases.h"
+#include "nicks.h"
+#include "activity.h"
+#include "archive.h"
+#include "snapshot.h"
+#include "leaderboard.h"
+
+// Message ids indexed for search per backfill chunk
+#define STORE_SEARCH_BACKFILL_CHUNK  20000
+
+// How often to look for days old enough to archive once there aren't any (s)
+#define STORE_ARCHIVE_INTERVAL       60
+
+// Longest a channel whose segments fail to archive waits before trying again, doubling from
+// STORE_ARCHIVE_INTERVAL (s)
+#define STORE_ARCHIVE_MAX_BACKOFF    3600
+
+// Messages, activity hours or topics moved from an alias to its main nick per transaction
+#define STORE_REATTRIBUTE_CHUNK      5000
+
+// A channel that failed to archive a segment, which is skipped until retry
+struct store_archive_retry
+{
+	time_t retry;
+	int failures;
+};
+
+// A message's userid is its position among its user's messages, from 0
+// userid value stored as NULL
+#define STORE_NO_USERID  -1
+
+// How far into the logfile the database is up to date
+struct checkpoint
+{
+	long long inode;                // Logfile inode
+	long long size;                 // Logfile has to be at least this long to resume from the checkpoint
+	long long offset;               // Offset just past the last line written
+	time_t day;                     // Current day at offset
+};
+
+// A channel's messages still under an alias's own nick, from before the alias was added
+// What's being moved from an alias, in order
+enum reattribution_phase
+{
+	REATTRIBUTE_ACTIVITY,           // Activity rollups and topics first, so activity includes the
+	REATTRIBUTE_TOPICS,             // alias's from the start
+	REATTRIBUTE_MESSAGES,           // Counted messages, newest first, with the user counts
+	REATTRIBUTE_UNCOUNTED,          // Then any without a userid
+};
+
+struct reattribution
+{
+	int channel;
+	int alias;                      // Nick id of the alias
+	struct logline_slice nick;      // Main nick, from the alias table
+	long long messages;             // How many there were when it was found
+	enum reattribution_phase phase;
+};
+
+// Everything the writer thread needs to write lines
+struct store
+{
+	sqlite3* db;                    // Connection used for writing
+	struct alias_table aliases;     // Alias => main nick, resolved before anything is written
+	struct nick_table nicks;        // Nick => id, for every nick in the nicks table
+	struct activity_table activity; // Hourly counts not yet added to the rollup tables
+	long long search_first;         // Messages written since the last flush, to index for search, 0 for none
+	long long search_last;
+	long long search_next;          // Next message id to index for search, from before the index existed
+	long long search_end;           // Last message id to index that way, search_next > search_end once done
+	struct archive archive;         // Where old messages are moved to
+	time_t archive_checked;         // When there was last nothing old enough to archive
+	struct store_archive_retry* archive_retries; // Each channel's failures, by channel id
+	struct snapshot snapshot;       // Copies of an in-memory database on disk
+	struct reattribution* reattributions; // Aliased messages to move to their main nicks
+	int reattribution_count;
+	int reattribution_next;         // The one being moved
+	long long reattribute_moved;    // Messages moved in the open transaction
+	atomic_llong reattribute_total; // Progress, for readers
+	atomic_llong reattribute_done;
+	struct leaderboard** leaderboards; // Each channel's users, by channel id
+	int leaderboard_count;
+	atomic_ulong generation;        // Bumped whenever readers can see newly committed data
+	atomic_llong modified;          // When the generation last moved on
+};
+
+struct store store_create(sqlite3* db);
+void store_destroy(struct store* store);
+
+// Get the id for a channel, adding it if it's new, and load its users into its leaderboard
+// Call before the writer thread starts
+// Returns -1 on failure
+int store_channel(struct store* store, const char* network, const char* name);
+
+// Get a channel's leaderboard, or NULL if store_channel hasn't been called for it
+struct leaderboard* store_leaderboard(struct store* store, int channel);
+
+// Add up what has been counted in memory into the rollup tables, and index new messages for
+// search, call just before committing
+void store_flush(struct store* store);
+
+// Publish leaderboards once what they count has been committed, and move the generation on
+void store_publish(struct store* store);
+
+// Reload nicks, leaderboards and search progress from the database, and drop unflushed counts, after a rollback
+void store_reload(struct store* store);
+
+// Check if there are messages from before the search index that still need indexing
+int store_search_backlog(struct store* store);
+
+// Index the next chunk of them, call inside a transaction
+void store_backfill_search(struct store* store);
+
+// Find aliases whose messages are still under their own nick, because the alias was added
+// after they were written, to be moved over to the main nick by store_reattribute
+// Call once aliases and nicks are loaded, before the writer thread starts
+// Returns the number of messages to move
+long long store_find_reattributions(struct store* store);
+
+// Check if there are aliased messages still to move
+int store_reattribute_backlog(struct store* store);
+
+// Move the next chunk of an alias's messages to its main nick, call inside a transaction
+// The alias's last userids go on the end of the main nick's, so counts, userids and
+// leaderboards agree after every chunk
+void store_reattribute(struct store* store);
+
+// Check if it's time to look for messages old enough to archive
+int store_archive_backlog(struct store* store);
+
+// Move the oldest day of messages in a channel out to a segment, if it's old enough, call inside a transaction
+// Messages are only archived once they're indexed for search, so wait for store_search_backlog first
+void store_archive_day(struct store* store);
+
+// Get a nick's id, adding it to the nicks table if it's new
+// nick must already be resolved with alias_resolve
+// Returns 0 on failure
+int store_nick(struct store* store, struct logline_slice nick);
+
+// Write a topic change
+// Returns 1 if the topic was stored
+int store_topic(struct store* store, int channel, struct logline_slice nick, struct logline_slice topic, time_t time);
+
+// Write a message and count it towards its user
+// Returns 1 if the message was stored
+int store_message(struct store* store, int channel, struct logline_slice nick, struct logline_slice message, time_t time);
+
+// Write a message from the nick with id nick, whose userid was reserved with store_add_messages
+// Returns 1 if the message was stored
+int store_message_userid(struct store* store, int channel, int nick,
+                         struct logline_slice message, time_t time, long long userid);
+
+// Count count messages towards the user with nick id nick in one go, lastseen being the latest of them
+// Returns the userid of the first of the messages, which is the user's message count before
+// the update (the rest follow on from it), or STORE_NO_USERID if the channel or nick is unknown
+// or the count couldn't be written
+long long store_add_messages(struct store* store, int channel, int nick, int count, time_t lastseen);
+
+// Record a channel's checkpoint, call inside the transaction it describes
+int store_save_checkpoint(struct store* store, int channel, const struct checkpoint* checkpoint);
+
+// Get the last checkpoint saved for a channel
+// Returns 0 if there isn't one
+int store_load_checkpoint(struct store* store, int channel, struct checkpoint* checkpoint);
+
+#endif /* __STORE_H__ */
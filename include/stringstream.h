@@ -15,6 +15,12 @@ struct stringstream
 struct stringstream ss_create();
 void ss_destroy(struct stringstream* ss);
 void ss_add(struct stringstream* ss, const char* string);
+
+// Add len bytes of data, which can include nulls
+void ss_add_len(struct stringstream* ss, const char* data, size_t len);
+
+// Add string as a quoted JSON string, escaping it as needed
+void ss_add_json(struct stringstream* ss, const char* string);
 void ss_clear(struct stringstream* ss);
 
 #endif /* __STRINGSTREAM_H__ */
@@ -2,10 +2,21 @@
 #define __STRUCTURES_H__
 
 #define STATS_MAX(x, y)    (x > y ? x : y)
+#define STATS_MIN(x, y)    (x < y ? x : y)
 
 #define STATS_NICK_LEN     32
 #define STATS_MESSAGE_LEN  1024
 
+// Longest search query, and most results per page
+#define STATS_SEARCH_LEN   256
+#define STATS_SEARCH_PAGE  50
+
+// Most buckets returned by one activity query, ten years of hours
+#define STATS_MAX_ACTIVITY 87840
+
+// Times asked for are clamped to between the epoch and the end of year 9999
+#define STATS_MAX_TIME     253402300799LL
+
 struct stats_user
 {
 	char nick[STATS_NICK_LEN];
@@ -21,6 +32,21 @@ struct stats_message
 	char message[STATS_MESSAGE_LEN];
 };
 
+struct stats_search_result
+{
+	long long id;                   // Message id
+	double rank;                    // bm25, lower is better
+	time_t time;
+	char nick[STATS_NICK_LEN];
+	char message[STATS_MESSAGE_LEN];
+};
+
+struct stats_activity
+{
+	time_t time;                    // Start of the bucket
+	int messages;
+};
+
 
 #endif /* __STRUCTURES_H__ */
 
@@ -0,0 +1,48 @@
+#ifndef __TAIL_H__
+#define __TAIL_H__
+
+#include <sys/types.h>
+
+#include "ingest.h"
+
+#define TAIL_BUFFER_SIZE       (64 * 1024)
+#define TAIL_EVENT_BUFFER_SIZE 4096
+
+// Follows a logfile as it is written, across rotation and truncation
+// Every pending inotify event is drained at once, and all new data is read
+// in as few read() calls as the buffer allows, so a burst of lines costs a
+// handful of syscalls instead of several per line
+struct tail
+{
+	char* path;                     // Logfile path
+	const char* name;               // File name part of path
+
+	int fd;                         // Logfile being read, -1 until attached
+	ino_t inode;                    // Inode of fd
+	off_t position;                 // Offset in fd just past the data read
+
+	int inotify_fd;                 // Non blocking inotify instance
+	int file_wd;                    // Watch on the logfile, -1 once it is gone
+	int dir_wd;                     // Watch on the logfile's directory, to see it recreated
+	int epoll_fd;                   // Waits on inotify_fd
+
+	char* buffer;                   // Data read but not yet parsed (an incomplete line)
+	size_t buffer_len;              // Size of buffer
+	size_t used;                    // Bytes of buffer holding data
+
+	struct ingest_batch* batch;     // Complete lines are fed in here
+};
+
+// Set up watches on path
+// inotify_fd or file_wd are left -1 on failure
+struct tail tail_create(const char* path);
+void tail_destroy(struct tail* tail);
+
+// Start following fd from offset, taking ownership of fd
+void tail_attach(struct tail* tail, int fd, off_t offset, struct ingest_batch* batch);
+
+// Wait up to timeout ms (-1 for no limit) for changes, and ingest any new lines
+// Returns 0 on timeout, -1 on error, otherwise 1
+int tail_wait(struct tail* tail, int timeout);
+
+#endif /* __TAIL_H__ */
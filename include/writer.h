@@ -0,0 +1,132 @@
+#ifndef __WRITER_H__
+#define __WRITER_H__
+
+#include <time.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "store.h"
+#include "logline.h"
+
+#define WRITER_DEFAULT_BATCH_SIZE      10000
+#define WRITER_DEFAULT_FLUSH_INTERVAL  50
+#define WRITER_DEFAULT_QUEUE_SIZE      8192
+
+// Milliseconds waited before writing a rolled back transaction again, doubling each time up to the max
+#define WRITER_REPLAY_WAIT             1000
+#define WRITER_MAX_REPLAY_WAIT         60000
+
+// Nick and message text up to this long is kept in the queue slot itself
+#define WRITER_INLINE_TEXT             512
+
+enum writer_record_kind
+{
+	WRITER_TOPIC,
+	WRITER_MESSAGE,
+	WRITER_CALL,                    // Run call(store, arg) on the writer thread
+};
+
+// A parsed line (or a batch of them) waiting to be written
+struct writer_record
+{
+	enum writer_record_kind kind;
+	int channel;
+	int lines;                      // Logfile lines the record accounts for
+	struct checkpoint checkpoint;   // Where the channel's logfile is up to once written, inode 0 for none
+
+	time_t time;
+	size_t nick_len;
+	size_t message_len;
+	char* text;                     // Nick followed by message, inline_text unless too long
+	char inline_text[WRITER_INLINE_TEXT];
+
+	void (*call)(struct store* store, void* arg);
+	void (*done)(void* arg);        // Run once call's transaction is committed, may be NULL
+	void* arg;
+};
+
+struct writer_slot
+{
+	atomic_size_t sequence;         // Which lap of the ring the slot is ready for
+	struct writer_record record;
+};
+
+// The latest checkpoint of each channel written in the open transaction
+struct writer_checkpoint
+{
+	int channel;
+	int pending;                    // Changed in the open transaction
+	struct checkpoint checkpoint;
+};
+
+// Parsed records go through a bounded lock free queue (many producers, one
+// consumer) into a single thread that does every database write, grouping
+// records into transactions. A transaction is committed when it reaches
+// batch_size lines, has been open flush_interval ms, or the queue runs dry.
+// Producers only wait when the queue is full.
+// Records stay in a journal until their transaction is committed, and if the
+// commit fails they're written again before anything newer, so a checkpoint is
+// never saved past lines that didn't make it into the database.
+struct writer
+{
+	struct store* store;
+	int batch_size;                 // Lines per transaction
+	int flush_interval;             // Longest a transaction stays open (ms)
+
+	struct writer_slot* slots;      // Ring of queue_size slots
+	size_t queue_size;              // Always a power of two
+	atomic_size_t enqueue_pos;      // Next slot for producers to claim
+	atomic_size_t dequeue_pos;      // Next slot for the writer to read
+
+	pthread_mutex_t lock;           // Only taken to sleep or wake someone up
+	pthread_cond_t ready;           // Signalled when a sleeping writer has records
+	pthread_cond_t space;           // Signalled when waiting producers have space
+	atomic_int writer_sleeping;
+	atomic_int producers_waiting;
+	atomic_int stopping;
+	pthread_t thread;
+
+	int in_transaction;             // Writer thread only
+	int lines;                      // Lines in the open transaction
+	struct timespec opened;         // Time the open transaction began
+	struct writer_checkpoint* checkpoints;
+	int checkpoint_count;
+	struct writer_record* journal;  // Records written in the open transaction, written again if it's rolled back
+	int journal_count;
+	int journal_max;
+
+	// Statistics, readable from any thread
+	atomic_ulong records;           // Records queued
+	atomic_ulong full_waits;        // Times a producer found the queue full
+	atomic_size_t max_depth;        // Most records ever waiting
+	atomic_ulong commits;           // Transactions committed
+	atomic_ulong lines_committed;   // Lines committed
+};
+
+struct writer writer_create(struct store* store, int batch_size, int flush_interval, int queue_size);
+void writer_destroy(struct writer* writer);
+
+// Start the writer thread, writer must stay at the same address until writer_stop
+// Returns 0 on success
+int writer_start(struct writer* writer);
+
+// Write everything queued, commit, and stop the writer thread
+void writer_stop(struct writer* writer);
+
+// Queue a topic or message, accounting for lines logfile lines, waiting if the queue is full
+// checkpoint may be NULL
+void writer_line(struct writer* writer, enum writer_record_kind kind, int channel, time_t time,
+                 struct logline_slice nick, struct logline_slice message,
+                 int lines, const struct checkpoint* checkpoint);
+
+// Queue a call to run on the writer thread inside a transaction, accounting for lines logfile lines
+// call is run again if the transaction is rolled back, and done (which may be NULL) once it's committed
+// checkpoint may be NULL
+void writer_call(struct writer* writer, int channel, void (*call)(struct store* store, void* arg),
+                 void (*done)(void* arg), void* arg, int lines, const struct checkpoint* checkpoint);
+
+// Records waiting to be written
+size_t writer_depth(struct writer* writer);
+
+#endif /* __WRITER_H__ */
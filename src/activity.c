@@ -0,0 +1,113 @@
+#include <activity.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ACTIVITY_DEFAULT_LENGTH  256
+
+static size_t hash_entry(int channel, int nick, time_t start)
+{
+	unsigned long long hash = (unsigned long long)start / ACTIVITY_HOUR;
+
+	hash = hash * 31 + (unsigned int)channel;
+	hash = hash * 0x9e3779b97f4a7c15ull + (unsigned int)nick;
+
+	return (size_t)(hash ^ (hash >> 29));
+}
+
+// Find the slot for a bucket, either holding it or empty
+static struct activity_entry* find_slot(struct activity_entry* entries, size_t len, int channel, int nick, time_t start)
+{
+	size_t slot = hash_entry(channel, nick, start) & (len - 1);
+
+	while (entries[slot].nick != 0 &&
+	       (entries[slot].channel != channel || entries[slot].nick != nick || entries[slot].start != start))
+	{
+		slot = (slot + 1) & (len - 1);
+	}
+
+	return &entries[slot];
+}
+
+static void grow(struct activity_table* table)
+{
+	size_t i;
+	size_t old_len = table->len;
+	struct activity_entry* old_entries = table->entries;
+	struct activity_entry* entry;
+
+	table->len *= 2;
+	table->entries = calloc(table->len, sizeof(struct activity_entry));
+
+	for (i = 0; i < old_len; ++i)
+	{
+		entry = &old_entries[i];
+
+		if (entry->nick != 0)
+			*find_slot(table->entries, table->len, entry->channel, entry->nick, entry->start) = *entry;
+	}
+
+	free(old_entries);
+}
+
+struct activity_table activity_create()
+{
+	struct activity_table table;
+
+	table.len = ACTIVITY_DEFAULT_LENGTH;
+	table.entries = calloc(table.len, sizeof(struct activity_entry));
+	table.count = 0;
+
+	return table;
+}
+
+void activity_destroy(struct activity_table* table)
+{
+	free(table->entries);
+
+	table->entries = NULL;
+	table->len = 0;
+	table->count = 0;
+}
+
+void activity_clear(struct activity_table* table)
+{
+	if (table->count == 0)
+		return;
+
+	memset(table->entries, 0, sizeof(struct activity_entry) * table->len);
+	table->count = 0;
+}
+
+// Add to one bucket
+static void add(struct activity_table* table, int channel, int nick, time_t start, int count)
+{
+	struct activity_entry* entry;
+
+	// Keep the table at most half full
+	if ((table->count + 1) * 2 > table->len)
+		grow(table);
+
+	entry = find_slot(table->entries, table->len, channel, nick, start);
+
+	if (entry->nick == 0)
+	{
+		entry->channel = channel;
+		entry->nick = nick;
+		entry->start = start;
+		entry->messages = 0;
+
+		table->count++;
+	}
+
+	entry->messages += count;
+}
+
+void activity_add(struct activity_table* table, int channel, int nick, time_t time, int count)
+{
+	if (nick <= 0)
+		return;
+
+	add(table, channel, nick, time - time % ACTIVITY_HOUR, count);
+	add(table, channel, ACTIVITY_CHANNEL, time - time % ACTIVITY_DAY, count);
+}
@@ -0,0 +1,262 @@
+#include <aliases.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "errors.h"
+#include "queries.h"
+#include "statements.h"
+
+#define ALIAS_DEFAULT_LENGTH  64
+
+// Find the slot for alias, either holding it or empty
+static struct alias_entry* find_slot(struct alias_entry* entries, size_t len, const char* alias, size_t alias_len)
+{
+	size_t slot = logline_nick_hash(alias, alias_len) & (len - 1);
+
+	while (entries[slot].alias != NULL &&
+	       !logline_nick_equal(entries[slot].alias, entries[slot].alias_len, alias, alias_len))
+	{
+		slot = (slot + 1) & (len - 1);
+	}
+
+	return &entries[slot];
+}
+
+static void grow(struct alias_table* table)
+{
+	size_t i;
+	size_t old_len = table->len;
+	struct alias_entry* old_entries = table->entries;
+
+	table->len *= 2;
+	table->entries = calloc(table->len, sizeof(struct alias_entry));
+
+	for (i = 0; i < old_len; ++i)
+	{
+		if (old_entries[i].alias != NULL)
+			*find_slot(table->entries, table->len, old_entries[i].alias, old_entries[i].alias_len) = old_entries[i];
+	}
+
+	free(old_entries);
+}
+
+struct alias_table alias_create()
+{
+	struct alias_table table;
+
+	table.len = ALIAS_DEFAULT_LENGTH;
+	table.entries = calloc(table.len, sizeof(struct alias_entry));
+	table.count = 0;
+
+	return table;
+}
+
+void alias_destroy(struct alias_table* table)
+{
+	size_t i;
+
+	if (table->entries == NULL)
+		return;
+
+	for (i = 0; i < table->len; ++i)
+	{
+		free(table->entries[i].alias);
+		free(table->entries[i].nick);
+	}
+
+	free(table->entries);
+	table->entries = NULL;
+	table->len = 0;
+	table->count = 0;
+}
+
+void alias_add(struct alias_table* table, const char* alias, const char* nick)
+{
+	struct alias_entry* entry;
+
+	// Keep the table at most half full
+	if ((table->count + 1) * 2 > table->len)
+		grow(table);
+
+	entry = find_slot(table->entries, table->len, alias, strlen(alias));
+
+	// First mapping wins, like the subquery it replaces
+	if (entry->alias != NULL)
+		return;
+
+	entry->alias = strdup(alias);
+	entry->alias_len = strlen(alias);
+	entry->nick = strdup(nick);
+	entry->nick_len = strlen(nick);
+
+	table->count++;
+}
+
+int alias_load(struct alias_table* table, sqlite3* db)
+{
+	int rc;
+	int count = 0;
+	sqlite3_stmt* statement;
+
+	rc = sqlite3_prepare_v2(db, SELECT_ALIASES, -1, &statement, NULL);
+	if (rc != SQLITE_OK)
+	{
+		fprintf(stderr, SQLITE_STATEMENT_PREPERATION_FAILURE, sqlite3_errmsg(db));
+		fprintf(stderr, SQLITE_PROBLEM_QUERY, SELECT_ALIASES);
+
+		return 0;
+	}
+
+	while ((rc = sqlite3_step(statement)) == SQLITE_ROW)
+	{
+		const char* alias = (const char*)sqlite3_column_text(statement, 0);
+		const char* nick = (const char*)sqlite3_column_text(statement, 1);
+
+		if (alias != NULL && nick != NULL)
+		{
+			alias_add(table, alias, nick);
+			count++;
+		}
+	}
+
+	if (rc != SQLITE_DONE)
+	{
+		fprintf(stderr, SQLITE_QUERY_FAILURE, sqlite3_errmsg(db));
+		fprintf(stderr, SQLITE_PROBLEM_QUERY, SELECT_ALIASES);
+	}
+
+	sqlite3_finalize(statement);
+
+	return count;
+}
+
+// Find alias in the table, or NULL if it isn't there
+static const struct alias_entry* alias_find(const struct alias_table* table, const char* alias, size_t alias_len)
+{
+	const struct alias_entry* entry;
+
+	if (table->count == 0)
+		return NULL;
+
+	entry = find_slot(table->entries, table->len, alias, alias_len);
+
+	return entry->alias != NULL ? entry : NULL;
+}
+
+// Run one of the sync's statements, binding alias and nick when they aren't NULL
+// Returns 1 on success
+static int alias_write(sqlite3* db, enum statement_id id, const char* alias, const char* nick)
+{
+	int rc;
+	sqlite3_stmt* statement = sc_get(sc_thread_cache(db), id);
+
+	if (statement == NULL)
+		return 0;
+
+	if (alias != NULL)
+		sqlite3_bind_text(statement, sqlite3_bind_parameter_index(statement, "$nick"), alias, -1, SQLITE_STATIC);
+	if (nick != NULL)
+		sqlite3_bind_text(statement, sqlite3_bind_parameter_index(statement, "$alias"), nick, -1, SQLITE_STATIC);
+
+	rc = sqlite3_step(statement);
+	if (rc != SQLITE_DONE)
+	{
+		fprintf(stderr, SQLITE_QUERY_FAILURE, sqlite3_errmsg(db));
+		fprintf(stderr, SQLITE_PROBLEM_QUERY, sc_sql(id));
+	}
+
+	sqlite3_clear_bindings(statement);
+	sqlite3_reset(statement);
+
+	return rc == SQLITE_DONE;
+}
+
+int alias_sync(sqlite3* db, const struct alias_table* wanted)
+{
+	size_t i;
+	int ok;
+	int began;
+	int added = 0;
+	int changed = 0;
+	int removed = 0;
+	const struct alias_entry* entry;
+	const struct alias_entry* stored_entry;
+	struct alias_table stored = alias_create();
+
+	alias_load(&stored, db);
+
+	ok = began = alias_write(db, STMT_BEGIN_TRANSACTION, NULL, NULL);
+
+	// Aliases in the config that are new or now go to a different nick
+	for (i = 0; ok && i < wanted->len; ++i)
+	{
+		entry = &wanted->entries[i];
+		if (entry->alias == NULL)
+			continue;
+
+		stored_entry = alias_find(&stored, entry->alias, entry->alias_len);
+
+		if (stored_entry == NULL)
+		{
+			printf("Adding alias %s => %s\n", entry->alias, entry->nick);
+			ok = alias_write(db, STMT_INSERT_ALIAS, entry->alias, entry->nick);
+			added++;
+		}
+		else if (!logline_nick_equal(stored_entry->nick, stored_entry->nick_len, entry->nick, entry->nick_len))
+		{
+			printf("Changing alias %s => %s to %s, messages already moved to %s stay there\n",
+			       entry->alias, stored_entry->nick, entry->nick, stored_entry->nick);
+			ok = alias_write(db, STMT_UPDATE_ALIAS, entry->alias, entry->nick);
+			changed++;
+		}
+	}
+
+	// Aliases that are no longer in the config
+	for (i = 0; ok && i < stored.len; ++i)
+	{
+		stored_entry = &stored.entries[i];
+		if (stored_entry->alias == NULL || alias_find(wanted, stored_entry->alias, stored_entry->alias_len) != NULL)
+			continue;
+
+		printf("Removing alias %s => %s, messages already moved to %s stay there\n",
+		       stored_entry->alias, stored_entry->nick, stored_entry->nick);
+		ok = alias_write(db, STMT_DELETE_ALIAS, stored_entry->alias, NULL);
+		removed++;
+	}
+
+	if (ok)
+		ok = alias_write(db, STMT_COMMIT_TRANSACTION, NULL, NULL);
+
+	if (ok)
+	{
+		printf("Aliases: %d added, %d changed, %d removed, %d unchanged\n",
+		       added, changed, removed, (int)stored.count - changed - removed);
+	}
+	else if (began)
+	{
+		alias_write(db, STMT_ROLLBACK_TRANSACTION, NULL, NULL);
+	}
+
+	alias_destroy(&stored);
+
+	return ok ? added + changed + removed : -1;
+}
+
+struct logline_slice alias_resolve(const struct alias_table* table, struct logline_slice nick)
+{
+	struct alias_entry* entry;
+
+	if (table->count == 0)
+		return nick;
+
+	entry = find_slot(table->entries, table->len, nick.ptr, nick.len);
+	if (entry->alias != NULL)
+	{
+		nick.ptr = entry->nick;
+		nick.len = entry->nick_len;
+	}
+
+	return nick;
+}
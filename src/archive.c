@@ -0,0 +1,527 @@
+#include <archive.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "errors.h"
+
+// Each message in a block is a record followed by its text. Records are varints, ids and times
+// as the difference from the message before (times zigzag encoded, in case a log goes backwards)
+struct archive_record
+{
+	long long id;
+	long long time;
+	long long userid;
+	int nick;
+	int len;
+};
+
+// Longest a record can be encoded as
+#define ARCHIVE_RECORD_MAX  (10 * 5)
+
+static size_t put_varint(char* buffer, unsigned long long value)
+{
+	size_t len = 0;
+
+	while (value >= 0x80)
+	{
+		buffer[len++] = (char)(value | 0x80);
+		value >>= 7;
+	}
+
+	buffer[len++] = (char)value;
+
+	return len;
+}
+
+// Returns the bytes read, or 0 if the varint runs past end
+static size_t get_varint(const char* buffer, const char* end, unsigned long long* value)
+{
+	size_t len = 0;
+	int shift = 0;
+
+	*value = 0;
+
+	while (buffer + len < end && shift < 64)
+	{
+		*value |= (unsigned long long)(buffer[len] & 0x7f) << shift;
+
+		if ((buffer[len++] & 0x80) == 0)
+			return len;
+
+		shift += 7;
+	}
+
+	return 0;
+}
+
+static size_t put_record(char* buffer, const struct archive_record* record, const struct archive_record* previous)
+{
+	size_t len = 0;
+	long long time = record->time - previous->time;
+
+	len += put_varint(buffer + len, (unsigned long long)(record->id - previous->id));
+	len += put_varint(buffer + len, ((unsigned long long)time << 1) ^ (unsigned long long)(time >> 63));
+	len += put_varint(buffer + len, (unsigned long long)record->userid);
+	len += put_varint(buffer + len, (unsigned int)record->nick);
+	len += put_varint(buffer + len, (unsigned int)record->len);
+
+	return len;
+}
+
+// Decode the record at data into record, which holds the one before it (zeroed for the first)
+// Returns the bytes read, or 0 if the block is corrupt
+static size_t get_record(const char* data, const char* end, struct archive_record* record)
+{
+	size_t len = 0;
+	size_t rc;
+	unsigned long long values[5];
+	int i;
+
+	for (i = 0; i < 5; ++i)
+	{
+		rc = get_varint(data + len, end, &values[i]);
+		if (rc == 0)
+			return 0;
+
+		len += rc;
+	}
+
+	record->id += (long long)values[0];
+	record->time += (long long)(values[1] >> 1) ^ -(long long)(values[1] & 1);
+	record->userid = (long long)values[2];
+	record->nick = (int)values[3];
+	record->len = (int)values[4];
+
+	if (record->len < 0 || data + len + record->len > end)
+		return 0;
+
+	return len;
+}
+
+// Segment files are named after their channel, day and first message id
+// Returns 0 if the path doesn't fit in path_len
+static int segment_path(const struct archive* archive, int channel, time_t day, long long segment,
+                        char* path, size_t path_len)
+{
+	struct tm tm;
+	char date[16];
+
+	gmtime_r(&day, &tm);
+	strftime(date, sizeof(date), "%Y%m%d", &tm);
+
+	return snprintf(path, path_len, "%s/%d-%s-%lld.seg", archive->directory, channel, date, segment) < (int)path_len;
+}
+
+struct archive archive_create(const char* directory, int age, int cache_blocks)
+{
+	struct archive archive;
+
+	archive.directory = directory != NULL ? strdup(directory) : NULL;
+	archive.age = age;
+
+	pthread_mutex_init(&archive.lock, NULL);
+	archive.cache_len = cache_blocks > 0 ? cache_blocks : ARCHIVE_DEFAULT_CACHE_BLOCKS;
+	archive.cache = calloc(archive.cache_len, sizeof(struct archive_cache_entry));
+	archive.clock = 0;
+	archive.hits = 0;
+	archive.misses = 0;
+
+	// The directory only has to exist once something is archived, so failing here isn't fatal
+	if (archive.directory != NULL && mkdir(archive.directory, 0755) != 0 && errno != EEXIST)
+		fprintf(stderr, ARCHIVE_DIRECTORY_FAILURE, archive.directory, strerror(errno));
+
+	return archive;
+}
+
+void archive_destroy(struct archive* archive)
+{
+	int i;
+
+	if (archive->cache == NULL)
+		return;
+
+	for (i = 0; i < archive->cache_len; ++i)
+		free(archive->cache[i].data);
+
+	free(archive->cache);
+	free(archive->directory);
+	pthread_mutex_destroy(&archive->lock);
+
+	archive->cache = NULL;
+	archive->cache_len = 0;
+	archive->directory = NULL;
+}
+
+int archive_enabled(const struct archive* archive)
+{
+	return archive->directory != NULL && archive->age > 0;
+}
+
+void archive_block_column(sqlite3_stmt* statement, int column, int channel, struct archive_block* block)
+{
+	block->channel = channel;
+	block->day = (time_t)sqlite3_column_int64(statement, column);
+	block->segment = sqlite3_column_int64(statement, column + 1);
+	block->offset = sqlite3_column_int64(statement, column + 2);
+	block->size = sqlite3_column_int(statement, column + 3);
+	block->length = sqlite3_column_int(statement, column + 4);
+	block->first_id = sqlite3_column_int64(statement, column + 5);
+	block->last_id = sqlite3_column_int64(statement, column + 6);
+}
+
+int archive_segment_open(struct archive* archive, struct archive_segment* segment, int channel, time_t day, long long first_id)
+{
+	memset(segment, 0, sizeof(struct archive_segment));
+
+	segment->archive = archive;
+	segment->channel = channel;
+	segment->day = day;
+	segment->first_id = first_id;
+
+	// A cut off temporary name could even be the finished segment's
+	if (!segment_path(archive, channel, day, first_id, segment->path, sizeof(segment->path)) ||
+	    snprintf(segment->temp_path, sizeof(segment->temp_path), "%s.tmp", segment->path) >= (int)sizeof(segment->temp_path))
+	{
+		fprintf(stderr, ARCHIVE_WRITE_FAILURE, segment->path, "path too long");
+		return 0;
+	}
+
+	segment->buffer_size = ARCHIVE_BLOCK_SIZE * 2;
+	segment->buffer = malloc(segment->buffer_size);
+
+	// A segment left over from a database that was thrown away gets replaced
+	segment->file = fopen(segment->temp_path, "wb");
+	if (segment->file == NULL)
+	{
+		fprintf(stderr, ARCHIVE_WRITE_FAILURE, segment->temp_path, strerror(errno));
+		return 0;
+	}
+
+	return 1;
+}
+
+// Compress the block being filled onto the end of the file
+static int write_block(struct archive_segment* segment)
+{
+	uLongf size;
+	Bytef* compressed;
+	struct archive_block* block;
+
+	if (segment->buffer_len == 0)
+		return 1;
+
+	size = compressBound(segment->buffer_len);
+	compressed = malloc(size);
+
+	if (compress2(compressed, &size, (const Bytef*)segment->buffer, segment->buffer_len, Z_BEST_COMPRESSION) != Z_OK ||
+	    fwrite(compressed, 1, size, segment->file) != size)
+	{
+		fprintf(stderr, ARCHIVE_WRITE_FAILURE, segment->temp_path, strerror(errno));
+		free(compressed);
+		return 0;
+	}
+
+	free(compressed);
+
+	segment->blocks = realloc(segment->blocks, sizeof(struct archive_block) * (segment->block_count + 1));
+	block = &segment->blocks[segment->block_count++];
+
+	block->channel = segment->channel;
+	block->day = segment->day;
+	block->segment = segment->first_id;
+	block->offset = segment->offset;
+	block->size = (int)size;
+	block->length = (int)segment->buffer_len;
+	block->first_id = segment->block_first_id;
+	block->last_id = segment->block_last_id;
+
+	segment->offset += size;
+	segment->buffer_len = 0;
+
+	return 1;
+}
+
+int archive_segment_add(struct archive_segment* segment, long long id, time_t time, long long userid, int nick,
+                        struct logline_slice message)
+{
+	struct archive_record record;
+	struct archive_record previous;
+
+	if (segment->file == NULL)
+		return 0;
+
+	// Grow for messages longer than a block
+	while (segment->buffer_len + ARCHIVE_RECORD_MAX + message.len > segment->buffer_size)
+	{
+		segment->buffer_size *= 2;
+		segment->buffer = realloc(segment->buffer, segment->buffer_size);
+	}
+
+	// Each block starts from nothing, so it can be read on its own
+	if (segment->buffer_len == 0)
+	{
+		segment->block_first_id = id;
+		segment->block_last_id = 0;
+		segment->block_last_time = 0;
+	}
+
+	record.id = id;
+	record.time = (long long)time;
+	record.userid = userid;
+	record.nick = nick;
+	record.len = (int)message.len;
+
+	previous.id = segment->block_last_id;
+	previous.time = (long long)segment->block_last_time;
+
+	segment->buffer_len += put_record(segment->buffer + segment->buffer_len, &record, &previous);
+	memcpy(segment->buffer + segment->buffer_len, message.ptr, message.len);
+	segment->buffer_len += message.len;
+	segment->block_last_id = id;
+	segment->block_last_time = time;
+
+	// Blocks end with the message that fills them
+	if (segment->buffer_len >= ARCHIVE_BLOCK_SIZE)
+		return write_block(segment);
+
+	return 1;
+}
+
+int archive_segment_finish(struct archive_segment* segment)
+{
+	int rc;
+
+	if (segment->file == NULL || !write_block(segment))
+		return 0;
+
+	// The file has to be complete on disk before the database refers to it
+	rc = fflush(segment->file) == 0 && fsync(fileno(segment->file)) == 0;
+	rc = fclose(segment->file) == 0 && rc;
+	segment->file = NULL;
+
+	if (!rc || rename(segment->temp_path, segment->path) != 0)
+	{
+		fprintf(stderr, ARCHIVE_WRITE_FAILURE, segment->path, strerror(errno));
+		unlink(segment->temp_path);
+		return 0;
+	}
+
+	return 1;
+}
+
+void archive_segment_destroy(struct archive_segment* segment)
+{
+	if (segment->file != NULL)
+	{
+		fclose(segment->file);
+		unlink(segment->temp_path);
+		segment->file = NULL;
+	}
+
+	free(segment->buffer);
+	free(segment->blocks);
+
+	segment->buffer = NULL;
+	segment->blocks = NULL;
+	segment->block_count = 0;
+}
+
+// Read and decompress a block from its segment file
+// Returns NULL on failure
+static char* load_block(struct archive* archive, const struct archive_block* block)
+{
+	FILE* file;
+	char path[FILENAME_MAX];
+	Bytef* compressed;
+	char* data;
+	uLongf length = block->length;
+	int rc;
+
+	if (!segment_path(archive, block->channel, block->day, block->segment, path, sizeof(path)))
+	{
+		fprintf(stderr, ARCHIVE_READ_FAILURE, path, "path too long");
+		return NULL;
+	}
+
+	file = fopen(path, "rb");
+	if (file == NULL)
+	{
+		fprintf(stderr, ARCHIVE_READ_FAILURE, path, strerror(errno));
+		return NULL;
+	}
+
+	compressed = malloc(block->size);
+	data = malloc(block->length);
+
+	rc = fseek(file, block->offset, SEEK_SET) == 0 &&
+	     fread(compressed, 1, block->size, file) == (size_t)block->size &&
+	     uncompress((Bytef*)data, &length, compressed, block->size) == Z_OK &&
+	     length == (uLongf)block->length;
+
+	fclose(file);
+	free(compressed);
+
+	if (!rc)
+	{
+		fprintf(stderr, ARCHIVE_READ_FAILURE, path, "corrupt block");
+		free(data);
+		return NULL;
+	}
+
+	return data;
+}
+
+// Find a block in the cache, lock must be held
+static struct archive_cache_entry* cache_find(struct archive* archive, const struct archive_block* block)
+{
+	int i;
+	struct archive_cache_entry* entry;
+
+	for (i = 0; i < archive->cache_len; ++i)
+	{
+		entry = &archive->cache[i];
+
+		if (entry->data != NULL && entry->channel == block->channel &&
+		    entry->segment == block->segment && entry->offset == block->offset)
+		{
+			entry->used = ++archive->clock;
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+// Put a block in the cache in place of the least recently used one, lock must be held
+static struct archive_cache_entry* cache_insert(struct archive* archive, const struct archive_block* block, char* data)
+{
+	int i;
+	struct archive_cache_entry* entry = &archive->cache[0];
+
+	for (i = 1; i < archive->cache_len; ++i)
+	{
+		if (archive->cache[i].used < entry->used)
+			entry = &archive->cache[i];
+	}
+
+	free(entry->data);
+
+	entry->channel = block->channel;
+	entry->segment = block->segment;
+	entry->offset = block->offset;
+	entry->data = data;
+	entry->length = block->length;
+	entry->used = ++archive->clock;
+
+	return entry;
+}
+
+// Which message in a block to read
+struct archive_match
+{
+	long long id;                   // First at or after id, if nick is 0
+	int nick;                       // Otherwise the one from nick with userid
+	long long userid;
+};
+
+// Find the message in a decompressed block, copying it out
+static int find_message(const char* data, int length, const struct archive_match* match, struct archive_message* message)
+{
+	const char* pos = data;
+	const char* end = data + length;
+	size_t rc;
+	int len;
+	struct archive_record record;
+
+	memset(&record, 0, sizeof(record));
+
+	while (pos < end)
+	{
+		rc = get_record(pos, end, &record);
+		if (rc == 0)
+			return 0;
+
+		pos += rc;
+
+		if (match->nick == 0 ? record.id >= match->id : (record.nick == match->nick && record.userid == match->userid))
+		{
+			len = record.len < ARCHIVE_MESSAGE_LEN - 1 ? record.len : ARCHIVE_MESSAGE_LEN - 1;
+
+			message->id = record.id;
+			message->time = (time_t)record.time;
+			message->userid = record.userid;
+			message->nick = record.nick;
+			memcpy(message->message, pos, len);
+			message->message[len] = '\0';
+
+			return 1;
+		}
+
+		pos += record.len;
+	}
+
+	return 0;
+}
+
+// Find a message in a block, going through the cache
+static int read_message(struct archive* archive, const struct archive_block* block, const struct archive_match* match,
+                        struct archive_message* message)
+{
+	int rc;
+	char* data;
+	struct archive_cache_entry* entry;
+
+	if (archive->directory == NULL)
+		return 0;
+
+	pthread_mutex_lock(&archive->lock);
+
+	entry = cache_find(archive, block);
+	if (entry != NULL)
+	{
+		archive->hits++;
+		rc = find_message(entry->data, entry->length, match, message);
+
+		pthread_mutex_unlock(&archive->lock);
+		return rc;
+	}
+
+	archive->misses++;
+	pthread_mutex_unlock(&archive->lock);
+
+	// Other readers carry on while the block is read, if two read the same block the
+	// second copy just pushes something else out
+	data = load_block(archive, block);
+	if (data == NULL)
+		return 0;
+
+	pthread_mutex_lock(&archive->lock);
+
+	entry = cache_insert(archive, block, data);
+	rc = find_message(entry->data, entry->length, match, message);
+
+	pthread_mutex_unlock(&archive->lock);
+
+	return rc;
+}
+
+int archive_read_at_id(struct archive* archive, const struct archive_block* block, long long id,
+                       struct archive_message* message)
+{
+	struct archive_match match = { id, 0, 0 };
+
+	return read_message(archive, block, &match, message);
+}
+
+int archive_read_user(struct archive* archive, const struct archive_block* block, int nick, long long userid,
+                      struct archive_message* message)
+{
+	struct archive_match match = { 0, nick, userid };
+
+	return read_message(archive, block, &match, message);
+}
@@ -0,0 +1,350 @@
+#include <channel.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "errors.h"
+#include "queries.h"
+#include "statements.h"
+#include "logline.h"
+#include "import.h"
+
+// Parse line of log
+static void channel_parse_line(void* context, const char* line, size_t len)
+{
+	struct channel* channel = context;
+	time_t time;                  // Time of line
+	struct logline tokens;        // Tokenized line
+	struct logline_slice nick;    // Nick without mode character
+
+	// Split line into its parts
+	logline_tokenize(line, len, &tokens);
+
+	// Log open and day change message
+	if (tokens.kind == LOGLINE_LOG_OPENED || tokens.kind == LOGLINE_DAY_CHANGED)
+	{
+		// Convert day to unix time
+		channel->current_day = logline_day(&tokens);
+	}
+	else if (tokens.kind == LOGLINE_BAD_DATE)
+	{
+		fprintf(stderr, "Failed to parse date format %.*s\n", (int)len, line);
+	}
+	else if (tokens.kind == LOGLINE_TOPIC)
+	{
+		// Work out time
+		time = logline_time(&tokens, channel->current_day);
+
+		// Skip if from the past
+		if (time > channel->latest_time_at_load)
+		{
+			ingest_topic(&channel->ingest, time, tokens.nick, tokens.message);
+		}
+	}
+	else if (tokens.kind == LOGLINE_MESSAGE)
+	{
+		// Remove first character from nick (op char)
+		nick.ptr = tokens.nick.ptr + 1;
+		nick.len = tokens.nick.len - 1;
+
+		// Calculate time
+		time = logline_time(&tokens, channel->current_day);
+
+		if (time >= channel->latest_time_at_load)
+		{
+			// Skip messages already in the db at load
+			if (time == channel->latest_time_at_load && channel->messages_skipped < channel->messages_to_skip)
+			{
+				channel->messages_skipped++;
+
+				return;
+			}
+
+			// Queue message for the database
+			ingest_message(&channel->ingest, time, nick, tokens.message);
+
+			// Increment total message count
+			channel->messages++;
+		}
+	}
+}
+
+// Read the logfile from where the database is up to
+// Returns the offset just past the last complete line
+static off_t channel_import(struct channel* channel, FILE* logfile_fd)
+{
+	const char* import_mode;         // How to read the logfile
+	struct stat logfile_stat;        // Logfile details
+	struct checkpoint checkpoint;    // Where the last run got up to
+	size_t data_read;                // Amount of data read by getline
+	char* line;                      // Pointer to getline buffer
+	size_t size;                     // Size of getline buffer
+	off_t old_position;              // Old position in buffer
+
+	// Resume from the last checkpoint if it was taken on this logfile
+	if (store_load_checkpoint(channel->store, channel->id, &checkpoint))
+	{
+		if (fstat(fileno(logfile_fd), &logfile_stat) == 0 &&
+		    checkpoint.inode == (long long)logfile_stat.st_ino &&
+		    checkpoint.size <= (long long)logfile_stat.st_size)
+		{
+			printf("%s: Resuming from byte %lld of logfile\n", channel->name, checkpoint.offset);
+
+			fseek(logfile_fd, checkpoint.offset, SEEK_SET);
+			channel->current_day = checkpoint.day;
+
+			// Everything before the checkpoint is already in the database
+			channel->latest_time_at_load = 0;
+			channel->messages_to_skip = 0;
+		}
+		else
+		{
+			printf("%s: Logfile was replaced or truncated since the last checkpoint, rescanning\n", channel->name);
+		}
+	}
+
+	// Checkpoint the logfile position with every record
+	ingest_track(&channel->ingest, fileno(logfile_fd), ftell(logfile_fd), &channel->current_day);
+
+	// Iterate through lines
+	printf("%s: Parsing logfile...\n", channel->name);
+
+	if (channel->latest_time_at_load > 0)
+	{
+		printf("%s: Skipping to new messages...\n", channel->name);
+	}
+
+	// Get starting position in buffer
+	old_position = ftell(logfile_fd);
+
+	// Parallel import can't skip messages that are already in the database by time
+	import_mode = channel->settings.import_mode;
+	if (strcmp(import_mode, "parallel") == 0 && channel->latest_time_at_load > 0)
+	{
+		printf("%s: Channel isn't empty, importing new messages in one thread\n", channel->name);
+		import_mode = "mmap";
+	}
+
+	if (strcmp(import_mode, "parallel") == 0)
+	{
+		// Parse whole days on a pool of threads, writing them in order
+		old_position = import_parallel(fileno(logfile_fd), old_position, channel->settings.import_threads,
+		                               &channel->ingest, &channel->current_day, &channel->messages);
+	}
+	else if (strcmp(import_mode, "stream") != 0)
+	{
+		// Read all complete lines straight from the file
+		old_position = import_file(fileno(logfile_fd), old_position, &channel->ingest);
+	}
+	else
+	{
+		// Read lines
+		line = NULL;
+		size = 0;
+		while ((data_read = getline(&line, &size, logfile_fd)) != -1)
+		{
+			// If last character isn't a linebreak,
+			// Break and let monitoring loop get it instead
+			// (this is the last line of the file and is not yet complete)
+			if (line[data_read-1] != '\n')
+				break;
+
+			// Update position in buffer
+			old_position = ftell(logfile_fd);
+
+			// Parse line
+			ingest_line(&channel->ingest, line, data_read);
+		}
+
+		// Free memory allocated by getline
+		free(line);
+	}
+
+	printf("%s: Finished parsing logfile (%lu lines).\n", channel->name, channel->ingest.lines);
+
+	return old_position;
+}
+
+// Worker thread, imports the logfile then follows it
+static void* channel_run(void* arg)
+{
+	struct channel* channel = arg;
+	FILE* logfile_fd;                // Logfile for the initial import
+	off_t position;                  // Offset just past the last complete line
+	int rc;
+
+	logfile_fd = fopen(channel->logfile, "r");
+	if (logfile_fd == NULL)
+	{
+		fprintf(stderr, "%s: Failed to open logfile %s\n", channel->name, channel->logfile);
+		return NULL;
+	}
+
+	position = channel_import(channel, logfile_fd);
+
+	// Follow the logfile from where the import stopped
+	tail_attach(&channel->tail, dup(fileno(logfile_fd)), position, &channel->ingest);
+	fclose(logfile_fd);
+
+	// Wait for changes
+	printf("%s: Waiting for new messages...\n", channel->name);
+	do
+	{
+		rc = tail_wait(&channel->tail, -1);
+	}
+	while (rc >= 0);
+
+	return NULL;
+}
+
+struct channel channel_create(struct store* store, struct writer* writer,
+                              const char* network, const char* name, const char* logfile)
+{
+	struct channel channel;
+	struct statement_cache* statements;
+	sqlite3_stmt* statement;
+	int rc;
+
+	memset(&channel, 0, sizeof(channel));
+
+	channel.name = name;
+	channel.network = network;
+	channel.logfile = logfile;
+	channel.store = store;
+	channel.writer = writer;
+	channel.tail.inotify_fd = -1;
+
+	channel.id = store_channel(store, network, name);
+	if (channel.id < 0)
+		return channel;
+
+	// Get this thread's statement cache
+	statements = sc_thread_cache(store->db);
+
+	// Get latest message time from database
+	statement = sc_get(statements, STMT_SELECT_LATEST_MESSAGES);
+	if (statement == NULL)
+		return channel;
+
+	// Bind parameters
+	sqlite3_bind_int(statement, 1, channel.id);
+	sqlite3_bind_int(statement, 2, 1);       // Number of messages to retrieve (1)
+
+	// Run statement
+	rc = sqlite3_step(statement);
+	if (rc == SQLITE_ROW)
+	{
+		channel.latest_time_at_load = (time_t)sqlite3_column_int(statement, 0);
+
+		printf("%s: Got latest time from database: %d\n", name, (int)channel.latest_time_at_load);
+
+		sqlite3_reset(statement);
+
+		// Get number of messages to skip at this time
+		// (so we don't double up messages at the same time)
+		statement = sc_get(statements, STMT_SELECT_MESSAGE_COUNT_AT_TIME);
+		if (statement == NULL)
+			return channel;
+
+		// Bind parameters
+		sqlite3_bind_int(statement, 1, channel.id);
+		sqlite3_bind_int(statement, 2, channel.latest_time_at_load);
+
+		// Run statement
+		rc = sqlite3_step(statement);
+		if (rc == SQLITE_ROW)
+		{
+			channel.messages_to_skip = sqlite3_column_int(statement, 0);
+		}
+	}
+	else
+	{
+		sqlite3_reset(statement);
+
+		// Quiet channels can have every message archived
+		statement = sc_get(statements, STMT_SELECT_ARCHIVE_LATEST);
+		if (statement == NULL)
+			return channel;
+
+		sqlite3_bind_int(statement, 1, channel.id);
+
+		if (sqlite3_step(statement) == SQLITE_ROW)
+		{
+			channel.latest_time_at_load = (time_t)sqlite3_column_int64(statement, 0);
+			channel.messages_to_skip = sqlite3_column_int(statement, 1);
+
+			printf("%s: Got latest time from archive: %d\n", name, (int)channel.latest_time_at_load);
+		}
+		else
+		{
+			printf("%s: New channel\n", name);
+		}
+	}
+
+	sqlite3_reset(statement);
+
+	// Get total message count
+	statement = sc_get(statements, STMT_SELECT_MESSAGE_COUNT);
+	if (statement == NULL)
+		return channel;
+
+	sqlite3_bind_int(statement, 1, channel.id);
+
+	rc = sqlite3_step(statement);
+	if (rc == SQLITE_ROW)
+	{
+		channel.messages = sqlite3_column_int(statement, 0);
+
+		printf("%s: Got message count: %d\n", name, channel.messages);
+	}
+
+	sqlite3_reset(statement);
+
+	return channel;
+}
+
+void channel_destroy(struct channel* channel)
+{
+	if (channel->tail.inotify_fd >= 0)
+		tail_destroy(&channel->tail);
+}
+
+int channel_start(struct channel* channel, const struct channel_settings* settings)
+{
+	channel->settings = *settings;
+
+	// Queue parsed lines for the writer
+	channel->ingest = ingest_create(channel->writer, channel->id, channel_parse_line, channel);
+
+	// Initialise inotify and watch logfile
+	printf("%s: Watching logfile %s...\n", channel->name, channel->logfile);
+	channel->tail = tail_create(channel->logfile);
+
+	if (channel->tail.inotify_fd < 0)
+	{
+		fprintf(stderr, INOTIFY_INIT_FAILURE);
+		return INOTIFY_INIT_FAILURE_ID;
+	}
+
+	if (channel->tail.file_wd < 0)
+	{
+		fprintf(stderr, INOTIFY_WATCH_FAILURE);
+		return INOTIFY_WATCH_FAILURE_ID;
+	}
+
+	if (pthread_create(&channel->thread, NULL, channel_run, channel) != 0)
+	{
+		fprintf(stderr, CHANNEL_THREAD_FAILURE, channel->name);
+		return CHANNEL_THREAD_FAILURE_ID;
+	}
+
+	return 0;
+}
+
+void channel_join(struct channel* channel)
+{
+	pthread_join(channel->thread, NULL);
+}
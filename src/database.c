@@ -0,0 +1,210 @@
+#include <database.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "errors.h"
+#include "queries.h"
+
+// Run SQL on a connection, reporting any error
+static int database_exec(sqlite3* db, const char* sql)
+{
+	int rc;
+	char* error = NULL;
+
+	rc = sqlite3_exec(db, sql, NULL, NULL, &error);
+	if (rc != SQLITE_OK)
+	{
+		fprintf(stderr, SQLITE_QUERY_FAILURE, error);
+		fprintf(stderr, SQLITE_PROBLEM_QUERY, sql);
+	}
+
+	sqlite3_free(error);
+
+	return rc;
+}
+
+// Switch the journal to WAL, returns 1 if it is now in WAL mode
+static int database_enable_wal(sqlite3* db)
+{
+	int wal = 0;
+	const char* mode;
+	sqlite3_stmt* statement;
+
+	if (sqlite3_prepare_v2(db, ENABLE_WAL, -1, &statement, NULL) != SQLITE_OK)
+		return 0;
+
+	// Answers with the journal mode in use, which is unchanged if WAL isn't possible
+	if (sqlite3_step(statement) == SQLITE_ROW)
+	{
+		mode = (const char*)sqlite3_column_text(statement, 0);
+		wal = mode != NULL && strcmp(mode, "wal") == 0;
+	}
+
+	sqlite3_finalize(statement);
+
+	// Only the WAL has to be synced on commit now
+	if (wal)
+		database_exec(db, WAL_SYNCHRONOUS);
+
+	return wal;
+}
+
+static sqlite3* reader_open(struct database* database)
+{
+	int rc;
+	sqlite3* db;
+
+	rc = sqlite3_open_v2(database->uri, &db, SQLITE_OPEN_READONLY | database->open_flags, NULL);
+	if (rc != SQLITE_OK)
+	{
+		fprintf(stderr, SQLITE_DATABASE_CREATION_FAILURE, sqlite3_errmsg(db));
+		sqlite3_close(db);
+		return NULL;
+	}
+
+	sqlite3_busy_timeout(db, DATABASE_BUSY_TIMEOUT);
+
+	return db;
+}
+
+// Hand an exiting thread's reader to the next thread that needs one
+static void reader_release(void* ptr)
+{
+	struct database_reader* reader = ptr;
+
+	pthread_mutex_lock(&reader->database->lock);
+	reader->idle = 1;
+	pthread_mutex_unlock(&reader->database->lock);
+}
+
+struct database database_create(const char* filename, int shared_memory)
+{
+	struct database database;
+
+	memset(&database, 0, sizeof(database));
+
+	database.filename = filename;
+	database.uri = filename;
+
+	database.memory = strcmp(filename, ":memory:") == 0;
+
+	if (database.memory)
+	{
+		// A private in-memory database can only have one connection
+		if (shared_memory)
+		{
+			database.uri = DATABASE_SHARED_MEMORY_URI;
+			database.open_flags = SQLITE_OPEN_URI;
+			database.separate_readers = 1;
+		}
+	}
+	else
+	{
+		database.separate_readers = 1;
+	}
+
+	return database;
+}
+
+int database_open(struct database* database)
+{
+	int rc;
+	sqlite3_int64 limit = DATABASE_MEMORY_LIMIT;
+
+	rc = sqlite3_open_v2(database->uri, &database->writer,
+	                     SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | database->open_flags, NULL);
+	if (rc != SQLITE_OK)
+		return rc;
+
+	// Readers only hold the writer up while it commits, and only without WAL
+	sqlite3_busy_timeout(database->writer, DATABASE_BUSY_TIMEOUT);
+
+	if (database->memory && database->separate_readers)
+		sqlite3_file_control(database->writer, "main", SQLITE_FCNTL_SIZE_LIMIT, &limit);
+
+	if (!database->memory)
+	{
+		database->wal = database_enable_wal(database->writer);
+		if (!database->wal)
+			fprintf(stderr, DATABASE_WAL_FAILURE, database->filename);
+	}
+
+	pthread_key_create(&database->reader_key, reader_release);
+	pthread_mutex_init(&database->lock, NULL);
+
+	return SQLITE_OK;
+}
+
+void database_close(struct database* database)
+{
+	struct database_reader* reader;
+	struct database_reader* next;
+
+	for (reader = database->readers; reader != NULL; reader = next)
+	{
+		next = reader->next;
+
+		// Waits for any statements still cached by the thread that had it
+		sqlite3_close_v2(reader->db);
+		free(reader);
+	}
+
+	sqlite3_close_v2(database->writer);
+
+	pthread_key_delete(database->reader_key);
+	pthread_mutex_destroy(&database->lock);
+
+	database->readers = NULL;
+	database->reader_count = 0;
+	database->writer = NULL;
+}
+
+sqlite3* database_reader(struct database* database)
+{
+	struct database_reader* reader;
+	sqlite3* db;
+
+	if (!database->separate_readers)
+		return database->writer;
+
+	reader = pthread_getspecific(database->reader_key);
+	if (reader != NULL)
+		return reader->db;
+
+	// Take over a reader from a thread that has exited
+	pthread_mutex_lock(&database->lock);
+	for (reader = database->readers; reader != NULL; reader = reader->next)
+	{
+		if (reader->idle)
+		{
+			reader->idle = 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&database->lock);
+
+	// Or open a new one
+	if (reader == NULL)
+	{
+		db = reader_open(database);
+		if (db == NULL)
+			return database->writer;
+
+		reader = malloc(sizeof(struct database_reader));
+		reader->database = database;
+		reader->db = db;
+		reader->idle = 0;
+
+		pthread_mutex_lock(&database->lock);
+		reader->next = database->readers;
+		database->readers = reader;
+		database->reader_count++;
+		pthread_mutex_unlock(&database->lock);
+	}
+
+	pthread_setspecific(database->reader_key, reader);
+
+	return reader->db;
+}
@@ -0,0 +1,187 @@
+#include <httpd.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/resource.h>
+
+#include "errors.h"
+
+static const char unavailable_text[] = "Too busy, try again shortly\n";
+
+// Raise the file descriptor limit to fit connection_limit connections of connection_fds each, and
+// reserved_fds more, as far as the hard limit allows
+// Returns the connection limit that fits
+static int httpd_fit_fd_limit(int connection_limit, int connection_fds, int reserved_fds)
+{
+	struct rlimit limit;
+	rlim_t wanted = (rlim_t)connection_limit * connection_fds + reserved_fds;
+
+	if (getrlimit(RLIMIT_NOFILE, &limit) != 0)
+		return connection_limit;
+
+	if (limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < wanted)
+	{
+		limit.rlim_cur = (limit.rlim_max != RLIM_INFINITY && limit.rlim_max < wanted) ? limit.rlim_max : wanted;
+		setrlimit(RLIMIT_NOFILE, &limit);
+		getrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	if (limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < wanted)
+	{
+		connection_limit = limit.rlim_cur > (rlim_t)reserved_fds * 2 ? ((int)limit.rlim_cur - reserved_fds) / connection_fds
+		                                                             : (int)limit.rlim_cur / 2 / connection_fds;
+		if (connection_limit < 1)
+			connection_limit = 1;
+
+		printf("Warning: only %llu file descriptors are available, limiting the httpd to %d connections\n",
+		       (unsigned long long)limit.rlim_cur, connection_limit);
+	}
+
+	return connection_limit;
+}
+
+struct httpd httpd_create()
+{
+	struct httpd httpd;
+
+	memset(&httpd, 0, sizeof(httpd));
+
+	atomic_init(&httpd.rendering, 0);
+	atomic_init(&httpd.shed, 0);
+
+	return httpd;
+}
+
+void httpd_destroy(struct httpd* httpd)
+{
+	if (httpd->unavailable != NULL)
+		MHD_destroy_response(httpd->unavailable);
+
+	httpd->unavailable = NULL;
+}
+
+int httpd_start(struct httpd* httpd, const struct httpd_settings* settings, int port,
+                MHD_AccessHandlerCallback handler, void* handler_cls)
+{
+	const char* mode = settings->mode != NULL ? settings->mode : "epoll";
+	unsigned int flags;
+	int threads = settings->threads;
+	int connection_limit = settings->connection_limit > 0 ? settings->connection_limit : HTTPD_DEFAULT_CONNECTION_LIMIT;
+	int connection_fds = 1;
+	int reserved_fds = settings->reserved_fds + HTTPD_RESERVED_FDS;
+	int poll_supported = MHD_is_feature_supported(MHD_FEATURE_POLL) == MHD_YES;
+
+	// Pick the event loop, falling back to poll where epoll isn't available
+	if (strcmp(mode, "epoll") == 0 && MHD_is_feature_supported(MHD_FEATURE_EPOLL) != MHD_YES)
+	{
+		printf("Warning: microhttpd doesn't support epoll here, using poll\n");
+		mode = "poll";
+	}
+
+	if (strcmp(mode, "epoll") == 0)
+		flags = MHD_USE_EPOLL_INTERNALLY;
+	else if (strcmp(mode, "poll") == 0)
+		flags = poll_supported ? MHD_USE_POLL_INTERNALLY : MHD_USE_SELECT_INTERNALLY;
+	else if (strcmp(mode, "select") == 0)
+		flags = MHD_USE_SELECT_INTERNALLY;
+	else if (strcmp(mode, "thread_per_connection") == 0)
+		flags = MHD_USE_THREAD_PER_CONNECTION | (poll_supported ? MHD_USE_POLL_INTERNALLY : MHD_USE_SELECT_INTERNALLY);
+	else
+	{
+		fprintf(stderr, HTTPD_MODE_INVALID, mode);
+		return HTTPD_MODE_INVALID_ID;
+	}
+
+	// Every connection has its own thread instead of sharing the pool's
+	if (flags & MHD_USE_THREAD_PER_CONNECTION)
+		threads = 0;
+	else if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	// Each thread that renders a page keeps a database reader, so pool threads have one each,
+	// and with a thread per connection every connection can have one
+	if (threads > 0)
+		reserved_fds += threads * (HTTPD_THREAD_FDS + settings->reader_fds);
+	else
+		connection_fds += settings->reader_fds;
+
+	// select() can't watch descriptors past FD_SETSIZE, and it's what's used without poll or epoll,
+	// thread_per_connection included
+	if ((flags & (MHD_USE_POLL | MHD_USE_EPOLL)) == 0 &&
+	    connection_limit > (FD_SETSIZE - reserved_fds) / connection_fds)
+	{
+		connection_limit = FD_SETSIZE > reserved_fds ? (FD_SETSIZE - reserved_fds) / connection_fds : 0;
+		if (connection_limit < 1)
+			connection_limit = 1;
+
+		printf("Warning: select can only watch %d connections\n", connection_limit);
+	}
+
+	connection_limit = httpd_fit_fd_limit(connection_limit, connection_fds, reserved_fds);
+
+	// Created once and shared by every request that's turned away
+	httpd->max_rendering = settings->max_rendering;
+	httpd->unavailable = MHD_create_response_from_buffer(strlen(unavailable_text), (void*)unavailable_text,
+	                                                     MHD_RESPMEM_PERSISTENT);
+	if (httpd->unavailable == NULL)
+	{
+		fprintf(stderr, MHD_INIT_FAILURE);
+		return MHD_INIT_FAILURE_ID;
+	}
+
+	MHD_add_response_header(httpd->unavailable, MHD_HTTP_HEADER_RETRY_AFTER, HTTPD_RETRY_AFTER);
+
+	httpd->daemon = MHD_start_daemon(flags, port, NULL, NULL,
+	                                 handler, handler_cls,
+	                                 MHD_OPTION_THREAD_POOL_SIZE, (unsigned int)threads,
+	                                 MHD_OPTION_CONNECTION_LIMIT, (unsigned int)connection_limit,
+	                                 MHD_OPTION_PER_IP_CONNECTION_LIMIT,
+	                                 (unsigned int)(settings->per_ip_connection_limit > 0 ? settings->per_ip_connection_limit : 0),
+	                                 MHD_OPTION_CONNECTION_TIMEOUT,
+	                                 (unsigned int)(settings->timeout > 0 ? settings->timeout : 0),
+	                                 MHD_OPTION_END);
+	if (httpd->daemon == NULL)
+	{
+		fprintf(stderr, MHD_INIT_FAILURE);
+		return MHD_INIT_FAILURE_ID;
+	}
+
+	if (threads > 0)
+		printf("Serving on port %d with %s and %d threads, up to %d connections\n", port, mode, threads, connection_limit);
+	else
+		printf("Serving on port %d with a thread per connection, up to %d connections\n", port, connection_limit);
+
+	return 0;
+}
+
+void httpd_stop(struct httpd* httpd)
+{
+	if (httpd->daemon != NULL)
+		MHD_stop_daemon(httpd->daemon);
+
+	httpd->daemon = NULL;
+}
+
+int httpd_render_begin(struct httpd* httpd)
+{
+	if (atomic_fetch_add(&httpd->rendering, 1) >= httpd->max_rendering && httpd->max_rendering > 0)
+	{
+		atomic_fetch_sub(&httpd->rendering, 1);
+		atomic_fetch_add(&httpd->shed, 1);
+		return 0;
+	}
+
+	return 1;
+}
+
+void httpd_render_end(struct httpd* httpd)
+{
+	atomic_fetch_sub(&httpd->rendering, 1);
+}
+
+int httpd_queue_unavailable(struct httpd* httpd, struct MHD_Connection* connection)
+{
+	return MHD_queue_response(connection, MHD_HTTP_SERVICE_UNAVAILABLE, httpd->unavailable);
+}
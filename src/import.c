@@ -0,0 +1,536 @@
+#define _GNU_SOURCE
+
+#include <import.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <malloc.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "logline.h"
+#include "store.h"
+
+// Feed complete lines in [start, end) to the batch
+// Returns a pointer to the start of the first incomplete line
+static const char* import_lines(const char* start, const char* end, struct ingest_batch* batch)
+{
+	const char* newline;
+
+	// memchr is vectorised by libc, so this runs close to memory speed
+	while ((newline = memchr(start, '\n', end - start)) != NULL)
+	{
+		ingest_line(batch, start, newline - start + 1);
+		start = newline + 1;
+	}
+
+	return start;
+}
+
+// Read the file in large blocks, for files that can't be mapped
+static off_t import_blocks(int fd, off_t offset, struct ingest_batch* batch)
+{
+	char* buffer;                   // Read buffer
+	size_t buffer_len;              // Size of read buffer
+	size_t used;                    // Bytes of buffer holding data
+	ssize_t data_read;              // Bytes read by read()
+	const char* rest;               // Start of incomplete line in buffer
+
+	buffer_len = IMPORT_BLOCK_SIZE;
+	buffer = malloc(buffer_len);
+	used = 0;
+
+	// Pipes can't seek, but can still be read from the start
+	if (lseek(fd, offset, SEEK_SET) < 0 && offset != 0)
+	{
+		free(buffer);
+		return offset;
+	}
+
+	for (;;)
+	{
+		// Grow the buffer if a single line doesn't fit
+		if (used == buffer_len)
+		{
+			buffer_len *= 2;
+			buffer = realloc(buffer, buffer_len);
+		}
+
+		data_read = read(fd, buffer + used, buffer_len - used);
+		if (data_read <= 0)
+			break;
+
+		used += data_read;
+
+		// Parse complete lines and move the incomplete one to the front
+		rest = import_lines(buffer, buffer + used, batch);
+
+		offset += rest - buffer;
+		used -= rest - buffer;
+		memmove(buffer, rest, used);
+	}
+
+	free(buffer);
+
+	return offset;
+}
+
+off_t import_file(int fd, off_t offset, struct ingest_batch* batch)
+{
+	struct stat file_stat;          // Logfile details
+	char* map;                      // Mapped logfile
+	const char* rest;               // Start of incomplete last line
+
+	if (fstat(fd, &file_stat) < 0 || !S_ISREG(file_stat.st_mode))
+		return import_blocks(fd, offset, batch);
+
+	// Nothing new to read
+	if (file_stat.st_size <= offset)
+		return offset;
+
+	map = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+	{
+		perror("mmap");
+		return import_blocks(fd, offset, batch);
+	}
+
+	// The whole file is read front to back once
+	madvise(map, file_stat.st_size, MADV_SEQUENTIAL);
+
+	rest = import_lines(map + offset, map + file_stat.st_size, batch);
+	offset = rest - map;
+
+	munmap(map, file_stat.st_size);
+
+	return offset;
+}
+
+// A parsed topic or message waiting to be written
+struct import_record
+{
+	enum logline_kind kind;
+	time_t time;
+	struct logline_slice nick;      // Without mode character for messages
+	struct logline_slice message;
+	int user;                       // Index into shard users (messages only)
+	int ordinal;                    // Message number for the user within the shard
+};
+
+// Messages by one nick within a shard
+struct import_user
+{
+	struct logline_slice nick;
+	int messages;
+	time_t lastseen;
+};
+
+// A run of whole days parsed by one worker
+struct import_shard
+{
+	const char* start;
+	const char* end;
+
+	time_t day;                     // Current day, at the start and then the end of the shard
+	int lines;                      // Lines in the shard
+	int messages;                   // Messages in the shard
+	int parsed;                     // Set once a worker has finished with the shard
+
+	int channel;                    // Channel the shard is written to
+	struct import_pool* pool;       // Pool the shard belongs to
+
+	struct import_record* records;
+	int record_count, record_max;
+
+	struct import_user* users;
+	int user_count, user_max;
+
+	int* user_table;                // Open addressed hash of user index + 1
+	int user_table_len;             // Always a power of two
+};
+
+// State shared by the workers and the writer
+struct import_pool
+{
+	struct import_shard* shards;
+	int shard_count;
+
+	int next_shard;                 // Next shard for a worker to take
+	int written;                    // Shards written so far
+	int ahead;                      // Most shards parsed but not yet written
+
+	const struct alias_table* aliases;
+
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+};
+
+static void shard_grow_user_table(struct import_shard* shard)
+{
+	int i;
+	unsigned int slot;
+
+	free(shard->user_table);
+
+	shard->user_table_len = shard->user_table_len ? shard->user_table_len * 2 : 256;
+	shard->user_table = calloc(shard->user_table_len, sizeof(int));
+
+	// Rehash existing users
+	for (i = 0; i < shard->user_count; ++i)
+	{
+		slot = logline_nick_hash(shard->users[i].nick.ptr, shard->users[i].nick.len) & (shard->user_table_len - 1);
+		while (shard->user_table[slot] != 0)
+			slot = (slot + 1) & (shard->user_table_len - 1);
+
+		shard->user_table[slot] = i + 1;
+	}
+}
+
+// Find or add the shard user for nick, returns its index
+static int shard_user(struct import_shard* shard, struct logline_slice nick)
+{
+	unsigned int slot;
+	struct import_user* user;
+
+	// Keep the table at most half full
+	if (shard->user_count * 2 >= shard->user_table_len)
+		shard_grow_user_table(shard);
+
+	slot = logline_nick_hash(nick.ptr, nick.len) & (shard->user_table_len - 1);
+	while (shard->user_table[slot] != 0)
+	{
+		user = &shard->users[shard->user_table[slot] - 1];
+
+		// Nicks are case insensitive, like the nick table they're counted against
+		if (logline_nick_equal(user->nick.ptr, user->nick.len, nick.ptr, nick.len))
+			return shard->user_table[slot] - 1;
+
+		slot = (slot + 1) & (shard->user_table_len - 1);
+	}
+
+	// New user
+	if (shard->user_count == shard->user_max)
+	{
+		shard->user_max = shard->user_max ? shard->user_max * 2 : 64;
+		shard->users = realloc(shard->users, sizeof(struct import_user) * shard->user_max);
+	}
+
+	user = &shard->users[shard->user_count];
+	user->nick = nick;
+	user->messages = 0;
+	user->lastseen = 0;
+
+	shard->user_table[slot] = ++shard->user_count;
+
+	return shard->user_count - 1;
+}
+
+static struct import_record* shard_add_record(struct import_shard* shard)
+{
+	if (shard->record_count == shard->record_max)
+	{
+		shard->record_max = shard->record_max ? shard->record_max * 2 : 4096;
+		shard->records = realloc(shard->records, sizeof(struct import_record) * shard->record_max);
+	}
+
+	return &shard->records[shard->record_count++];
+}
+
+// Tokenize a shard into records, only touching the shard's own state
+static void shard_parse(struct import_shard* shard, const struct alias_table* aliases)
+{
+	const char* pos = shard->start;
+	const char* newline;
+	struct logline tokens;
+	struct import_record* record;
+	struct import_user* user;
+
+	while ((newline = memchr(pos, '\n', shard->end - pos)) != NULL)
+	{
+		logline_tokenize(pos, newline - pos, &tokens);
+
+		if (tokens.kind == LOGLINE_LOG_OPENED || tokens.kind == LOGLINE_DAY_CHANGED)
+		{
+			shard->day = logline_day(&tokens);
+		}
+		else if (tokens.kind == LOGLINE_BAD_DATE)
+		{
+			fprintf(stderr, "Failed to parse date format %.*s\n", (int)(newline - pos), pos);
+		}
+		else if (tokens.kind == LOGLINE_TOPIC)
+		{
+			record = shard_add_record(shard);
+			record->kind = LOGLINE_TOPIC;
+			record->time = logline_time(&tokens, shard->day);
+			record->nick = tokens.nick;
+			record->message = tokens.message;
+		}
+		else if (tokens.kind == LOGLINE_MESSAGE)
+		{
+			record = shard_add_record(shard);
+			record->kind = LOGLINE_MESSAGE;
+			record->time = logline_time(&tokens, shard->day);
+
+			// Remove first character from nick (op char) and attribute aliases to their main nick
+			record->nick.ptr = tokens.nick.ptr + 1;
+			record->nick.len = tokens.nick.len - 1;
+			record->nick = alias_resolve(aliases, record->nick);
+			record->message = tokens.message;
+
+			// Count the message for its user
+			record->user = shard_user(shard, record->nick);
+			user = &shard->users[record->user];
+			record->ordinal = user->messages++;
+			user->lastseen = record->time;
+
+			shard->messages++;
+		}
+
+		shard->lines++;
+		pos = newline + 1;
+	}
+}
+
+// Write a parsed shard
+static void shard_write(struct import_shard* shard, struct store* store)
+{
+	int i;
+	int* nicks;
+	long long* first_userid;
+	struct import_record* record;
+	long long userid;
+
+	// One message count update per user, remembering their nick id and where their userids start
+	nicks = malloc(sizeof(int) * (shard->user_count + 1));
+	first_userid = malloc(sizeof(long long) * (shard->user_count + 1));
+	for (i = 0; i < shard->user_count; ++i)
+	{
+		nicks[i] = store_nick(store, shard->users[i].nick);
+		first_userid[i] = store_add_messages(store, shard->channel, nicks[i],
+		                                     shard->users[i].messages, shard->users[i].lastseen);
+	}
+
+	// Then the records themselves, in file order
+	for (i = 0; i < shard->record_count; ++i)
+	{
+		record = &shard->records[i];
+
+		if (record->kind == LOGLINE_TOPIC)
+		{
+			store_topic(store, shard->channel, record->nick, record->message, record->time);
+		}
+		else
+		{
+			// Give each message the userid it would have got if written one at a time
+			if (first_userid[record->user] == STORE_NO_USERID)
+				userid = STORE_NO_USERID;
+			else
+				userid = first_userid[record->user] + record->ordinal;
+
+			store_message_userid(store, shard->channel, nicks[record->user], record->message, record->time, userid);
+		}
+	}
+
+	free(nicks);
+	free(first_userid);
+}
+
+static void shard_free(struct import_shard* shard)
+{
+	free(shard->records);
+	free(shard->users);
+	free(shard->user_table);
+
+	shard->records = NULL;
+	shard->users = NULL;
+	shard->user_table = NULL;
+}
+
+// Runs on the writer thread, and again if the transaction it's in is rolled back
+static void shard_call(struct store* store, void* arg)
+{
+	shard_write(arg, store);
+}
+
+// Once the shard is committed, lets the workers move on to more shards
+static void shard_done(void* arg)
+{
+	struct import_shard* shard = arg;
+	struct import_pool* pool = shard->pool;
+
+	shard_free(shard);
+
+	pthread_mutex_lock(&pool->lock);
+	pool->written++;
+	pthread_cond_broadcast(&pool->changed);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static void* import_worker(void* ptr)
+{
+	struct import_pool* pool = ptr;
+	int shard;
+
+	for (;;)
+	{
+		// Take the next shard, without getting too far ahead of the writer
+		pthread_mutex_lock(&pool->lock);
+		while (pool->next_shard < pool->shard_count &&
+		       pool->next_shard >= pool->written + pool->ahead)
+		{
+			pthread_cond_wait(&pool->changed, &pool->lock);
+		}
+
+		if (pool->next_shard >= pool->shard_count)
+		{
+			pthread_mutex_unlock(&pool->lock);
+			break;
+		}
+
+		shard = pool->next_shard++;
+		pthread_mutex_unlock(&pool->lock);
+
+		shard_parse(&pool->shards[shard], pool->aliases);
+
+		// Let the writer know
+		pthread_mutex_lock(&pool->lock);
+		pool->shards[shard].parsed = 1;
+		pthread_cond_broadcast(&pool->changed);
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	return NULL;
+}
+
+// Find the first day marker line after pos
+static const char* next_day_marker(const char* pos, const char* end)
+{
+	const char* newline;
+
+	while ((newline = memchr(pos, '\n', end - pos)) != NULL)
+	{
+		pos = newline + 1;
+
+		if (logline_is_day_marker(pos, end - pos))
+			return pos;
+	}
+
+	return end;
+}
+
+off_t import_parallel(int fd, off_t offset, int threads, struct ingest_batch* batch,
+                      time_t* day, int* messages)
+{
+	struct stat file_stat;          // Logfile details
+	char* map;                      // Mapped logfile
+	const char* start;              // Start of the data to import
+	const char* end;                // End of the last complete line
+	const char* pos;                // Shard boundary
+	struct import_pool pool;        // Shards and worker state
+	pthread_t* workers;             // Worker threads
+	int i;
+
+	if (threads < 1)
+		threads = 1;
+
+	if (fstat(fd, &file_stat) < 0 || !S_ISREG(file_stat.st_mode) || file_stat.st_size <= offset)
+		return import_file(fd, offset, batch);
+
+	map = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+	{
+		perror("mmap");
+		return import_file(fd, offset, batch);
+	}
+
+	// Only whole lines are imported
+	start = map + offset;
+	end = memrchr(start, '\n', map + file_stat.st_size - start);
+	if (end == NULL)
+	{
+		munmap(map, file_stat.st_size);
+		return offset;
+	}
+	end++;
+
+	// Split into shards of roughly IMPORT_SHARD_SIZE, each starting on a new day
+	memset(&pool, 0, sizeof(struct import_pool));
+	pos = start;
+	while (pos < end)
+	{
+		struct import_shard* shard;
+
+		if (pool.shard_count % 64 == 0)
+			pool.shards = realloc(pool.shards, sizeof(struct import_shard) * (pool.shard_count + 64));
+
+		shard = &pool.shards[pool.shard_count++];
+		memset(shard, 0, sizeof(struct import_shard));
+
+		shard->start = pos;
+		shard->day = *day;
+		shard->channel = batch->channel;
+
+		if (end - pos > IMPORT_SHARD_SIZE)
+			pos = next_day_marker(pos + IMPORT_SHARD_SIZE - 1, end);
+		else
+			pos = end;
+
+		shard->end = pos;
+	}
+
+	printf("Importing %d shards on %d threads...\n", pool.shard_count, threads);
+
+	// The file is read front to back, just not by one thread
+	madvise(map + offset, file_stat.st_size - offset, MADV_SEQUENTIAL);
+
+	// Start workers
+	pool.ahead = threads * IMPORT_SHARDS_AHEAD;
+	pool.aliases = &batch->writer->store->aliases;
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.changed, NULL);
+
+	workers = malloc(sizeof(pthread_t) * threads);
+	for (i = 0; i < threads; ++i)
+		pthread_create(&workers[i], NULL, import_worker, &pool);
+
+	// Queue shards for the writer in order as they become ready
+	for (i = 0; i < pool.shard_count; ++i)
+	{
+		struct import_shard* shard = &pool.shards[i];
+
+		pthread_mutex_lock(&pool.lock);
+		while (!shard->parsed)
+			pthread_cond_wait(&pool.changed, &pool.lock);
+		pthread_mutex_unlock(&pool.lock);
+
+		// The day has to be current for the shard's checkpoint
+		*day = shard->day;
+		*messages += shard->messages;
+
+		shard->pool = &pool;
+		ingest_count(batch, shard->lines, shard->end - shard->start);
+		ingest_call(batch, shard_call, shard_done, shard);
+	}
+
+	// Shards point into the mapped file, so wait until they're written
+	pthread_mutex_lock(&pool.lock);
+	while (pool.written < pool.shard_count)
+		pthread_cond_wait(&pool.changed, &pool.lock);
+	pthread_mutex_unlock(&pool.lock);
+
+	for (i = 0; i < threads; ++i)
+		pthread_join(workers[i], NULL);
+
+	free(workers);
+	free(pool.shards);
+	pthread_cond_destroy(&pool.changed);
+	pthread_mutex_destroy(&pool.lock);
+
+	offset = end - map;
+	munmap(map, file_stat.st_size);
+
+	return offset;
+}
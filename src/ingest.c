@@ -0,0 +1,95 @@
+#include <ingest.h>
+
+#include <sys/stat.h>
+
+// Where the logfile is up to, or NULL if it isn't being tracked
+static const struct checkpoint* ingest_checkpoint(struct ingest_batch* batch, struct checkpoint* checkpoint)
+{
+	if (batch->inode == 0)
+		return NULL;
+
+	checkpoint->inode = batch->inode;
+	checkpoint->size = batch->position;
+	checkpoint->offset = batch->position;
+	checkpoint->day = batch->day != NULL ? *batch->day : 0;
+
+	return checkpoint;
+}
+
+struct ingest_batch ingest_create(struct writer* writer, int channel,
+                                  void (*parse)(void* context, const char* line, size_t len), void* context)
+{
+	struct ingest_batch batch;
+
+	batch.writer = writer;
+	batch.channel = channel;
+	batch.parse = parse;
+	batch.context = context;
+
+	batch.inode = 0;
+	batch.position = 0;
+	batch.day = NULL;
+	batch.lines = 0;
+	batch.unqueued = 0;
+
+	return batch;
+}
+
+void ingest_track(struct ingest_batch* batch, int fd, off_t offset, const time_t* day)
+{
+	struct stat file_stat;
+
+	batch->inode = fstat(fd, &file_stat) == 0 ? (long long)file_stat.st_ino : 0;
+	batch->position = offset;
+	batch->day = day;
+}
+
+void ingest_line(struct ingest_batch* batch, const char* line, size_t len)
+{
+	// Records from this line are checkpointed just past it
+	ingest_count(batch, 1, len);
+
+	batch->parse(batch->context, line, len);
+}
+
+void ingest_count(struct ingest_batch* batch, int lines, size_t bytes)
+{
+	batch->position += bytes;
+	batch->lines += lines;
+	batch->unqueued += lines;
+}
+
+// Lines the next record accounts for
+static int ingest_take_lines(struct ingest_batch* batch)
+{
+	int lines = batch->unqueued;
+
+	batch->unqueued = 0;
+
+	return lines;
+}
+
+void ingest_topic(struct ingest_batch* batch, time_t time, struct logline_slice nick, struct logline_slice topic)
+{
+	struct checkpoint checkpoint;
+
+	writer_line(batch->writer, WRITER_TOPIC, batch->channel, time, nick, topic,
+	            ingest_take_lines(batch), ingest_checkpoint(batch, &checkpoint));
+}
+
+void ingest_message(struct ingest_batch* batch, time_t time, struct logline_slice nick, struct logline_slice message)
+{
+	struct checkpoint checkpoint;
+
+	writer_line(batch->writer, WRITER_MESSAGE, batch->channel, time, nick, message,
+	            ingest_take_lines(batch), ingest_checkpoint(batch, &checkpoint));
+}
+
+void ingest_call(struct ingest_batch* batch, void (*call)(struct store* store, void* arg),
+                 void (*done)(void* arg), void* arg)
+{
+	struct checkpoint checkpoint;
+
+	writer_call(batch->writer, batch->channel, call, done, arg, ingest_take_lines(batch),
+	            ingest_checkpoint(batch, &checkpoint));
+}
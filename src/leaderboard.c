@@ -0,0 +1,297 @@
+#include <leaderboard.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+
+#define LEADERBOARD_DEFAULT_USERS  64
+
+static void grow(struct leaderboard* leaderboard)
+{
+	leaderboard->user_max *= 2;
+	leaderboard->users = realloc(leaderboard->users, sizeof(struct leaderboard_user) * leaderboard->user_max);
+	leaderboard->order = realloc(leaderboard->order, sizeof(int) * leaderboard->user_max);
+}
+
+// Make room in by_nick for a nick id
+static void grow_nicks(struct leaderboard* leaderboard, int nick)
+{
+	int old_len = leaderboard->by_nick_len;
+
+	while (leaderboard->by_nick_len <= nick)
+		leaderboard->by_nick_len *= 2;
+
+	leaderboard->by_nick = realloc(leaderboard->by_nick, sizeof(int) * leaderboard->by_nick_len);
+	memset(leaderboard->by_nick + old_len, 0, sizeof(int) * (leaderboard->by_nick_len - old_len));
+}
+
+static void swap_ranks(struct leaderboard* leaderboard, int a, int b)
+{
+	int user_a = leaderboard->order[a];
+	int user_b = leaderboard->order[b];
+
+	leaderboard->order[a] = user_b;
+	leaderboard->order[b] = user_a;
+	leaderboard->users[user_a].rank = b;
+	leaderboard->users[user_b].rank = a;
+}
+
+// Highest rank held by a user with messages messages, searching ranks 0 to below
+static int first_rank_with(struct leaderboard* leaderboard, int messages, int below)
+{
+	int low = 0;
+	int high = below;
+	int middle;
+
+	// order is sorted by messages, most first
+	while (low < high)
+	{
+		middle = (low + high) / 2;
+
+		if (leaderboard->users[leaderboard->order[middle]].messages > messages)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return low;
+}
+
+// Move a user up after their count went up
+static void promote(struct leaderboard* leaderboard, struct leaderboard_user* user)
+{
+	int above;
+	int rank;
+
+	// Swap with the first of each run of equal counts it has overtaken, so a
+	// single message costs one swap however many users are tied with it
+	while (user->rank > 0)
+	{
+		above = leaderboard->users[leaderboard->order[user->rank - 1]].messages;
+		if (above >= user->messages)
+			break;
+
+		rank = first_rank_with(leaderboard, above, user->rank - 1);
+		swap_ranks(leaderboard, rank, user->rank);
+	}
+}
+
+// Lowest rank held by a user with messages messages, searching from rank from down
+static int last_rank_with(struct leaderboard* leaderboard, int messages, int from)
+{
+	int low = from;
+	int high = leaderboard->user_count;
+	int middle;
+
+	// Find the first rank with fewer, order is sorted by messages, most first
+	while (low < high)
+	{
+		middle = (low + high) / 2;
+
+		if (leaderboard->users[leaderboard->order[middle]].messages >= messages)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return low - 1;
+}
+
+// Move a user down after their count went down
+static void demote(struct leaderboard* leaderboard, struct leaderboard_user* user)
+{
+	int below;
+	int rank;
+
+	// Like promote, one swap per run of equal counts it has dropped below
+	while (user->rank < leaderboard->user_count - 1)
+	{
+		below = leaderboard->users[leaderboard->order[user->rank + 1]].messages;
+		if (below <= user->messages)
+			break;
+
+		rank = last_rank_with(leaderboard, below, user->rank + 1);
+		swap_ranks(leaderboard, rank, user->rank);
+	}
+}
+
+// Forget a user with no messages left, who demote has moved to the bottom
+static void remove_user(struct leaderboard* leaderboard, struct leaderboard_user* user)
+{
+	int index = user - leaderboard->users;
+	int last = --leaderboard->user_count;
+
+	leaderboard->by_nick[user->nick] = 0;
+
+	// Fill the gap with the last user
+	if (index != last)
+	{
+		*user = leaderboard->users[last];
+		leaderboard->order[user->rank] = index;
+		leaderboard->by_nick[user->nick] = index + 1;
+	}
+}
+
+struct leaderboard leaderboard_create()
+{
+	struct leaderboard leaderboard;
+
+	memset(&leaderboard, 0, sizeof(leaderboard));
+
+	leaderboard.user_max = LEADERBOARD_DEFAULT_USERS;
+	leaderboard.users = malloc(sizeof(struct leaderboard_user) * leaderboard.user_max);
+	leaderboard.order = malloc(sizeof(int) * leaderboard.user_max);
+	leaderboard.by_nick_len = LEADERBOARD_DEFAULT_USERS;
+	leaderboard.by_nick = calloc(leaderboard.by_nick_len, sizeof(int));
+
+	atomic_init(&leaderboard.current, 0);
+	atomic_init(&leaderboard.readers[0], 0);
+	atomic_init(&leaderboard.readers[1], 0);
+
+	return leaderboard;
+}
+
+void leaderboard_destroy(struct leaderboard* leaderboard)
+{
+	leaderboard_clear(leaderboard);
+
+	free(leaderboard->users);
+	free(leaderboard->order);
+	free(leaderboard->by_nick);
+
+	leaderboard->users = NULL;
+	leaderboard->order = NULL;
+	leaderboard->by_nick = NULL;
+}
+
+void leaderboard_clear(struct leaderboard* leaderboard)
+{
+	memset(leaderboard->by_nick, 0, sizeof(int) * leaderboard->by_nick_len);
+	leaderboard->user_count = 0;
+	leaderboard->changed = 1;
+}
+
+int leaderboard_add(struct leaderboard* leaderboard, int nick, const char* name, int count, time_t lastseen)
+{
+	int previous;
+	int rank;
+	struct leaderboard_user* user;
+
+	if (nick <= 0)
+		return -1;
+
+	if (nick >= leaderboard->by_nick_len)
+		grow_nicks(leaderboard, nick);
+
+	if (leaderboard->by_nick[nick] != 0)
+	{
+		user = &leaderboard->users[leaderboard->by_nick[nick] - 1];
+		previous = user->messages;
+	}
+	else
+	{
+		if (leaderboard->user_count == leaderboard->user_max)
+			grow(leaderboard);
+
+		// New users start at the bottom
+		user = &leaderboard->users[leaderboard->user_count];
+		user->nick = nick;
+		user->name = name;
+		user->messages = 0;
+		user->lastseen = 0;
+		user->rank = leaderboard->user_count;
+
+		leaderboard->order[user->rank] = leaderboard->user_count;
+		leaderboard->by_nick[nick] = ++leaderboard->user_count;
+
+		previous = -1;
+	}
+
+	rank = user->rank;
+
+	user->messages += count;
+	if (lastseen > user->lastseen)
+		user->lastseen = lastseen;
+
+	if (count >= 0)
+		promote(leaderboard, user);
+	else
+		demote(leaderboard, user);
+
+	if (rank < LEADERBOARD_SNAPSHOT_SIZE || user->rank < LEADERBOARD_SNAPSHOT_SIZE)
+		leaderboard->changed = 1;
+
+	if (user->messages <= 0)
+		remove_user(leaderboard, user);
+
+	return previous;
+}
+
+void leaderboard_publish(struct leaderboard* leaderboard)
+{
+	int i;
+	int next;
+	struct leaderboard_user* user;
+	struct leaderboard_snapshot* snapshot;
+
+	if (!leaderboard->changed)
+		return;
+
+	// Wait for anyone still reading the old snapshot, they only copy a few entries
+	next = !atomic_load(&leaderboard->current);
+	while (atomic_load(&leaderboard->readers[next]) != 0)
+		sched_yield();
+
+	snapshot = &leaderboard->snapshots[next];
+	snapshot->count = 0;
+
+	for (i = 0; i < leaderboard->user_count && i < LEADERBOARD_SNAPSHOT_SIZE; ++i)
+	{
+		user = &leaderboard->users[leaderboard->order[i]];
+
+		strncpy(snapshot->entries[i].name, user->name, LEADERBOARD_NICK_LEN - 1);
+		snapshot->entries[i].name[LEADERBOARD_NICK_LEN - 1] = '\0';
+
+		snapshot->entries[i].nick = user->nick;
+		snapshot->entries[i].messages = user->messages;
+		snapshot->entries[i].lastseen = user->lastseen;
+		snapshot->count++;
+	}
+
+	atomic_store(&leaderboard->current, next);
+	leaderboard->changed = 0;
+}
+
+int leaderboard_read(struct leaderboard* leaderboard, struct leaderboard_entry* entries, int count, int offset)
+{
+	int current;
+	const struct leaderboard_snapshot* snapshot;
+
+	// Count ourselves in, making sure the snapshot didn't change in between
+	for (;;)
+	{
+		current = atomic_load(&leaderboard->current);
+		atomic_fetch_add(&leaderboard->readers[current], 1);
+
+		if (atomic_load(&leaderboard->current) == current)
+			break;
+
+		atomic_fetch_sub(&leaderboard->readers[current], 1);
+	}
+
+	snapshot = &leaderboard->snapshots[current];
+
+	if (offset < 0)
+		offset = 0;
+
+	if (offset >= snapshot->count || count < 0)
+		count = 0;
+	else if (offset + count > snapshot->count)
+		count = snapshot->count - offset;
+
+	memcpy(entries, snapshot->entries + offset, sizeof(struct leaderboard_entry) * count);
+
+	atomic_fetch_sub(&leaderboard->readers[current], 1);
+
+	return count;
+}
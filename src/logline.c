@@ -0,0 +1,318 @@
+#include <logline.h>
+
+#include <string.h>
+#include <strings.h>
+
+#define LOG_OPENED_PREFIX   "--- Log opened "
+#define DAY_CHANGED_PREFIX  "--- Day changed "
+#define TOPIC_MARKER        "-!-"
+#define TOPIC_CHANGED       " changed the topic of "
+#define TOPIC_TO            "to:"
+
+// Length of a string literal
+#define LITERAL_LEN(x)      (sizeof(x) - 1)
+
+static const char* const month_names[12] =
+{
+	"January", "February", "March", "April", "May", "June",
+	"July", "August", "September", "October", "November", "December"
+};
+
+// Match a literal at pos, advancing past it on success
+static int match(const char** pos, const char* end, const char* literal, size_t literal_len)
+{
+	if ((size_t)(end - *pos) < literal_len || memcmp(*pos, literal, literal_len) != 0)
+		return 0;
+
+	*pos += literal_len;
+	return 1;
+}
+
+// Skip any spaces at pos (like a space in a scanf format)
+static void skip_spaces(const char** pos, const char* end)
+{
+	while (*pos < end && (**pos == ' ' || **pos == '\t'))
+		(*pos)++;
+}
+
+// Read a run of non space characters (like %s), must be at least one character long
+static int read_word(const char** pos, const char* end, struct logline_slice* word)
+{
+	const char* start = *pos;
+
+	while (*pos < end && **pos != ' ' && **pos != '\t')
+		(*pos)++;
+
+	word->ptr = start;
+	word->len = *pos - start;
+
+	return word->len > 0;
+}
+
+// Read a non negative decimal integer (like %d)
+static int read_int(const char** pos, const char* end, int* value)
+{
+	const char* start = *pos;
+
+	*value = 0;
+	while (*pos < end && **pos >= '0' && **pos <= '9')
+	{
+		*value = *value * 10 + (**pos - '0');
+		(*pos)++;
+	}
+
+	return *pos > start;
+}
+
+// Read HH:MM (or any of the %d:%d forms irssi writes)
+static int read_time(const char** pos, const char* end, int* hour, int* minute)
+{
+	return read_int(pos, end, hour) &&
+	       match(pos, end, ":", 1) &&
+	       read_int(pos, end, minute);
+}
+
+// Convert an abbreviated or full english month name to 0-11, or -1
+static int month_from_name(const struct logline_slice* name)
+{
+	int i;
+
+	for (i = 0; i < 12; ++i)
+	{
+		size_t full_len = strlen(month_names[i]);
+
+		if ((name->len == 3 || name->len == full_len) &&
+		    strncasecmp(name->ptr, month_names[i], name->len) == 0)
+		{
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+// Read the "Mon Jan 04" part of a date marker
+static int read_date(const char** pos, const char* end, struct logline* out)
+{
+	struct logline_slice word;
+
+	// Day of week (ignored)
+	skip_spaces(pos, end);
+	if (!read_word(pos, end, &word))
+		return 0;
+
+	// Month
+	skip_spaces(pos, end);
+	if (!read_word(pos, end, &word))
+		return 0;
+
+	out->month = month_from_name(&word);
+	if (out->month < 0)
+		return 0;
+
+	// Day of month
+	skip_spaces(pos, end);
+	return read_int(pos, end, &out->day);
+}
+
+// --- Log opened Mon Jan 04 10:00:00 2010
+static enum logline_kind read_log_opened(const char* pos, const char* end, struct logline* out)
+{
+	int ignored;
+
+	if (!read_date(&pos, end, out))
+		return LOGLINE_BAD_DATE;
+
+	// Time the log was opened (ignored)
+	skip_spaces(&pos, end);
+	if (!read_time(&pos, end, &ignored, &ignored) ||
+	    !match(&pos, end, ":", 1) ||
+	    !read_int(&pos, end, &ignored))
+	{
+		return LOGLINE_BAD_DATE;
+	}
+
+	skip_spaces(&pos, end);
+	if (!read_int(&pos, end, &out->year))
+		return LOGLINE_BAD_DATE;
+
+	return LOGLINE_LOG_OPENED;
+}
+
+// --- Day changed Mon Jan 04 2010
+static enum logline_kind read_day_changed(const char* pos, const char* end, struct logline* out)
+{
+	if (!read_date(&pos, end, out))
+		return LOGLINE_BAD_DATE;
+
+	skip_spaces(&pos, end);
+	if (!read_int(&pos, end, &out->year))
+		return LOGLINE_BAD_DATE;
+
+	return LOGLINE_DAY_CHANGED;
+}
+
+// nick changed the topic of #chan to: topic
+static enum logline_kind read_topic(const char* pos, const char* end, struct logline* out)
+{
+	struct logline_slice channel;
+
+	skip_spaces(&pos, end);
+	if (!read_word(&pos, end, &out->nick) ||
+	    !match(&pos, end, TOPIC_CHANGED, LITERAL_LEN(TOPIC_CHANGED)))
+	{
+		return LOGLINE_OTHER;
+	}
+
+	skip_spaces(&pos, end);
+	if (!read_word(&pos, end, &channel))
+		return LOGLINE_OTHER;
+
+	skip_spaces(&pos, end);
+	if (!match(&pos, end, TOPIC_TO, LITERAL_LEN(TOPIC_TO)))
+		return LOGLINE_OTHER;
+
+	// Topic is the rest of the line, and can't be empty
+	skip_spaces(&pos, end);
+	if (pos == end)
+		return LOGLINE_OTHER;
+
+	out->message.ptr = pos;
+	out->message.len = end - pos;
+
+	return LOGLINE_TOPIC;
+}
+
+// <@nick> message
+static enum logline_kind read_message(const char* pos, const char* end, struct logline* out)
+{
+	const char* nick_end;
+
+	// The nick is everything up to the closing bracket
+	nick_end = memchr(pos, '>', end - pos);
+	if (nick_end == NULL || nick_end == pos)
+		return LOGLINE_OTHER;
+
+	out->nick.ptr = pos;
+	out->nick.len = nick_end - pos;
+	pos = nick_end + 1;
+
+	// Message is the rest of the line, and can't be empty
+	skip_spaces(&pos, end);
+	if (pos == end)
+		return LOGLINE_OTHER;
+
+	out->message.ptr = pos;
+	out->message.len = end - pos;
+
+	return LOGLINE_MESSAGE;
+}
+
+static enum logline_kind classify(const char* pos, const char* end, struct logline* out)
+{
+	// Markers start with ---
+	if (*pos == '-')
+	{
+		if (match(&pos, end, LOG_OPENED_PREFIX, LITERAL_LEN(LOG_OPENED_PREFIX)))
+			return read_log_opened(pos, end, out);
+
+		if (match(&pos, end, DAY_CHANGED_PREFIX, LITERAL_LEN(DAY_CHANGED_PREFIX)))
+			return read_day_changed(pos, end, out);
+
+		return LOGLINE_OTHER;
+	}
+
+	// Everything else starts with a timestamp
+	if (!read_time(&pos, end, &out->hour, &out->minute))
+		return LOGLINE_OTHER;
+
+	skip_spaces(&pos, end);
+
+	if (match(&pos, end, "<", 1))
+		return read_message(pos, end, out);
+
+	if (match(&pos, end, TOPIC_MARKER, LITERAL_LEN(TOPIC_MARKER)))
+		return read_topic(pos, end, out);
+
+	return LOGLINE_OTHER;
+}
+
+enum logline_kind logline_tokenize(const char* line, size_t len, struct logline* out)
+{
+	const char* end;
+
+	// Only look at the first line in the buffer
+	end = memchr(line, '\n', len);
+	if (end == NULL)
+		end = line + len;
+
+	out->kind = LOGLINE_OTHER;
+	if (end > line)
+		out->kind = classify(line, end, out);
+
+	return out->kind;
+}
+
+int logline_is_day_marker(const char* line, size_t len)
+{
+	const char* end = line + len;
+
+	return match(&line, end, LOG_OPENED_PREFIX, LITERAL_LEN(LOG_OPENED_PREFIX)) ||
+	       match(&line, end, DAY_CHANGED_PREFIX, LITERAL_LEN(DAY_CHANGED_PREFIX));
+}
+
+time_t logline_day(const struct logline* line)
+{
+	struct tm time_struct;
+
+	// Midnight of the given day
+	memset(&time_struct, 0, sizeof(struct tm));
+	time_struct.tm_year = line->year - 1900;
+	time_struct.tm_mon = line->month;
+	time_struct.tm_mday = line->day;
+	time_struct.tm_isdst = -1;
+
+	return mktime(&time_struct);
+}
+
+time_t logline_time(const struct logline* line, time_t day)
+{
+	return day + line->hour * 3600 + line->minute * 60;
+}
+
+// ASCII lower case, matching sqlite's nocase collation
+static unsigned char fold(unsigned char c)
+{
+	return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+unsigned int logline_nick_hash(const char* nick, size_t len)
+{
+	size_t i;
+	unsigned int hash = 2166136261u;
+
+	// FNV-1a over the folded nick
+	for (i = 0; i < len; ++i)
+	{
+		hash ^= fold(nick[i]);
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+int logline_nick_equal(const char* a, size_t a_len, const char* b, size_t b_len)
+{
+	size_t i;
+
+	if (a_len != b_len)
+		return 0;
+
+	for (i = 0; i < a_len; ++i)
+	{
+		if (fold(a[i]) != fold(b[i]))
+			return 0;
+	}
+
+	return 1;
+}
@@ -1,19 +1,21 @@
 // TODOs:
 // Cleanup at exit and sigint to help with debugging
-// Look into thread safety and performance benefits of enabling multiple threads in mhttpd
 
 #define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <errno.h>
 #include <unistd.h>
 #include <malloc.h>
 #include <stdarg.h>
 #include <time.h>
+#include <math.h>
+#include <limits.h>
 #include <signal.h>
-#include <sys/inotify.h>
 #include <sys/types.h>
 #include <sys/select.h>
 #include <sys/socket.h>
@@ -25,11 +27,17 @@
 #include "errors.h"
 #include "queries.h"
 #include "stringstream.h"
+#include "statements.h"
+#include "database.h"
+#include "store.h"
+#include "channel.h"
+#include "pagecache.h"
+#include "httpd.h"
 
 #define CONFIG_FILE_DEFAULT "logwatcher.conf"
 
-// Parse line of log
-void parse_line(const char* line);
+// Bytes MHD asks for at a time when a page is streamed
+#define STATS_STREAM_BLOCK_SIZE 16384
 
 // Generate statistics page in response to http request
 int generate_statistics(void *cls, struct MHD_Connection *connection,
@@ -40,47 +48,82 @@ int generate_statistics(void *cls, struct MHD_Connection *connection,
 
 // Get top users with all data
 // Returns the count of users actually retrieved if < requested
-int stats_get_top_users_full(struct stats_user* users, int count);
+int stats_get_top_users_full(int channel, struct stats_user* users, int count);
 
 // Get top users with message count and nick only
 // Returns the count of messages actually retrieved if < requested
-int stats_get_top_users_min(struct stats_user* users, int count, int offset);
+int stats_get_top_users_min(int channel, struct stats_user* users, int count, int offset);
 
 // Get random messages from log
 // Returns the count of messages actually retrieved if < requested
-int stats_get_random_messages(struct stats_message* messages, int count);
+int stats_get_random_messages(int channel, struct stats_message* messages, int count);
 
 // Get last topics from log
 // Returns the count of topics actually retrieved if < requested
-int stats_get_last_topics(struct stats_message* topics, int count);
+int stats_get_last_topics(int channel, struct stats_message* topics, int count);
+
+// Get message counts in buckets of bucket seconds (ACTIVITY_HOUR or ACTIVITY_DAY) from the rollups,
+// for the whole channel or just nick, between from and to
+// Buckets without messages are left out
+// Returns the count of buckets actually retrieved if < requested
+int stats_get_activity(int channel, const char* nick, int bucket, time_t from, time_t to,
+                       struct stats_activity* activity, int count);
+
+// Search messages for every word in query, optionally only from nick
+// Newest first, carrying on after the result with id after_id (LLONG_MAX for the first page), or
+// if by_rank best matches first, carrying on after the result with after_rank and after_id
+// (-HUGE_VAL and 0 for the first page)
+// Returns the count of results actually retrieved if < requested
+int stats_search(int channel, const char* query, const char* nick, int by_rank, double after_rank, long long after_id,
+                 struct stats_search_result* results, int count);
+
+// Find a channel by name (with or without the leading #), or the first channel if name is NULL
+// Returns NULL if there is no such channel
+struct channel* find_channel(const char* name);
 
 // Execute multi statement SQL
 int execute_sql(const char* sql);
 
+// Run any schema migrations the database hasn't had yet
+// New databases are created at the latest version, and only have it recorded
+int migrate_database(int new_database);
+
 // Convert unix time to string
 int convert_time_to_string(time_t time, char* buffer, size_t buffer_len, const char* format);
 
+// Schema migrations, each one taking the database from its index's version to the next
+const char* const migrations[] =
+{
+	MIGRATE_USER_SEQUENCES,
+	MIGRATE_NICK_IDS,
+	MIGRATE_ACTIVITY,
+	MIGRATE_SEARCH,
+	MIGRATE_ALIAS_KEY,
+	MIGRATE_MESSAGE_IDS,
+};
+
 // Timer thing
 void timer_start();
 void timer_end();
 
 // Globals
-sqlite3* db;                    // Sqlite database
+struct database database;       // Database and its connections
+sqlite3* db;                    // Writer connection, used for setup
 char* sqlite_error = NULL;      // Sqlite error
 
-int sqlite_messages = 0;        // Messages in message table
+struct store store;             // Ingest side of the database
+struct writer writer;           // Does every write to the database
+struct page_cache page_cache;   // Rendered pages, shared by the httpd threads
+time_t started;                 // When logwatcher started, part of every ETag
+struct httpd httpd;             // Serves the stats
 
-time_t current_day = 0;         // Current day (last encountered in log)
-time_t latest_time_at_load = 0; // Latest time encountered
-int messages_skipped = 0;       // Messages skipped at this time
-int messages_to_skip = 0;       // Messages to skip at this time
+struct channel* channels;       // Logged channels
+int channel_count = 0;          // Number of logged channels
 
 // Configuration variables
 const char* config_file = CONFIG_FILE_DEFAULT;
 const char* database_filename;
-const char* network;
-const char* channel;
-const char* logfile;
+int shared_memory = 0;          // Share a :memory: database between connections
 
 // Entry point
 int main(int argc, char** argv)
@@ -88,22 +131,44 @@ int main(int argc, char** argv)
 	config_t config;                 // Config structure
 	const config_setting_t* setting; // Config setting
 	int config_array_len;            // Config array length
+	const config_setting_t* channels_setting; // List of channels, or NULL for a single channel
 
-	int inotify_fd;                  // File descriptor for inotify
-	int inotify_wd;                  // Watch descriptor for logfile
-	struct inotify_event event;      // inotify event struct
-
-	FILE* logfile_fd;                // File descriptor for logfile
-	long logfile_len;                // Logfile length
-	size_t data_read;                // Amount of data read by getline
-	char* line;                      // Pointer to getline buffer
-	size_t size;                     // Size of getline buffer
-	size_t old_position;             // Old position in buffer
+	const char* network = NULL;      // Default network, and the single channel's details
+	const char* channel = NULL;
+	const char* logfile = NULL;
 
-	struct MHD_Daemon* daemon;       // microhttpd daemon
 	int port = 0;                    // httpd port
+	struct httpd_settings httpd_settings = // How the httpd serves connections
+	{
+		.mode = "epoll",
+		.threads = 0,
+		.connection_limit = HTTPD_DEFAULT_CONNECTION_LIMIT,
+		.per_ip_connection_limit = 0,
+		.timeout = HTTPD_DEFAULT_TIMEOUT,
+		.max_rendering = HTTPD_DEFAULT_MAX_RENDERING,
+	};
+
+	struct channel_settings settings = // How channels are imported
+	{
+		.import_mode = "mmap",
+		.import_threads = 0,
+	};
+	int batch_size = WRITER_DEFAULT_BATCH_SIZE;         // Lines per transaction
+	int flush_interval = WRITER_DEFAULT_FLUSH_INTERVAL; // Longest time before a commit (ms)
+	int queue_size = WRITER_DEFAULT_QUEUE_SIZE;         // Parsed lines waiting to be written
+	const char* archive_directory = NULL;               // Where old messages are archived, NULL for nowhere
+	int archive_age = 0;                                // Days before messages are archived
+	int archive_cache_blocks = ARCHIVE_DEFAULT_CACHE_BLOCKS; // Decompressed archive blocks kept in memory
+	const char* snapshot_filename = NULL;               // Where an in-memory database is snapshotted, NULL for nowhere
+	int snapshot_interval = SNAPSHOT_DEFAULT_INTERVAL;  // Seconds between snapshots
+	int snapshot_step_pages = SNAPSHOT_DEFAULT_STEP_PAGES; // Pages copied per snapshot step
+	int page_cache_size = PAGE_CACHE_DEFAULT_ENTRIES;   // Rendered pages kept
+	int page_cache_min_refresh = 0;                     // Time an out of date page is still served for (ms)
+	int i, j;                        // Counters
+	struct alias_table wanted_aliases; // Aliases from the config file
 
 	int rc;                          // Return code
+	int new_database;                // Database file didn't have any tables
 	sqlite3_stmt* statement;         // Sqlite statement
 
 	// Check args for config file
@@ -130,62 +195,113 @@ int main(int argc, char** argv)
 	setting = config_lookup(&config, "logwatcher.database_filename");
 	database_filename = config_setting_get_string(setting);
 
-	// Load network name
-	setting = config_lookup(&config, "logwatcher.network");
-	network = config_setting_get_string(setting);
+	// Load whether a :memory: database is shared with the HTTP threads (optional)
+	setting = config_lookup(&config, "logwatcher.shared_memory");
+	if (setting != NULL)
+		shared_memory = config_setting_get_bool(setting);
 
-	// Load channel name
-	setting = config_lookup(&config, "logwatcher.channel");
-	channel = config_setting_get_string(setting);
+	// Load network name (the default for channels that don't have one)
+	config_lookup_string(&config, "logwatcher.network", &network);
+
+	// Load channel list, or the single channel and logfile name
+	channels_setting = config_lookup(&config, "logwatcher.channels");
+	if (channels_setting == NULL)
+	{
+		config_lookup_string(&config, "logwatcher.channel", &channel);
+		config_lookup_string(&config, "logwatcher.logfile", &logfile);
 
-	// Load logfile name
-	setting = config_lookup(&config, "logwatcher.logfile");
-	logfile = config_setting_get_string(setting);
+		if (channel == NULL || logfile == NULL)
+		{
+			fprintf(stderr, "Failed to load channels from config file\n");
+			return -1;
+		}
+	}
 
 	// Load port
 	setting = config_lookup(&config, "logwatcher.port");
 	port = config_setting_get_int(setting);
 
-	// Initialise inotify
-	printf("Initialising inotify...\n");
-	inotify_fd = inotify_init();
+	// Load initial import mode (optional)
+	setting = config_lookup(&config, "logwatcher.import_mode");
+	if (setting != NULL)
+		settings.import_mode = config_setting_get_string(setting);
 
-	if (inotify_fd < 0)
-	{
-		fprintf(stderr, INOTIFY_INIT_FAILURE);
-		return INOTIFY_INIT_FAILURE_ID;
-	}
+	// Load number of parallel import threads (optional)
+	setting = config_lookup(&config, "logwatcher.import_threads");
+	if (setting != NULL)
+		settings.import_threads = config_setting_get_int(setting);
 
-	// Add a watch to logfile
-	printf("Watching logfile...\n");
-	inotify_wd = inotify_add_watch(inotify_fd, logfile, IN_MODIFY);
+	if (settings.import_threads <= 0)
+		settings.import_threads = sysconf(_SC_NPROCESSORS_ONLN);
 
-	if (inotify_wd < 0)
-	{
-		fprintf(stderr, INOTIFY_WATCH_FAILURE);
-		return INOTIFY_WATCH_FAILURE_ID;
-	}
+	// Load ingest batch size (optional)
+	setting = config_lookup(&config, "logwatcher.ingest_batch_size");
+	if (setting != NULL)
+		batch_size = config_setting_get_int(setting);
 
-	// Get logfile length
-	logfile_fd = fopen(logfile, "r");
-	//fseek(logfile_fd, 0, SEEK_END);
-	logfile_len = ftell(logfile_fd);
+	// Load ingest flush interval (optional)
+	setting = config_lookup(&config, "logwatcher.ingest_flush_interval");
+	if (setting != NULL)
+		flush_interval = config_setting_get_int(setting);
 
-	// Read logfile
-	printf("Reading logfile...\n");
-	//fseek(logfile_fd, 0, SEEK_SET);
+	// Load ingest queue size (optional)
+	setting = config_lookup(&config, "logwatcher.ingest_queue_size");
+	if (setting != NULL)
+		queue_size = config_setting_get_int(setting);
 
-	// Initialise httpd
-	printf("Initialising httpd...\n");
-	daemon = MHD_start_daemon(MHD_USE_SELECT_INTERNALLY, port, NULL, NULL,
-					&generate_statistics, NULL,
-					MHD_OPTION_THREAD_POOL_SIZE, (unsigned int)16,
-					MHD_OPTION_END);
-	if (daemon == NULL)
-	{
-		fprintf(stderr, MHD_INIT_FAILURE);
-		return MHD_INIT_FAILURE_ID;
-	}
+	// Load message archiving settings (optional)
+	config_lookup_string(&config, "logwatcher.archive_directory", &archive_directory);
+
+	setting = config_lookup(&config, "logwatcher.archive_age");
+	if (setting != NULL)
+		archive_age = config_setting_get_int(setting);
+
+	setting = config_lookup(&config, "logwatcher.archive_cache_blocks");
+	if (setting != NULL)
+		archive_cache_blocks = config_setting_get_int(setting);
+
+	// Load in-memory database snapshot settings (optional)
+	config_lookup_string(&config, "logwatcher.snapshot_filename", &snapshot_filename);
+
+	setting = config_lookup(&config, "logwatcher.snapshot_interval");
+	if (setting != NULL)
+		snapshot_interval = config_setting_get_int(setting);
+
+	setting = config_lookup(&config, "logwatcher.snapshot_step_pages");
+	if (setting != NULL)
+		snapshot_step_pages = config_setting_get_int(setting);
+
+	// Load page cache settings (optional)
+	setting = config_lookup(&config, "logwatcher.page_cache_size");
+	if (setting != NULL)
+		page_cache_size = config_setting_get_int(setting);
+
+	setting = config_lookup(&config, "logwatcher.page_cache_min_refresh");
+	if (setting != NULL)
+		page_cache_min_refresh = config_setting_get_int(setting);
+
+	// Load httpd settings (optional)
+	config_lookup_string(&config, "logwatcher.httpd_mode", &httpd_settings.mode);
+
+	setting = config_lookup(&config, "logwatcher.httpd_threads");
+	if (setting != NULL)
+		httpd_settings.threads = config_setting_get_int(setting);
+
+	setting = config_lookup(&config, "logwatcher.httpd_connection_limit");
+	if (setting != NULL)
+		httpd_settings.connection_limit = config_setting_get_int(setting);
+
+	setting = config_lookup(&config, "logwatcher.httpd_per_ip_connection_limit");
+	if (setting != NULL)
+		httpd_settings.per_ip_connection_limit = config_setting_get_int(setting);
+
+	setting = config_lookup(&config, "logwatcher.httpd_timeout");
+	if (setting != NULL)
+		httpd_settings.timeout = config_setting_get_int(setting);
+
+	setting = config_lookup(&config, "logwatcher.httpd_max_rendering");
+	if (setting != NULL)
+		httpd_settings.max_rendering = config_setting_get_int(setting);
 
 	// Enable sqlite serialized threads mode
 	rc = sqlite3_config(SQLITE_CONFIG_SERIALIZED);
@@ -198,13 +314,33 @@ int main(int argc, char** argv)
 
 	// Create or open sqlite database
 	printf("Opening database...\n");
-	rc = sqlite3_open(database_filename, &db);
-	if (rc)
+	database = database_create(database_filename, shared_memory);
+	rc = database_open(&database);
+	if (rc != SQLITE_OK)
 	{
-		fprintf(stderr, SQLITE_DATABASE_CREATION_FAILURE, sqlite3_errmsg(db));
+		fprintf(stderr, SQLITE_DATABASE_CREATION_FAILURE, sqlite3_errmsg(database.writer));
 		return SQLITE_DATABASE_CREATION_FAILURE_ID;
 	}
 
+	db = database.writer;
+
+	if (database.wal)
+		printf("Using WAL journaling\n");
+	if (!database.separate_readers)
+		printf("Warning: the httpd shares the writer's connection to a private :memory: database\n");
+
+	// Snapshots only make sense for a database that's lost on exit
+	if (!database.memory && snapshot_filename != NULL)
+	{
+		printf("Warning: ignoring snapshot_filename, the database is already on disk\n");
+		snapshot_filename = NULL;
+	}
+
+	// Start an in-memory database from its last snapshot, the checkpoints in
+	// it then pick up each logfile from where the snapshot was taken
+	if (snapshot_restore(snapshot_filename, db))
+		printf("Restored database from snapshot %s\n", snapshot_filename);
+
 	// Load extensions
 	printf("Loading sqlite extensions...\n");
 
@@ -221,6 +357,10 @@ int main(int argc, char** argv)
 	// Disable extension loading
 	sqlite3_enable_load_extension(db, 1);
 
+	// New databases don't have anything to migrate
+	new_database = sqlite3_prepare_v2(db, SELECT_MESSAGES_TABLE, -1, &statement, NULL) != SQLITE_OK;
+	sqlite3_finalize(statement);
+
 	// Initialise database
 	printf("Creating database tables if non existent...\n");
 	rc = execute_sql(TABLE_CREATION);
@@ -230,461 +370,499 @@ int main(int argc, char** argv)
 		return -1;
 	}
 
-	// Get latest message time from database
-	latest_time_at_load = 0;
+	// Databases from before channels were added need the channel columns
+	if (sqlite3_prepare_v2(db, SELECT_CHANNEL_COLUMN, -1, &statement, NULL) == SQLITE_OK)
+	{
+		sqlite3_finalize(statement);
+	}
+	else
+	{
+		printf("Adding channels to database...\n");
+		execute_sql(ADD_CHANNEL_COLUMNS);
+	}
 
-	// Prepare statement
-	rc = sqlite3_prepare_v2(db, SELECT_LATEST_MESSAGES, -1, &statement, NULL);
+	// Bring older databases up to date, before indexing columns they might not have yet
+	rc = migrate_database(new_database);
 	if (rc != SQLITE_OK)
 	{
-		fprintf(stderr, SQLITE_STATEMENT_PREPERATION_FAILURE, sqlite3_errmsg(db));
-		return SQLITE_STATEMENT_PREPERATION_FAILURE_ID;
+		fprintf(stderr, "Failed to initialise database, terminating.\n");
+		return -1;
 	}
 
-	// Bind parameters
-	sqlite3_bind_int(statement, 1, 1);       // Number of messages to retrieve (1)
+	rc = execute_sql(INDEX_CREATION);
+	if (rc != SQLITE_OK)
+	{
+		fprintf(stderr, "Failed to initialise database, terminating.\n");
+		return -1;
+	}
 
-	// Run statement
-	rc = sqlite3_step(statement);
-	if (rc == SQLITE_ROW)
+	// Read aliases from config file
+	setting = config_lookup(&config, "logwatcher.aliases");
+	if (setting == 0)
 	{
-		latest_time_at_load = (time_t)sqlite3_column_int(statement, 0);
+		fprintf(stderr, "Failed to load aliases from config file\n");
+		return -1;
+	}
+
+	// Gather the configured aliases, then bring the aliases table in line with them
+	// (messages are stored under main nicks, so the aliases table is what the database was built with)
+	wanted_aliases = alias_create();
 
-		printf("Got latest time from database: %d\n", (int)latest_time_at_load);
+	config_array_len = config_setting_length(setting);
+	for (i = 0; i < config_array_len; ++i)
+	{
+		const config_setting_t* inner_array;
+		int inner_array_len;
+		const char* alias;
+		const char* nick;
 
-		rc = sqlite3_finalize(statement);
+		inner_array = config_setting_get_elem(setting, i);
+		if (inner_array == NULL)
+			continue;
 
-		// Get number of messages to skip at this time
-		// (so we don't double up messages at the same time)
-		rc = sqlite3_prepare_v2(db, SELECT_MESSAGE_COUNT_AT_TIME, -1, &statement, NULL);
-		if (rc != SQLITE_OK)
+		inner_array_len = config_setting_length(inner_array);
+		if (inner_array_len < 2)
 		{
-			fprintf(stderr, SQLITE_STATEMENT_PREPERATION_FAILURE, sqlite3_errmsg(db));
-			return SQLITE_STATEMENT_PREPERATION_FAILURE_ID;
+			fprintf(stderr, "Warning: <2 elements in aliases array, format: aliases ( [alias, nick, ...], [alias, nick, ...], ... )\n");
+			continue;
 		}
 
-		// Bind parameters
-		sqlite3_bind_int(statement, 1, latest_time_at_load);
+		nick = config_setting_get_string_elem(inner_array, 0);
+		if (nick == NULL)
+			continue;
 
-		// Run statement
-		rc = sqlite3_step(statement);
-		if (rc == SQLITE_ROW)
+		for (j = 1; j < inner_array_len; ++j)
 		{
-			messages_to_skip = sqlite3_column_int(statement, 0);
+			size_t count = wanted_aliases.count;
 
-			rc = sqlite3_finalize(statement);
+			alias = config_setting_get_string_elem(inner_array, j);
+			if (alias == NULL)
+				continue;
+
+			alias_add(&wanted_aliases, alias, nick);
+
+			if (wanted_aliases.count == count)
+				fprintf(stderr, "Warning: alias %s is listed more than once, keeping the first\n", alias);
 		}
 	}
-	else
-	{
-		printf("Creating new db\n");
-		sqlite3_finalize(statement);
-	}
 
-        // Get total message count
-	sqlite_messages = 0;
+	if (alias_sync(db, &wanted_aliases) < 0)
+		fprintf(stderr, "Failed to update aliases from config file, keeping the ones already in the database\n");
 
-        // Prepare statement
-        rc = sqlite3_prepare_v2(db, SELECT_MESSAGE_COUNT, -1, &statement, NULL);
-        if (rc != SQLITE_OK)
-        {
-                fprintf(stderr, SQLITE_STATEMENT_PREPERATION_FAILURE, sqlite3_errmsg(db));
-                return SQLITE_STATEMENT_PREPERATION_FAILURE_ID;
-        }
+	alias_destroy(&wanted_aliases);
 
-        // Run statement
-        rc = sqlite3_step(statement);
-        if (rc == SQLITE_ROW)
-        {
-                sqlite_messages = sqlite3_column_int(statement, 0);
+	// Resolve aliases in memory rather than in every insert
+	store = store_create(db);
+	rc = alias_load(&store.aliases, db);
+	printf("Resolving %d aliases in memory\n", rc);
 
-                printf("Got message count: %d\n", sqlite_messages);
+	// Nick ids are looked up in memory too
+	rc = nick_load(&store.nicks, db);
+	printf("Loaded %d nicks\n", rc);
+
+	// Messages from before an alias was added are moved to its main nick by the writer when it's idle
+	if (store_find_reattributions(&store) > 0)
+	{
+		printf("Moving %lld messages from %d aliases to their main nicks in the background\n",
+		       atomic_load(&store.reattribute_total), store.reattribution_count);
+	}
 
-                rc = sqlite3_step(statement);
-        }
-        else
-        {
-                printf("Creating new db");
-        }
+	// Old messages are moved out of the database by the writer when it's idle
+	archive_destroy(&store.archive);
+	store.archive = archive_create(archive_directory, archive_age, archive_cache_blocks);
 
-        // Clean up statement
-        sqlite3_finalize(statement);
+	if (archive_enabled(&store.archive))
+		printf("Archiving messages older than %d days to %s\n", archive_age, archive_directory);
 
-	// Read aliases from config file
-	setting = config_lookup(&config, "logwatcher.aliases");
-	if (setting == 0)
+	// The writer snapshots an in-memory database between transactions
+	snapshot_destroy(&store.snapshot);
+	// A private :memory: database's backup starts over after every commit, so it's copied in one step
+	if (snapshot_filename != NULL && !database.separate_readers)
 	{
-		fprintf(stderr, "Failed to load aliases from config file\n");
-		return -1;
+		printf("Snapshots of a private :memory: database are copied in one step, set shared_memory to spread them out\n");
+		snapshot_step_pages = SNAPSHOT_ALL_PAGES;
 	}
 
-	// Get number of aliases
-	config_array_len = config_setting_length(setting);
-	if (config_array_len > 0)
-	{
-		int i, j, k;
+	store.snapshot = snapshot_create(snapshot_filename, snapshot_interval, snapshot_step_pages);
 
-		k = 0;
+	if (snapshot_filename != NULL)
+		printf("Snapshotting database to %s every %d seconds\n", snapshot_filename, store.snapshot.interval);
 
-		printf("Loading aliases...\n");
-		for (i = 0; i < config_array_len; ++i)
+	// Everything parsed is written to the database by a single writer thread
+	writer = writer_create(&store, batch_size, flush_interval, queue_size);
+
+	// Set up each channel, either from the channels list or the single channel setting
+	channel_count = channels_setting != NULL ? config_setting_length(channels_setting) : 1;
+	channels = calloc(channel_count, sizeof(struct channel));
+
+	for (i = 0; i < channel_count; ++i)
+	{
+		const char* channel_network = network;
+
+		if (channels_setting != NULL)
 		{
-			const config_setting_t* inner_array;
+			const config_setting_t* entry = config_setting_get_elem(channels_setting, i);
 
-			inner_array = config_setting_get_elem(setting, i);
+			channel = NULL;
+			logfile = NULL;
 
-			if (inner_array != NULL)
+			config_setting_lookup_string(entry, "channel", &channel);
+			config_setting_lookup_string(entry, "network", &channel_network);
+			config_setting_lookup_string(entry, "logfile", &logfile);
+
+			if (channel == NULL || logfile == NULL)
 			{
-				int inner_array_len = config_setting_length(inner_array);
-
-				if (inner_array_len < 2)
-				{
-					fprintf(stderr, "Warning: <2 elements in aliases array, format: aliases ( [alias, nick, ...], [alias, nick, ...], ... )\n");
-				}
-                                else if (inner_array_len >= 2)
-                                {
-					sqlite3_stmt* statement;
-
-                                        const char* alias;
-                                        const char* nick;
-
-					alias = config_setting_get_string_elem(inner_array, 0);
-
-					for (j = 1; j < inner_array_len; ++j)
-					{
-						nick = config_setting_get_string_elem(inner_array, j);
-
-						printf("Adding alias %s => %s\n", nick, alias);
-
-						// Add to database
-						rc = sqlite3_prepare_v2(db, INSERT_ALIAS, -1, &statement, NULL);
-						if (rc != SQLITE_OK)
-						{
-							fprintf(stderr, SQLITE_STATEMENT_PREPERATION_FAILURE, sqlite3_errmsg(db));
-							fprintf(stderr, SQLITE_PROBLEM_QUERY, INSERT_TOPIC);
-						}
-
-						// Bind values
-						sqlite3_bind_text(statement, 1, nick, -1, SQLITE_STATIC);
-						sqlite3_bind_text(statement, 2, alias, -1, SQLITE_STATIC);
-
-						// Insert
-						rc = sqlite3_step(statement);
-						if (rc != SQLITE_DONE)
-						{
-							fprintf(stderr, SQLITE_QUERY_FAILURE, sqlite3_errmsg(db));
-							fprintf(stderr, SQLITE_PROBLEM_QUERY, INSERT_TOPIC);
-						}
-
-						// Finalise query
-						sqlite3_finalize(statement);
-
-						k++;
-					}
-				}
+				fprintf(stderr, "Failed to load channel %d from config file, format: channels ( { channel = ...; network = ...; logfile = ...; }, ... )\n", i);
+				return -1;
 			}
 		}
 
-		printf("Successfully loaded %d aliases\n", k);
+		if (channel_network == NULL)
+			channel_network = "";
+
+		channels[i] = channel_create(&store, &writer, channel_network, channel, logfile);
+		if (channels[i].id < 0)
+		{
+			fprintf(stderr, CHANNEL_CREATION_FAILURE, channel);
+			return CHANNEL_CREATION_FAILURE_ID;
+		}
 	}
 
-	// Iterate through lines
-	printf("Parsing logfile...\n");
+	// Pages are rebuilt only once the writer has committed something new
+	page_cache = page_cache_create(page_cache_size, page_cache_min_refresh);
+	started = time(NULL);
 
-	if (latest_time_at_load > 0)
+	// Channels and the httpd threads' database readers need descriptors besides the connections
+	httpd_settings.reserved_fds = channel_count * CHANNEL_FDS;
+	httpd_settings.reader_fds = (database.separate_readers && !database.memory ? DATABASE_READER_FDS : 0) +
+	                            (archive_directory != NULL ? ARCHIVE_READER_FDS : 0);
+
+	// Initialise httpd
+	printf("Initialising httpd...\n");
+	httpd = httpd_create();
+	rc = httpd_start(&httpd, &httpd_settings, port, &generate_statistics, NULL);
+	if (rc != 0)
+		return rc;
+
+	// Start the writer, then a worker for each channel
+	if (writer_start(&writer) != 0)
 	{
-		printf("Skipping to new messages...\n");
+		fprintf(stderr, WRITER_THREAD_FAILURE);
+		return WRITER_THREAD_FAILURE_ID;
 	}
 
-	// Get starting position in buffer
-	old_position = ftell(logfile_fd);
+	for (i = 0; i < channel_count; ++i)
+	{
+		rc = channel_start(&channels[i], &settings);
+		if (rc != 0)
+			return rc;
+	}
 
-	// Read lines
-	line = NULL;
-	while ((data_read = getline(&line, &size, logfile_fd)) != -1)
+	// Workers only exit on error
+	for (i = 0; i < channel_count; ++i)
 	{
-		if (line != NULL)
-		{
-			// If last character isn't a linebreak,
-			// Break and let monitoring loop get it instead
-			// (this is the last line of the file and is not yet complete)
-			if (line[data_read-1] != '\n')
-			{
-				fseek(logfile_fd, old_position, SEEK_SET);
-				break;
-			}
+		channel_join(&channels[i]);
+		channel_destroy(&channels[i]);
+	}
 
-			// Update position in buffer
-			old_position = ftell(logfile_fd);
+	httpd_stop(&httpd);
+	httpd_destroy(&httpd);
 
-			// Parse line
-			parse_line(line);
+	writer_stop(&writer);
+	writer_destroy(&writer);
 
-			// Free memory allocated by getline
-			free(line);
-			line = NULL;
-		}
-	}
-	logfile_len = ftell(logfile_fd);
-	printf("Finished parsing logfile.\n");
-
-	// Wait for changes
-	printf("Waiting for new messages...\n");
-	while (read(inotify_fd, &event, sizeof(struct inotify_event)))
-	{
-		// Get current position
-		old_position = ftell(logfile_fd);
-
-		// Read new text
-		//fread(new_text, new_text_len, 1, logfile_fd);
-	        line = NULL;
-	        while ((data_read = getline(&line, &size, logfile_fd)) != -1)
-	        {
-	                if (line != NULL)
-	                {
-				// If last character isn't a linebreak,
-				// Seek back and continue monitoring file
-				// (this is the end of the file and this line is not yet complete)
-				if (line[data_read-1] != '\n')
-				{
-					fseek(logfile_fd, old_position, SEEK_SET);
-					break;
-				}
-
-				// Update old position
-				old_position = ftell(logfile_fd);
-
-	                        // Parse line
-	                        parse_line(line);
-
-	                        // Free memory allocated by getline
-	                        free(line);
-	                        line = NULL;
-	                }
-	        }
-	}
+	database_close(&database);
 
 	return 0;
 }
 
-void parse_line(const char* line)
+// Build the page cache key for a request from its channel, mode and the arguments the mode uses
+// Returns 0 if the page can't be cached, or the mode is unknown
+static int stats_cache_key(struct MHD_Connection* connection, int channel, const char* mode, char* key, size_t key_len)
 {
-	int year;
-	char month[32];
-	int date;
-	int hour;
-	int minute;
+	static const char* const activity_args[] = { "bucket", "from", "to", "nick", NULL };
+	static const char* const search_args[] = { "q", "nick", "sort", "before", NULL };
 
-	int rc;                // Return code
-	int rc2;               // Return code
+	const char* const* args = NULL;
+	const char* value;
+	size_t len;
+	int i;
 
-	time_t time;
+	if (strcmp(mode, "html") == 0 || strcmp(mode, "json") == 0)
+	{
+		args = NULL;
+	}
+	else if (strcmp(mode, "activity") == 0)
+	{
+		// Without "to" the range ends now, which moves on without anything being committed
+		if (MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "to") == NULL)
+			return 0;
 
-	char* nick = NULL;     // Nickname
-	char* message = NULL;  // Message
+		args = activity_args;
+	}
+	else if (strcmp(mode, "search") == 0)
+	{
+		args = search_args;
+	}
+	else
+	{
+		// Unknown modes would only fill the cache with copies of the same error
+		return 0;
+	}
 
-	struct tm time_struct;
+	len = snprintf(key, key_len, "%d %zu:%s", channel, strlen(mode), mode);
 
-	int line_len = strlen(line);
+	// Values are length prefixed so none can run into the next
+	for (i = 0; args != NULL && args[i] != NULL && len < key_len; ++i)
+	{
+		value = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, args[i]);
 
-	hour = 0;
-	minute = 0;
+		if (value != NULL)
+			len += snprintf(key + len, key_len - len, " %s=%zu:%s", args[i], strlen(value), value);
+	}
 
-	// Allocate sscanf buffers
-	nick = malloc(line_len);
-	message = malloc(line_len);
+	return len < key_len;
+}
 
-	// Parse log open and day change message
-	rc = sscanf(line, "--- Log opened %*s %s %d %*d:%*d:%*d %d", month, &date, &year);
-	rc2 = sscanf(line, "--- Day changed %*s %s %d %d", month, &date, &year);
-	if (rc == 3 || rc2 == 3)
-	{
-		const int buffer_len = 1024;
-		char buffer[buffer_len];
+// Make the ETag for a page in an encoding, unique to this run so tags from before a restart never match
+// Pages with a footer that changes every request get weak tags, as they're only the same apart from it
+static void stats_etag(const struct page_version* page, enum page_encoding encoding, int weak, char* etag, size_t etag_len)
+{
+	const char* name = page_encoding_name(encoding);
 
-		// Create date string
-		snprintf(buffer, buffer_len, "%d %s %d 00:00:00", date, month, year);
+	snprintf(etag, etag_len, "%s\"%llx-%lx%s%s\"", weak ? "W/" : "", (long long)started, page->generation,
+	         name != NULL ? "-" : "", name != NULL ? name : "");
+}
 
-		// Parse date string %b
-		if (strptime(buffer, "%d %b %Y %H:%M:%S", &time_struct) == NULL)
-		{
-			fprintf(stderr, "Failed to parse date format %s\n", buffer);
+// Check if pages in a mode have a footer added to them on every request
+static int stats_has_footer(const char* mode)
+{
+	return strcmp(mode, "html") == 0;
+}
 
-			return;
-		}
+// Add the page's ETag and Last-Modified to a response
+static void stats_add_validators(struct MHD_Response* response, const struct page_version* page, enum page_encoding encoding,
+                                 int weak)
+{
+	char etag[64];
+	char modified[64];
+
+	stats_etag(page, encoding, weak, etag, sizeof(etag));
+	MHD_add_response_header(response, MHD_HTTP_HEADER_ETAG, etag);
 
-		// Convert day to unix time
-		current_day = mktime(&time_struct);
+	// Clients can keep the page but should check it's current every time, and
+	// caches need to keep each encoding separately
+	MHD_add_response_header(response, "Cache-Control", "no-cache");
+	MHD_add_response_header(response, "Vary", "Accept-Encoding");
 
-		goto parse_line_cleanup;
+	// Last-Modified is in whole seconds, so leave it out until the second the page was modified
+	// is over, or a change later in the same second would look like it came before
+	if (page->modified < time(NULL))
+	{
+		convert_time_to_string(page->modified, modified, sizeof(modified), "%a, %d %b %Y %H:%M:%S GMT");
+		MHD_add_response_header(response, MHD_HTTP_HEADER_LAST_MODIFIED, modified);
 	}
+}
 
-	// Parse topic
-	rc = sscanf(line, "%d:%d -!- %s changed the topic of %*s to: %[^\n]", &hour, &minute, nick, message);
+// Check if the client already has the page, going by If-None-Match, or If-Modified-Since without it
+static int stats_not_modified(struct MHD_Connection* connection, const struct page_version* page, enum page_encoding encoding)
+{
+	const char* header;
+	char etag[64];
+	struct tm since;
 
-	if (rc == 4)
+	header = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_IF_NONE_MATCH);
+	if (header != NULL)
 	{
-		time_t time;
-		sqlite3_stmt* statement;
+		// Compared weakly, so the tag is found with or without W/ in front of it
+		stats_etag(page, encoding, 0, etag, sizeof(etag));
 
-		// Work out time
-		time = current_day + hour * 3600 + minute * 60;
+		// A list of tags, possibly weak (W/"..."), or * for any
+		return strcmp(header, "*") == 0 || strstr(header, etag) != NULL;
+	}
 
-		// Skip if from the past
-		if (time > latest_time_at_load)
-		{
-			// Add topic to database
-			rc = sqlite3_prepare_v2(db, INSERT_TOPIC, -1, &statement, NULL);
-			if (rc != SQLITE_OK)
-			{
-				fprintf(stderr, SQLITE_STATEMENT_PREPERATION_FAILURE, sqlite3_errmsg(db));
-				fprintf(stderr, SQLITE_PROBLEM_QUERY, INSERT_TOPIC);
-				goto parse_line_cleanup;
-			}
+	header = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_IF_MODIFIED_SINCE);
+	if (header != NULL && page->modified < time(NULL))
+	{
+		memset(&since, 0, sizeof(since));
 
-			// Bind values
-			sqlite3_bind_int(statement, 1, (int)time);
-			sqlite3_bind_text(statement, 2, nick, -1, SQLITE_STATIC);
-			sqlite3_bind_text(statement, 3, message, -1, SQLITE_STATIC);
+		if (strptime(header, "%a, %d %b %Y %H:%M:%S GMT", &since) != NULL)
+			return timegm(&since) >= page->modified;
+	}
 
-			// Insert
-			rc = sqlite3_step(statement);
-			if (rc != SQLITE_DONE)
-			{
-				fprintf(stderr, SQLITE_QUERY_FAILURE, sqlite3_errmsg(db));
-				fprintf(stderr, SQLITE_PROBLEM_QUERY, INSERT_TOPIC);
-			}
+	return 0;
+}
 
-			// Finalise query
-			sqlite3_finalize(statement);
-		}
+// Tell the client its copy of the page is still current
+static int stats_queue_not_modified(struct MHD_Connection* connection, const struct page_version* page, enum page_encoding encoding,
+                                    int weak)
+{
+	int rc;
+	struct MHD_Response* response;
 
-		goto parse_line_cleanup;
-	}
+	response = MHD_create_response_from_buffer(0, NULL, MHD_RESPMEM_PERSISTENT);
 
-	// Parse message string
-	rc = sscanf(line, "%d:%d <%[^>]> %[^\n]", &hour, &minute, nick, message);
+	MHD_add_response_header(response, "Access-Control-Allow-Origin", "http://www.renaporn.com");
+	stats_add_validators(response, page, encoding, weak);
 
-	if (rc == 4)
-	{
-		sqlite3_stmt* statement;
+	rc = MHD_queue_response(connection, MHD_HTTP_NOT_MODIFIED, response);
+	MHD_destroy_response(response);
 
-		// Remove first character from nick (op char)
-		char* nick_only = nick+1;
+	return rc;
+}
 
-		// Calculate time
-		time = current_day + hour * 3600 + minute * 60;
+// Modes generate_statistics can render
+enum stats_mode
+{
+	STATS_MODE_NONE,                // Unknown mode, an empty page
+	STATS_MODE_HTML,
+	STATS_MODE_JSON,
+	STATS_MODE_ACTIVITY,
+	STATS_MODE_SEARCH,
+};
+
+// A page being rendered a section at a time, so responses can be sent as they're
+// rendered. Everything it needs from the request is copied in, as the response outlives it.
+struct stats_page
+{
+	struct channel* channel;
+	enum stats_mode mode;
+	int section;                    // Next section to render
+	struct timespec start;          // When the request came in
+
+	int bucket;                     // Activity mode's bucket length, range and nick (NULL for everyone)
+	time_t from, to;
+	char* nick;
+
+	char* query;                    // Search mode's query, nick above, sort and where to carry on from
+	int by_rank;
+	double after_rank;
+	long long after_id;
+	struct stats_search_result* results;
+	int result_count;
+
+	struct stringstream out;        // Rendered and not yet sent, when streaming
+	size_t out_sent;
+
+	int cacheable;                  // Put the page in the page cache once it's rendered, when streaming
+	char cache_key[PAGE_CACHE_KEY_LEN];
+	struct page_version version;
+	struct stringstream whole;      // Everything rendered so far, for the page cache
+
+	int rendering;                  // Counted in httpd.rendering until its last section's rendered
+};
+
+// Read a unix time from the query string, clamped so ranges can be subtracted without overflowing
+static time_t stats_time_arg(const char* arg)
+{
+	long long time = strtoll(arg, NULL, 10);
 
-		if (time >= latest_time_at_load)
-		{
-			// Skip messages already in the db at load
-			if (time == latest_time_at_load && messages_skipped < messages_to_skip)
-			{
-				messages_skipped++;
+	return (time_t)STATS_MIN(STATS_MAX(time, 0), STATS_MAX_TIME);
+}
 
-				goto parse_line_cleanup;
-			}
+// Read the request's mode and the arguments it uses
+static struct stats_page* stats_page_create(struct MHD_Connection* connection, struct channel* channel,
+                                            const char* mode, const struct timespec* start)
+{
+	struct stats_page* page;
+	const char* arg;
 
-			// Add message to database
-			rc = sqlite3_prepare_v2(db, INSERT_MESSAGE, -1, &statement, NULL);
-			if (rc != SQLITE_OK)
-			{
-				fprintf(stderr, SQLITE_STATEMENT_PREPERATION_FAILURE, sqlite3_errmsg(db));
-				fprintf(stderr, SQLITE_PROBLEM_QUERY, INSERT_MESSAGE);
-				goto parse_line_cleanup;
-			}
+	page = calloc(1, sizeof(struct stats_page));
+	page->channel = channel;
+	page->start = *start;
 
-			// Bind values
-			sqlite3_bind_text(statement, 1, nick_only, -1, SQLITE_STATIC);
-			sqlite3_bind_text(statement, 2, message, -1, SQLITE_STATIC);
-			sqlite3_bind_int(statement, 3, time);
+	if (strcmp(mode, "html") == 0)
+	{
+		page->mode = STATS_MODE_HTML;
+	}
+	else if (strcmp(mode, "json") == 0)
+	{
+		page->mode = STATS_MODE_JSON;
+	}
+	else if (strcmp(mode, "activity") == 0)
+	{
+		page->mode = STATS_MODE_ACTIVITY;
 
-			// Run statement
-			rc = sqlite3_step(statement);
-			if (rc != SQLITE_DONE)
-			{
-				fprintf(stderr, SQLITE_QUERY_FAILURE, sqlite3_errmsg(db));
-				fprintf(stderr, SQLITE_PROBLEM_QUERY, INSERT_MESSAGE);
-			}
+		// Bucket length, days unless hours are asked for
+		arg = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "bucket");
+		if (arg != NULL && strcmp(arg, "hour") == 0)
+			page->bucket = ACTIVITY_HOUR;
+		else
+			page->bucket = ACTIVITY_DAY;
 
-			// Delete statement
-			sqlite3_finalize(statement);
+		// Time range as unix times, the last 30 days by default
+		arg = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "to");
+		page->to = arg != NULL ? stats_time_arg(arg) : time(NULL);
 
-			// Increment message count for user
-			rc = sqlite3_prepare_v2(db, INCREMENT_MESSAGE_COUNT, -1, &statement, NULL);
-			if (rc != SQLITE_OK)
-			{
-				fprintf(stderr, SQLITE_STATEMENT_PREPERATION_FAILURE, sqlite3_errmsg(db));
-				fprintf(stderr, SQLITE_PROBLEM_QUERY, INCREMENT_MESSAGE_COUNT);
-				goto parse_line_cleanup;
-			}
+		arg = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "from");
+		page->from = arg != NULL ? stats_time_arg(arg) : STATS_MAX(page->to - 30 * ACTIVITY_DAY, 0);
 
-			// Bind values
-			sqlite3_bind_int(statement, 1, time);
-			sqlite3_bind_text(statement, 2, nick_only, -1, SQLITE_STATIC);
+		// Just one user's messages (optional)
+		arg = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "nick");
+		page->nick = arg != NULL ? strdup(arg) : NULL;
+	}
+	else if (strcmp(mode, "search") == 0)
+	{
+		page->mode = STATS_MODE_SEARCH;
 
-			// Run statement
-			rc = sqlite3_step(statement);
-			if (rc != SQLITE_DONE)
-			{
-				fprintf(stderr, SQLITE_QUERY_FAILURE, sqlite3_errmsg(db));
-				fprintf(stderr, SQLITE_PROBLEM_QUERY, INCREMENT_MESSAGE_COUNT);
-			}
+		arg = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "q");
+		page->query = arg != NULL ? strdup(arg) : NULL;
 
-			// Delete statement
-			sqlite3_finalize(statement);
+		arg = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "nick");
+		page->nick = arg != NULL ? strdup(arg) : NULL;
 
-			// Check that a row was modified
-			if (sqlite3_changes(db) == 0)
-			{
-				// If not, insert initial row
-				rc = sqlite3_prepare_v2(db, INSERT_MESSAGE_COUNT, -1, &statement, NULL);
-				if (rc != SQLITE_OK)
-				{
-					fprintf(stderr, SQLITE_STATEMENT_PREPERATION_FAILURE, sqlite3_errmsg(db));
-					fprintf(stderr, SQLITE_PROBLEM_QUERY, INSERT_MESSAGE_COUNT);
-					goto parse_line_cleanup;
-				}
-
-				// Bind values
-				sqlite3_bind_text(statement, 1, nick_only, -1, SQLITE_STATIC);
-				sqlite3_bind_int(statement, 2, time);
-
-				// Run statement
-				rc = sqlite3_step(statement);
-				if (rc != SQLITE_DONE)
-				{
-					fprintf(stderr, SQLITE_QUERY_FAILURE, sqlite3_errmsg(db));
-					fprintf(stderr, SQLITE_PROBLEM_QUERY, INSERT_MESSAGE_COUNT);
-				}
-
-				// Delete statement
-				sqlite3_finalize(statement);
-			}
+		// Newest first unless sorting by relevance is asked for
+		arg = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "sort");
+		page->by_rank = arg != NULL && strcmp(arg, "rank") == 0;
 
-			// Increment total message count
-			sqlite_messages++;
-		}
+		// Carry on from the last page's "next" (optional)
+		arg = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "before");
+		page->after_rank = -HUGE_VAL;
+		page->after_id = page->by_rank ? 0 : LLONG_MAX;
 
-		goto parse_line_cleanup;
+		if (arg != NULL)
+		{
+			if (page->by_rank)
+				sscanf(arg, "%lf:%lld", &page->after_rank, &page->after_id);
+			else
+				sscanf(arg, "%lld", &page->after_id);
+		}
+	}
+	else
+	{
+		page->mode = STATS_MODE_NONE;
 	}
 
-parse_line_cleanup:
-	free(nick);
-	free(message);
+	return page;
 }
 
-int generate_statistics(void* cls, struct MHD_Connection* connection,
-                          const char* url,
-                          const char* method, const char* version,
-                          const char* upload_data,
-                          size_t* upload_data_size, void** con_cls)
+// Free a page, also used as the streamed response's free callback
+static void stats_page_destroy(void* cls)
+{
+	struct stats_page* page = cls;
+
+	// Streamed pages can be dropped part way through when the client goes away
+	if (page->rendering)
+		httpd_render_end(&httpd);
+
+	ss_destroy(&page->out);
+	ss_destroy(&page->whole);
+	free(page->nick);
+	free(page->query);
+	free(page->results);
+	free(page);
+}
+
+// Render the next section of a page into ss
+// Returns 0 once every section has been rendered
+static int stats_page_render(struct stats_page* page, struct stringstream* ss)
 {
 	// Constants (which should probably be moved into a config file at some point in the future)
 	const int max_highscore_users = 20;    // Number of users to show in the message count highscores
 	const int max_extended_hs = 20;        // Number of extended highscores to show
 	const int random_message_count = 10;   // Number of random messages wanted
 	const int latest_topic_count = 3;      // Number of latest topics to show
+	const int search_results_per_section = 10; // Search results rendered at a time
 
 	int i, j;                              // Counters
 	const int buffer_len = 8192;           // String buffer length
@@ -694,54 +872,29 @@ int generate_statistics(void* cls, struct MHD_Connection* connection,
 	char timebuf[timebuf_len];             // Time string buffer
 
 	int rc;                                // Return code
+	int section = page->section++;         // Section to render
+	struct channel* channel = page->channel;
 
-	struct stringstream ss;                // Stringstream for output
-
-	struct MHD_Response* response;         // HTTP response
-
-	struct timespec start, finish;         // Time structures for measuring execution time
-	float time_taken;                      // Time taken in ms
-
-	const char* default_mode = "html";     // The default mode for the page
-	const char* mode = default_mode;       // The mode from GET("mode") or default_mode if unavailable
-
-	struct stats_user* users = NULL;        // Users array for stats_* calls
-	struct stats_message* messages = NULL;  // Messages array for stats* calls
-
-	// Allocate memory for arrays
-	users = malloc(sizeof(struct stats_user) * STATS_MAX(max_highscore_users, max_extended_hs));
-	messages = malloc(sizeof(struct stats_message) * STATS_MAX(random_message_count, latest_topic_count));
-
-	// Create stringstream
-	ss = ss_create();
-
-	// Initialise start time
-	clock_gettime(CLOCK_MONOTONIC, &start);
-
-	// Get page mode
-	mode = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "mode");
-
-	// Set default mode if GET("mode") is null
-	if (mode == NULL)
-		mode = default_mode;
+	struct stats_user users[STATS_MAX(max_highscore_users, max_extended_hs)];                   // Users for stats_* calls
+	struct stats_message messages[STATS_MAX(random_message_count, latest_topic_count)];        // Messages for stats_* calls
 
-	if (strcmp(mode, "html") == 0)
+	if (page->mode == STATS_MODE_HTML && section == 0)
 	{
 		// Write start of page
-		ss_add(&ss, "<html><head><link rel=\"stylesheet\" href=\"http://www.renaporn.com/~rena/stats.css\">");
+		ss_add(ss, "<html><head><link rel=\"stylesheet\" href=\"http://www.renaporn.com/~rena/stats.css\">");
 
 		// Format channel name and network for title
-		snprintf(buffer, buffer_len, "<title>Stats for %s at %s</title>", channel, network);
-		ss_add(&ss, buffer);
+		snprintf(buffer, buffer_len, "<title>Stats for %s at %s</title>", channel->name, channel->network);
+		ss_add(ss, buffer);
 
 		// Format channel name and network for page
-		snprintf(buffer, buffer_len, "<h1>Stats for %s at %s</h1>", channel, network);
-		ss_add(&ss, "</head><body>");
-		ss_add(&ss, buffer);
-		ss_add(&ss, "<table><tr><td></td><td style=\"width: 110px\">Nickname</td><td style=\"width: 50px;\">Lines</td><td style=\"width: 90px;\">Last seen</td><td style=\"width: 500px;\">Random message</td></tr>");
+		snprintf(buffer, buffer_len, "<h1>Stats for %s at %s</h1>", channel->name, channel->network);
+		ss_add(ss, "</head><body>");
+		ss_add(ss, buffer);
+		ss_add(ss, "<table><tr><td></td><td style=\"width: 110px\">Nickname</td><td style=\"width: 50px;\">Lines</td><td style=\"width: 90px;\">Last seen</td><td style=\"width: 500px;\">Random message</td></tr>");
 
 		// Get top users
-		rc = stats_get_top_users_full(users, max_highscore_users);
+		rc = stats_get_top_users_full(channel->id, users, max_highscore_users);
 
 		// Iterate through top users
 		for (i = 0; i < rc; ++i)
@@ -753,36 +906,40 @@ int generate_statistics(void* cls, struct MHD_Connection* connection,
 			snprintf(buffer, buffer_len, "<tr><td>%d</td><td>%s</td><td>%d</td><td>%s</td><td>%s</td></tr>", i+1, users[i].nick, users[i].lines, timebuf, users[i].message);
 
 			// Write to page buffer
-			ss_add(&ss, buffer);
+			ss_add(ss, buffer);
 		}
 
 		// End table
-		ss_add(&ss, "</table><h3>Users who didn't quite make it</h3>");
-
+		ss_add(ss, "</table><h3>Users who didn't quite make it</h3>");
+	}
+	else if (page->mode == STATS_MODE_HTML && section == 1)
+	{
 		// Get extended highscore users
-		rc = stats_get_top_users_min(users, max_extended_hs, max_highscore_users);
+		rc = stats_get_top_users_min(channel->id, users, max_extended_hs, max_highscore_users);
 
 		// Generate html
-		ss_add(&ss, "<table>");
+		ss_add(ss, "<table>");
 		for (i = 0; i < (int)(rc / 5 + 0.5); ++i)
 		{
-			ss_add(&ss, "<tr>");
+			ss_add(ss, "<tr>");
 			for (j = 0; j < 5; ++j)
 			{
 				snprintf(buffer, buffer_len, "<td style=\"width: 150px;\">%s (%d)</td>", users[i*5 + j].nick, users[i*5 + j].lines);
-				ss_add(&ss, buffer);
+				ss_add(ss, buffer);
 			}
-			ss_add(&ss, "</tr>");
+			ss_add(ss, "</tr>");
 		}
 
 		// Line break
-		ss_add(&ss, "</table><br>");
-
+		ss_add(ss, "</table><br>");
+	}
+	else if (page->mode == STATS_MODE_HTML && section == 2)
+	{
 		// Get random_message_count random rows
-		rc = stats_get_random_messages(messages, random_message_count);
+		rc = stats_get_random_messages(channel->id, messages, random_message_count);
 
 		// Generate HTML
-		ss_add(&ss, "<h2>10 random messages from log</h2><table>");
+		ss_add(ss, "<h2>10 random messages from log</h2><table>");
 
 		for (i = 0; i < rc; ++i)
 		{
@@ -790,17 +947,19 @@ int generate_statistics(void* cls, struct MHD_Connection* connection,
 			snprintf(buffer, buffer_len, "<tr><td>&lt;%s&gt; %s</td></tr>", messages[i].nick, messages[i].message);
 
 			// Add to page
-			ss_add(&ss, buffer);
+			ss_add(ss, buffer);
 		}
 
 		// End table
-		ss_add(&ss, "</table>");
-
+		ss_add(ss, "</table>");
+	}
+	else if (page->mode == STATS_MODE_HTML && section == 3)
+	{
 		// Get latest topics
-		rc = stats_get_last_topics(messages, latest_topic_count);
+		rc = stats_get_last_topics(channel->id, messages, latest_topic_count);
 
 		// Generate HTML
-		ss_add(&ss, "<h2>Latest topics</h2><table>");
+		ss_add(ss, "<h2>Latest topics</h2><table>");
 
 		for (i = 0; i < rc; ++i)
 		{
@@ -811,32 +970,19 @@ int generate_statistics(void* cls, struct MHD_Connection* connection,
 			snprintf(buffer, buffer_len, "<tr><td style=\"width: 450px;\">%s</td><td>Set by %s at %s</td></tr>", messages[i].message, messages[i].nick, timebuf);
 
 			// Add to page
-			ss_add(&ss, buffer);
+			ss_add(ss, buffer);
 		}
 
 		// End table
-		ss_add(&ss, "</table>");
-
-		// Get finish time in ms
-		clock_gettime(CLOCK_MONOTONIC, &finish);
-		time_taken = (finish.tv_sec - start.tv_sec) * 1000.0f +
-				 (finish.tv_nsec - start.tv_nsec) / 1000000.0f;
-
-		// Generate footer
-		snprintf(buffer, buffer_len, "<p>Total messages: %d<br>Mode: %s<br>Time taken to generate: %gms</p>", sqlite_messages, mode, time_taken);
-
-		// Write footer
-		ss_add(&ss, "<br>");
-		ss_add(&ss, buffer);
-		ss_add(&ss, "</body></html>");
+		ss_add(ss, "</table>");
 	}
-	else if (strcmp(mode, "json") == 0)
+	else if (page->mode == STATS_MODE_JSON && section == 0)
 	{
 		// Get top users
-		rc = stats_get_top_users_full(users, max_highscore_users);
+		rc = stats_get_top_users_full(channel->id, users, max_highscore_users);
 
 		// Top of json
-		ss_add(&ss, "{ \"users\": [");
+		ss_add(ss, "{ \"users\": [");
 
 		// Iterate through them and write json
 		for (i = 0; i < rc; ++i)
@@ -846,162 +992,675 @@ int generate_statistics(void* cls, struct MHD_Connection* connection,
 			snprintf(buffer, buffer_len, top_user_format, i+1, users[i].nick, users[i].lines, users[i].message);
 
 			if (i > 0)
-				ss_add(&ss, ",");
+				ss_add(ss, ",");
 
-			ss_add(&ss, buffer);
+			ss_add(ss, buffer);
 		}
 
 		// Bottom of json
-		ss_add(&ss, "] }");
+		ss_add(ss, "] }");
 	}
+	else if (page->mode == STATS_MODE_ACTIVITY && section == 0)
+	{
+		int count;
+		struct stats_activity* activity;
 
-	// Create response
-	response = MHD_create_response_from_buffer(strlen(ss.buffer), (void*)ss.buffer, MHD_RESPMEM_PERSISTENT);
-
-	MHD_add_response_header(response, "Access-Control-Allow-Origin", "http://www.renaporn.com");
-
-	rc = MHD_queue_response(connection, MHD_HTTP_OK, response);
-	MHD_destroy_response(response);
+		// Allocate enough buckets for the whole range
+		count = page->to > page->from ? (int)STATS_MIN((page->to - page->from) / page->bucket + 2, STATS_MAX_ACTIVITY) : 0;
+		activity = malloc(sizeof(struct stats_activity) * STATS_MAX(count, 1));
 
-	// Clean up memory
-	ss_destroy(&ss);
-	free(users);
-	free(messages);
+		rc = stats_get_activity(channel->id, page->nick, page->bucket, page->from, page->to, activity, count);
 
-	return rc;
-}
+		// Top of json
+		snprintf(buffer, buffer_len, "{ \"from\": %lld, \"to\": %lld, \"bucket\": \"%s\", \"activity\": [",
+		         (long long)page->from, (long long)page->to, page->bucket == ACTIVITY_HOUR ? "hour" : "day");
+		ss_add(ss, buffer);
 
-int stats_get_top_users_full(struct stats_user* users, int count)
-{
-	int i;                          // Counter
-	int rc;                         // Return code
-	sqlite3_stmt* statement;        // Sqlite statement
+		for (i = 0; i < rc; ++i)
+		{
+			snprintf(buffer, buffer_len, "%s{ \"time\": %lld, \"messages\": %d }",
+			         i > 0 ? "," : "", (long long)activity[i].time, activity[i].messages);
+			ss_add(ss, buffer);
+		}
 
-	// Clear top users
-	execute_sql(CLEAR_TOP_USERS_TABLE);
+		// Bottom of json
+		ss_add(ss, "] }");
 
-	// Prepare top users
-	rc = sqlite3_prepare_v2(db, PREPARE_TOP_USERS_TABLE, -1, &statement, NULL);
-	if (rc != SQLITE_OK)
+		free(activity);
+	}
+	else if (page->mode == STATS_MODE_SEARCH && section == 0)
 	{
-		fprintf(stderr, SQLITE_STATEMENT_PREPERATION_FAILURE, sqlite3_errmsg(db));
-		fprintf(stderr, SQLITE_PROBLEM_QUERY, PREPARE_TOP_USERS_TABLE);
+		page->results = malloc(sizeof(struct stats_search_result) * STATS_SEARCH_PAGE);
+		page->result_count = page->query != NULL ?
+			stats_search(channel->id, page->query, page->nick, page->by_rank, page->after_rank, page->after_id,
+			             page->results, STATS_SEARCH_PAGE) : 0;
 
-		return 0;
+		// Top of json
+		ss_add(ss, "{ \"results\": [");
 	}
+	else if (page->mode == STATS_MODE_SEARCH && (section - 1) * search_results_per_section < page->result_count)
+	{
+		struct stats_search_result* results = page->results;
 
-	// Bind parameters
-	sqlite3_bind_int(statement, 1, count);
+		// The next few results
+		for (i = (section - 1) * search_results_per_section;
+		     i < page->result_count && i < section * search_results_per_section; ++i)
+		{
+			snprintf(buffer, buffer_len, "%s{ \"id\": %lld, \"time\": %lld, \"rank\": %g, \"nick\": ",
+			         i > 0 ? "," : "", results[i].id, (long long)results[i].time, results[i].rank);
+			ss_add(ss, buffer);
+			ss_add_json(ss, results[i].nick);
+			ss_add(ss, ", \"message\": ");
+			ss_add_json(ss, results[i].message);
+			ss_add(ss, " }");
+		}
+	}
+	else if (page->mode == STATS_MODE_SEARCH && page->results != NULL)
+	{
+		struct stats_search_result* results = page->results;
+		rc = page->result_count;
 
-	// Run query
-	rc = sqlite3_step(statement);
+		// Where the next page starts, if there might be one
+		if (rc < STATS_SEARCH_PAGE)
+			snprintf(buffer, buffer_len, "], \"next\": null }");
+		else if (page->by_rank)
+			snprintf(buffer, buffer_len, "], \"next\": \"%.17g:%lld\" }", results[rc - 1].rank, results[rc - 1].id);
+		else
+			snprintf(buffer, buffer_len, "], \"next\": \"%lld\" }", results[rc - 1].id);
 
-	// Make sure query completed successfully
-	if (rc != SQLITE_DONE)
+		// Bottom of json
+		ss_add(ss, buffer);
+
+		free(page->results);
+		page->results = NULL;
+	}
+	else
+	{
+		// Nothing left
+		return 0;
+	}
+
+	return 1;
+}
+
+// Add the html footer, which has live statistics so isn't cached with the rest of the page
+static void stats_page_footer(const struct stats_page* page, int cached, struct stringstream* ss)
+{
+	const int buffer_len = 1024;           // String buffer length
+	char buffer[buffer_len];               // String buffer
+
+	struct timespec finish;                // Time structure for measuring execution time
+	float time_taken;                      // Time taken in ms
+
+	if (page->mode != STATS_MODE_HTML)
+		return;
+
+	// Get finish time in ms
+	clock_gettime(CLOCK_MONOTONIC, &finish);
+	time_taken = (finish.tv_sec - page->start.tv_sec) * 1000.0f +
+			 (finish.tv_nsec - page->start.tv_nsec) / 1000000.0f;
+
+	// Generate footer
+	snprintf(buffer, buffer_len, "<p>Total messages: %d<br>Commits: %lu (%lu lines)<br>"
+	         "Write queue: %zu/%zu (at most %zu, full %lu times)<br>Page cache: %lu hits, %lu misses<br>"
+	         "Busy: %lu requests turned away<br>Mode: html<br>Time taken to generate: %gms%s</p>",
+	         page->channel->messages, atomic_load(&writer.commits), atomic_load(&writer.lines_committed),
+	         writer_depth(&writer), writer.queue_size, atomic_load(&writer.max_depth),
+	         atomic_load(&writer.full_waits), atomic_load(&page_cache.hits), atomic_load(&page_cache.misses),
+	         atomic_load(&httpd.shed), time_taken, cached ? " (cached)" : "");
+
+	// Write footer
+	ss_add(ss, "<br>");
+	ss_add(ss, buffer);
+
+	// Progress moving messages from new aliases, while it's going
+	if (atomic_load(&store.reattribute_done) < atomic_load(&store.reattribute_total))
+	{
+		snprintf(buffer, buffer_len, "<p>Moving messages to main nicks from aliases: %lld/%lld</p>",
+		         atomic_load(&store.reattribute_done), atomic_load(&store.reattribute_total));
+		ss_add(ss, buffer);
+	}
+	ss_add(ss, "</body></html>");
+}
+
+// Streamed response callback, rendering sections as MHD wants more to send
+static ssize_t stats_page_read(void* cls, uint64_t pos, char* buf, size_t max)
+{
+	struct stats_page* page = cls;
+	size_t len;
+
+	// Render until there's something to send, section -1 means the footer's been added
+	while (page->out_sent == page->out.len)
+	{
+		if (page->section < 0)
+			return MHD_CONTENT_READER_END_OF_STREAM;
+
+		ss_clear(&page->out);
+		page->out_sent = 0;
+
+		if (stats_page_render(page, &page->out))
+		{
+			if (page->cacheable)
+				ss_add_len(&page->whole, page->out.buffer, page->out.len);
+		}
+		else
+		{
+			// Cache the page before adding the footer to it
+			if (page->cacheable)
+				page_cache_put(&page_cache, page->cache_key, &page->version, page->whole.buffer, page->whole.len);
+
+			stats_page_footer(page, 0, &page->out);
+			page->section = -1;
+
+			httpd_render_end(&httpd);
+			page->rendering = 0;
+		}
+	}
+
+	len = STATS_MIN(max, page->out.len - page->out_sent);
+	memcpy(buf, page->out.buffer + page->out_sent, len);
+	page->out_sent += len;
+
+	return len;
+}
+
+int generate_statistics(void* cls, struct MHD_Connection* connection,
+                          const char* url,
+                          const char* method, const char* version,
+                          const char* upload_data,
+                          size_t* upload_data_size, void** con_cls)
+{
+	int rc;                                // Return code
+
+	struct stringstream ss;                // Stringstream for output
+	struct stringstream tail;              // Added to the page after caching, the html footer
+	struct stringstream encoded;           // The page just rendered, compressed from the cache
+
+	struct MHD_Response* response;         // HTTP response
+
+	struct timespec start;                 // Time structure for measuring execution time
+
+	const char* default_mode = "html";     // The default mode for the page
+	const char* mode = default_mode;       // The mode from GET("mode") or default_mode if unavailable
+
+	struct channel* channel;                // Channel from GET("channel"), or the first channel
+	struct stats_page* stats;               // The page being rendered
+
+	char cache_key[PAGE_CACHE_KEY_LEN];     // Identifies the page in the page cache
+	struct page_version page;               // What the page is rendered from
+	int cacheable;                          // The page can go in the page cache
+	int cached;                             // The page came from the page cache
+	struct page_encoder encoder;            // Content coding the page is sent in
+
+	// Get channel
+	channel = find_channel(MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "channel"));
+	if (channel == NULL)
 	{
-		fprintf(stderr, SQLITE_QUERY_FAILURE, sqlite3_errmsg(db));
-		fprintf(stderr, SQLITE_PROBLEM_QUERY, PREPARE_TOP_USERS_TABLE);
+		const char* not_found = "Unknown channel\n";
+
+		response = MHD_create_response_from_buffer(strlen(not_found), (void*)not_found, MHD_RESPMEM_PERSISTENT);
+		rc = MHD_queue_response(connection, MHD_HTTP_NOT_FOUND, response);
+		MHD_destroy_response(response);
+
+		return rc;
+	}
+
+	// Initialise start time
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	// Get page mode
+	mode = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "mode");
+
+	// Set default mode if GET("mode") is null
+	if (mode == NULL)
+		mode = default_mode;
+
+	// What the page would be rendered from now, modified first so it's never later than the generation
+	page.modified = atomic_load(&store.modified);
+	page.generation = atomic_load(&store.generation);
+	cacheable = stats_cache_key(connection, channel->id, mode, cache_key, sizeof(cache_key));
 
+	// Pages are compressed once as they're cached, so only cached pages are sent compressed
+	memset(&encoder, 0, sizeof(encoder));
+	if (cacheable && page_cache.len > 0)
+	{
+		encoder.encoding = page_encoding_accepted(MHD_lookup_connection_value(connection, MHD_HEADER_KIND,
+		                                                                      MHD_HTTP_HEADER_ACCEPT_ENCODING));
+	}
+
+	// Polls from clients that already have the current page are answered before anything else
+	if (cacheable && stats_not_modified(connection, &page, encoder.encoding))
+		return stats_queue_not_modified(connection, &page, encoder.encoding, stats_has_footer(mode));
+
+	// Create stringstream
+	ss = ss_create();
+
+	// Reuse the page if nothing new has been committed since it was rendered
+	cached = cacheable && page_cache_get(&page_cache, cache_key, &page, &encoder, &ss);
+
+	// Clients can have an older page still being served from the cache
+	if (cached && stats_not_modified(connection, &page, encoder.encoding))
+	{
+		ss_destroy(&ss);
+		return stats_queue_not_modified(connection, &page, encoder.encoding, stats_has_footer(mode));
+	}
+
+	// Past capacity, requests that need a page rendered are turned away straight away
+	if (!cached && !httpd_render_begin(&httpd))
+	{
+		ss_destroy(&ss);
+		return httpd_queue_unavailable(&httpd, connection);
+	}
+
+	stats = stats_page_create(connection, channel, mode, &start);
+
+	if (!cached && encoder.encoding == PAGE_IDENTITY)
+	{
+		// Send the page a section at a time as it's rendered, the response owns it from here
+		ss_destroy(&ss);
+
+		stats->out = ss_create();
+		stats->rendering = 1;
+
+		if (cacheable)
+		{
+			stats->cacheable = 1;
+			strcpy(stats->cache_key, cache_key);
+			stats->version = page;
+			stats->whole = ss_create();
+		}
+
+		response = MHD_create_response_from_callback(MHD_SIZE_UNKNOWN, STATS_STREAM_BLOCK_SIZE,
+		                                             &stats_page_read, stats, &stats_page_destroy);
+	}
+	else
+	{
+		if (!cached)
+		{
+			// Render the whole page to cache it, then send it compressed from the cache like the requests after it
+			while (stats_page_render(stats, &ss))
+				;
+
+			httpd_render_end(&httpd);
+
+			page_cache_put(&page_cache, cache_key, &page, ss.buffer, ss.len);
+
+			encoded = ss_create();
+
+			if (page_cache_read(&page_cache, cache_key, &page, &encoder, &encoded))
+			{
+				ss_destroy(&ss);
+				ss = encoded;
+			}
+			else
+			{
+				ss_destroy(&encoded);
+				encoder.encoding = PAGE_IDENTITY;
+			}
+		}
+
+		// Finish the page in whatever encoding it's in
+		tail = ss_create();
+		stats_page_footer(stats, cached, &tail);
+		page_encoder_finish(&encoder, &ss, tail.buffer);
+		ss_destroy(&tail);
+
+		stats_page_destroy(stats);
+
+		// The response frees the buffer once it's been sent
+		response = MHD_create_response_from_buffer(ss.len, (void*)ss.buffer, MHD_RESPMEM_MUST_FREE);
+		ss.buffer = NULL;
+	}
+
+	MHD_add_response_header(response, "Access-Control-Allow-Origin", "http://www.renaporn.com");
+
+	if (encoder.encoding != PAGE_IDENTITY)
+		MHD_add_response_header(response, MHD_HTTP_HEADER_CONTENT_ENCODING, page_encoding_name(encoder.encoding));
+
+	// Let clients poll with If-None-Match or If-Modified-Since, to get a 304 while nothing's changed
+	if (cacheable)
+		stats_add_validators(response, &page, encoder.encoding, stats_has_footer(mode));
+
+	rc = MHD_queue_response(connection, MHD_HTTP_OK, response);
+	MHD_destroy_response(response);
+
+	return rc;
+}
+
+// Get a nick by id, or the main nick if it has since become an alias, "" if there isn't one
+static void stats_nick_name(sqlite3* reader, int id, char* nick, size_t nick_len)
+{
+	size_t len;
+	const char* name = NULL;
+	struct logline_slice main_nick;
+	sqlite3_stmt* statement = sc_get(sc_thread_cache(reader), STMT_SELECT_NICK);
+
+	nick[0] = '\0';
+
+	if (statement == NULL)
+		return;
+
+	sqlite3_bind_int(statement, 1, id);
+
+	if (sqlite3_step(statement) == SQLITE_ROW)
+		name = (const char*)sqlite3_column_text(statement, 0);
+
+	if (name != NULL)
+	{
+		main_nick.ptr = name;
+		main_nick.len = strlen(name);
+		main_nick = alias_resolve(&store.aliases, main_nick);
+
+		len = main_nick.len < nick_len - 1 ? main_nick.len : nick_len - 1;
+		memcpy(nick, main_nick.ptr, len);
+		nick[len] = '\0';
+	}
+
+	sqlite3_reset(statement);
+}
+
+// Read an archived message from the block a statement finds (already bound), either the
+// first at or after id, or if nick isn't 0 the one from nick with userid
+// Returns 1 if there was one
+static int stats_archived_message(sqlite3* reader, sqlite3_stmt* statement, enum statement_id id, int channel,
+                                  long long message_id, int nick, long long userid, struct archive_message* message)
+{
+	int rc;
+	struct archive_block block;
+
+	rc = sqlite3_step(statement);
+	if (rc != SQLITE_ROW)
+	{
+		if (rc != SQLITE_DONE)
+		{
+			fprintf(stderr, SQLITE_QUERY_FAILURE, sqlite3_errmsg(reader));
+			fprintf(stderr, SQLITE_PROBLEM_QUERY, sc_sql(id));
+		}
+
+		sqlite3_reset(statement);
 		return 0;
 	}
 
-	// Finalise statement
-	rc = sqlite3_finalize(statement);
+	archive_block_column(statement, 0, channel, &block);
 
-	// Select generated table
-	rc = sqlite3_prepare_v2(db, SELECT_TOP_USERS_TABLE, -1, &statement, NULL);
-	if (rc != SQLITE_OK)
+	// The block has the message under the nick and userid it was written with,
+	// which differ if it's been moved from an alias since
+	if (nick != 0)
 	{
-		fprintf(stderr, SQLITE_STATEMENT_PREPERATION_FAILURE, sqlite3_errmsg(db));
-		fprintf(stderr, SQLITE_PROBLEM_QUERY, SELECT_TOP_USERS_TABLE);
+		nick = sqlite3_column_int(statement, 7);
+		userid = sqlite3_column_int64(statement, 8) + userid - sqlite3_column_int64(statement, 9);
+	}
+
+	sqlite3_reset(statement);
 
+	if (nick != 0)
+		return archive_read_user(&store.archive, &block, nick, userid, message);
+
+	return archive_read_at_id(&store.archive, &block, message_id, message);
+}
+
+// Read the first archived message in a channel at or after id
+// Returns 0 if it isn't archived
+static int stats_archived_message_at_id(sqlite3* reader, int channel, long long id, struct archive_message* message)
+{
+	sqlite3_stmt* statement = sc_get(sc_thread_cache(reader), STMT_SELECT_ARCHIVE_BLOCK_AT_ID);
+
+	if (statement == NULL)
 		return 0;
+
+	sqlite3_bind_int(statement, 1, channel);
+	sqlite3_bind_int64(statement, 2, id);
+
+	return stats_archived_message(reader, statement, STMT_SELECT_ARCHIVE_BLOCK_AT_ID, channel, id, 0, 0, message);
+}
+
+// Copy leaderboard entries into stats users, without messages
+static void copy_leaderboard_users(struct stats_user* users, const struct leaderboard_entry* entries, int count)
+{
+	int i;
+
+	for (i = 0; i < count; ++i)
+	{
+		strncpy(users[i].nick, entries[i].name, STATS_NICK_LEN);
+		users[i].nick[STATS_NICK_LEN - 1] = '\0';
+		users[i].message[0] = '\0';
+		users[i].lines = entries[i].messages;
+		users[i].lastseen = entries[i].lastseen;
 	}
+}
 
-	// Run query
-	i = 0;
-	rc = sqlite3_step(statement);
-	while (rc == SQLITE_ROW)
+int stats_get_top_users_full(int channel, struct stats_user* users, int count)
+{
+	int i;                          // Counter
+	int rc;                         // Return code
+	long long userid;               // Userid of the random message
+	sqlite3_stmt* statement;        // Sqlite statement
+	struct archive_message archived; // Random message, if it's been archived
+	struct leaderboard_entry* entries; // Users from the leaderboard
+	struct leaderboard* leaderboard = store_leaderboard(&store, channel);
+	sqlite3* reader = database_reader(&database);
+	struct statement_cache* statements = sc_thread_cache(reader);
+
+	if (leaderboard == NULL)
+		return 0;
+
+	// Get top users
+	entries = malloc(sizeof(struct leaderboard_entry) * count);
+	count = leaderboard_read(leaderboard, entries, count, 0);
+	copy_leaderboard_users(users, entries, count);
+
+	// Pick a random message for each of them
+	for (i = 0; i < count; ++i)
 	{
-		time_t lastseen;
-		int messages;
-		const char* nick;
 		const char* message;
 
-		// Get values
-		nick = (const char*)sqlite3_column_text(statement, 0);
-		messages = sqlite3_column_int(statement, 1);
-		message = (const char*)sqlite3_column_text(statement, 2);
-		lastseen = (time_t)sqlite3_column_int(statement, 3);
+		if (entries[i].messages <= 0)
+			continue;
 
-		// If a blank string is in the db sqlite will return NULL
-		if (nick == NULL)
-			nick = "";
-		if (message == NULL)
-			message = "";
+		statement = sc_get(statements, STMT_SELECT_USER_MESSAGE);
+		if (statement == NULL)
+			break;
+
+		// The message with a random userid below their message count
+		sqlite3_randomness(sizeof(userid), &userid);
+		userid = llabs(userid % entries[i].messages);
 
-		// Add to array
-		strncpy(users[i].nick, nick, STATS_NICK_LEN);
-		strncpy(users[i].message, message, STATS_MESSAGE_LEN);
-		users[i].lines = messages;
-		users[i].lastseen = lastseen;
+		// Bind parameters
+		sqlite3_bind_int(statement, 1, channel);
+		sqlite3_bind_int64(statement, 2, userid);
+		sqlite3_bind_int(statement, 3, entries[i].nick);
 
-		// Get next row
+		// Run query
 		rc = sqlite3_step(statement);
+		if (rc == SQLITE_ROW)
+		{
+			message = (const char*)sqlite3_column_text(statement, 0);
 
-		// Increment row number
-		i++;
-	}
+			// If a blank string is in the db sqlite will return NULL
+			if (message != NULL)
+				strncpy(users[i].message, message, STATS_MESSAGE_LEN);
+		}
+		else if (rc != SQLITE_DONE)
+		{
+			fprintf(stderr, SQLITE_QUERY_FAILURE, sqlite3_errmsg(reader));
+			fprintf(stderr, SQLITE_PROBLEM_QUERY, SELECT_USER_MESSAGE);
+		}
 
-	// Make sure query completed successfully
-	if (rc != SQLITE_DONE)
-	{
-		fprintf(stderr, "test\n");
-		fprintf(stderr, SQLITE_QUERY_FAILURE, sqlite3_errmsg(db));
-		fprintf(stderr, SQLITE_PROBLEM_QUERY, SELECT_TOP_USERS_TABLE);
+		// Reset statement
+		sqlite3_reset(statement);
+
+		// Not in the database, so it's been archived
+		if (rc == SQLITE_DONE)
+		{
+			statement = sc_get(statements, STMT_SELECT_ARCHIVE_USER_BLOCK);
+			if (statement == NULL)
+				break;
+
+			sqlite3_bind_int(statement, 1, channel);
+			sqlite3_bind_int(statement, 2, entries[i].nick);
+			sqlite3_bind_int64(statement, 3, userid);
+
+			if (stats_archived_message(reader, statement, STMT_SELECT_ARCHIVE_USER_BLOCK, channel,
+			                           0, entries[i].nick, userid, &archived))
+			{
+				strncpy(users[i].message, archived.message, STATS_MESSAGE_LEN);
+			}
+		}
+
+		users[i].message[STATS_MESSAGE_LEN - 1] = '\0';
 	}
 
-	// Finalise statement
-	rc = sqlite3_finalize(statement);
+	free(entries);
 
-	return i;
+	return count;
 }
 
-int stats_get_top_users_min(struct stats_user* users, int count, int offset)
+int stats_get_top_users_min(int channel, struct stats_user* users, int count, int offset)
+{
+	struct leaderboard_entry* entries; // Users from the leaderboard
+	struct leaderboard* leaderboard = store_leaderboard(&store, channel);
+
+	if (leaderboard == NULL)
+		return 0;
+
+	entries = malloc(sizeof(struct leaderboard_entry) * count);
+	count = leaderboard_read(leaderboard, entries, count, offset);
+	copy_leaderboard_users(users, entries, count);
+	free(entries);
+
+	return count;
+}
+
+int stats_get_random_messages(int channel, struct stats_message* messages, int count)
 {
 	int i;                          // Counter
 	int rc;                         // Return code
+	int picked;                     // Messages found
+	long long first, last;          // Range of the channel's message ids
+	long long pick;                 // Random message id
+	struct archive_message archived; // Picked message, if it's been archived
 	sqlite3_stmt* statement;        // Sqlite statement
+	sqlite3* reader = database_reader(&database);
+	struct statement_cache* statements = sc_thread_cache(reader);
 
-	// Select top users
-	rc = sqlite3_prepare_v2(db, SELECT_TOP_USERS, -1, &statement, NULL);
-	if (rc != SQLITE_OK)
+	// Get the channel's range of ids
+	statement = sc_get(statements, STMT_SELECT_MESSAGE_ID_RANGE);
+	if (statement == NULL)
+		return 0;
+
+	sqlite3_bind_int(statement, 1, channel);
+
+	rc = sqlite3_step(statement);
+	if (rc != SQLITE_ROW)
 	{
-		fprintf(stderr, SQLITE_STATEMENT_PREPERATION_FAILURE, sqlite3_errmsg(db));
-		fprintf(stderr, SQLITE_PROBLEM_QUERY, SELECT_TOP_USERS_TABLE);
+		fprintf(stderr, SQLITE_QUERY_FAILURE, sqlite3_errmsg(reader));
+		fprintf(stderr, SQLITE_PROBLEM_QUERY, SELECT_MESSAGE_ID_RANGE);
+
+		sqlite3_reset(statement);
+		return 0;
+	}
 
+	// No messages yet
+	if (sqlite3_column_type(statement, 0) == SQLITE_NULL)
+	{
+		sqlite3_reset(statement);
 		return 0;
 	}
 
+	first = sqlite3_column_int64(statement, 0);
+	last = sqlite3_column_int64(statement, 1);
+
+	sqlite3_reset(statement);
+
+	// Then look up each pick on its own
+	picked = 0;
+	for (i = 0; i < count; ++i)
+	{
+		const char* nick;
+		const char* message;
+
+		statement = sc_get(statements, STMT_SELECT_MESSAGE_AT_ID);
+		if (statement == NULL)
+			break;
+
+		sqlite3_randomness(sizeof(pick), &pick);
+		pick = first + llabs(pick % (last - first + 1));
+
+		// Older messages are read from the archive
+		if (stats_archived_message_at_id(reader, channel, pick, &archived))
+		{
+			stats_nick_name(reader, archived.nick, messages[picked].nick, STATS_NICK_LEN);
+			strncpy(messages[picked].message, archived.message, STATS_MESSAGE_LEN);
+			messages[picked].message[STATS_MESSAGE_LEN - 1] = '\0';
+
+			picked++;
+			continue;
+		}
+
+		// Bind parameters
+		sqlite3_bind_int(statement, 1, channel);
+		sqlite3_bind_int64(statement, 2, pick);
+
+		// Run query
+		rc = sqlite3_step(statement);
+		if (rc == SQLITE_ROW)
+		{
+			nick = (const char*)sqlite3_column_text(statement, 0);
+			message = (const char*)sqlite3_column_text(statement, 1);
+
+			// If a blank string is in the db sqlite will return NULL
+			if (nick == NULL)
+				nick = "";
+			if (message == NULL)
+				message = "";
+
+			strncpy(messages[picked].nick, nick, STATS_NICK_LEN);
+			strncpy(messages[picked].message, message, STATS_MESSAGE_LEN);
+
+			picked++;
+		}
+		else if (rc != SQLITE_DONE)
+		{
+			fprintf(stderr, SQLITE_QUERY_FAILURE, sqlite3_errmsg(reader));
+			fprintf(stderr, SQLITE_PROBLEM_QUERY, SELECT_MESSAGE_AT_ID);
+		}
+
+		// Reset statement
+		sqlite3_reset(statement);
+	}
+
+	return picked;
+}
+
+int stats_get_last_topics(int channel, struct stats_message* topics, int count)
+{
+	int i;                          // Counter
+	int rc;                         // Return code
+	sqlite3_stmt* statement;        // Sqlite statement
+	sqlite3* reader = database_reader(&database);
+	struct statement_cache* statements = sc_thread_cache(reader);
+
+	// Get prepared statement
+	statement = sc_get(statements, STMT_SELECT_LATEST_TOPICS);
+	if (statement == NULL)
+		return 0;
+
 	// Bind parameters
-	sqlite3_bind_int(statement, 1, count);
-	sqlite3_bind_int(statement, 2, offset);
+	sqlite3_bind_int(statement, 1, channel);
+	sqlite3_bind_int(statement, 2, count);
 
-	// Run query
+	// Execute statement
 	i = 0;
 	rc = sqlite3_step(statement);
 	while (rc == SQLITE_ROW)
 	{
-		time_t lastseen;
-		int messages;
+		time_t time;
 		const char* nick;
 		const char* message;
 
-		// Get values
-		nick = (const char*)sqlite3_column_text(statement, 0);
-		messages = sqlite3_column_int(statement, 1);
+		time = (time_t)sqlite3_column_int(statement, 0);
+		nick = (const char*)sqlite3_column_text(statement, 1);
 		message = (const char*)sqlite3_column_text(statement, 2);
-		lastseen = (time_t)sqlite3_column_int(statement, 3);
 
 		// If a blank string is in the db sqlite will return NULL
 		if (nick == NULL)
@@ -1009,70 +1668,87 @@ int stats_get_top_users_min(struct stats_user* users, int count, int offset)
 		if (message == NULL)
 			message = "";
 
-		// Add to array
-		strncpy(users[i].nick, nick, STATS_NICK_LEN);
-		strncpy(users[i].message, message, STATS_MESSAGE_LEN);
-		users[i].lines = messages;
-		users[i].lastseen = lastseen;
-
-		// Get next row
-		rc = sqlite3_step(statement);
+		topics[i].time = time;
+		strncpy(topics[i].nick, nick, STATS_NICK_LEN);
+		strncpy(topics[i].message, message, STATS_MESSAGE_LEN);
 
-		// Increment row number
 		i++;
+		rc = sqlite3_step(statement);
 	}
 
-	// Make sure query completed successfully
+	// Check if query done
 	if (rc != SQLITE_DONE)
 	{
-		fprintf(stderr, SQLITE_QUERY_FAILURE, sqlite3_errmsg(db));
-		fprintf(stderr, SQLITE_PROBLEM_QUERY, SELECT_TOP_USERS_TABLE);
+		fprintf(stderr, SQLITE_QUERY_FAILURE, sqlite3_errmsg(reader));
+		fprintf(stderr, SQLITE_PROBLEM_QUERY, SELECT_LATEST_TOPICS);
+
+		sqlite3_reset(statement);
+		return 0;
 	}
 
-	// Finalise statement
-	rc = sqlite3_finalize(statement);
+	// Reset statement
+	sqlite3_reset(statement);
 
 	return i;
 }
 
-int stats_get_random_messages(struct stats_message* messages, int count)
+int stats_get_activity(int channel, const char* nick, int bucket, time_t from, time_t to,
+                       struct stats_activity* activity, int count)
 {
 	int i;                          // Counter
 	int rc;                         // Return code
+	enum statement_id id;           // Query for the kind of buckets wanted
+	struct logline_slice main_nick; // Nick with aliases resolved
 	sqlite3_stmt* statement;        // Sqlite statement
+	sqlite3* reader = database_reader(&database);
+	struct statement_cache* statements = sc_thread_cache(reader);
 
-	// Create prepared statement
-	rc = sqlite3_prepare_v2(db, SELECT_RANDOM_MESSAGES, -1, &statement, NULL);
-	if (rc != SQLITE_OK)
-	{
-		fprintf(stderr, SQLITE_STATEMENT_PREPERATION_FAILURE, sqlite3_errmsg(db));
-		fprintf(stderr, SQLITE_PROBLEM_QUERY, SELECT_RANDOM_MESSAGES);
+	if (count <= 0)
+		return 0;
 
+	// A user's activity comes from the hourly rollup, which is per user
+	if (nick != NULL)
+		id = STMT_SELECT_ACTIVITY_NICK;
+	else if (bucket == ACTIVITY_HOUR)
+		id = STMT_SELECT_ACTIVITY_HOURS;
+	else
+		id = STMT_SELECT_ACTIVITY_DAYS;
+
+	// Get prepared statement
+	statement = sc_get(statements, id);
+	if (statement == NULL)
 		return 0;
-	}
 
-	// Bind parameters
-	sqlite3_bind_int(statement, 1, count);
+	// Bind parameters, including the bucket from is in
+	if (nick != NULL)
+	{
+		// Messages are counted towards main nicks
+		main_nick.ptr = nick;
+		main_nick.len = strlen(nick);
+		main_nick = alias_resolve(&store.aliases, main_nick);
+
+		sqlite3_bind_int(statement, 1, bucket);
+		sqlite3_bind_int(statement, 2, channel);
+		sqlite3_bind_text(statement, 3, main_nick.ptr, main_nick.len, SQLITE_STATIC);
+		sqlite3_bind_int64(statement, 4, from - from % bucket);
+		sqlite3_bind_int64(statement, 5, to);
+		sqlite3_bind_int(statement, 6, count);
+	}
+	else
+	{
+		sqlite3_bind_int(statement, 1, channel);
+		sqlite3_bind_int64(statement, 2, from - from % bucket);
+		sqlite3_bind_int64(statement, 3, to);
+		sqlite3_bind_int(statement, 4, count);
+	}
 
 	// Execute statement
 	i = 0;
 	rc = sqlite3_step(statement);
 	while (rc == SQLITE_ROW)
 	{
-		const char* nick;
-		const char* message;
-
-		nick = (const char*)sqlite3_column_text(statement, 0);
-		message = (const char*)sqlite3_column_text(statement, 1);
-
-		// If a blank string is in the db sqlite will return NULL
-		if (nick == NULL)
-			nick = "";
-		if (message == NULL)
-			message = "";
-
-		strncpy(messages[i].nick, nick, STATS_NICK_LEN);
-		strncpy(messages[i].message, message, STATS_MESSAGE_LEN);
+		activity[i].time = (time_t)sqlite3_column_int64(statement, 0);
+		activity[i].messages = sqlite3_column_int(statement, 1);
 
 		i++;
 		rc = sqlite3_step(statement);
@@ -1081,80 +1757,224 @@ int stats_get_random_messages(struct stats_message* messages, int count)
 	// Check if query done
 	if (rc != SQLITE_DONE)
 	{
-		fprintf(stderr, SQLITE_QUERY_FAILURE, sqlite3_errmsg(db));
-		fprintf(stderr, SQLITE_PROBLEM_QUERY, SELECT_RANDOM_MESSAGES);
+		fprintf(stderr, SQLITE_QUERY_FAILURE, sqlite3_errmsg(reader));
+		fprintf(stderr, SQLITE_PROBLEM_QUERY, sc_sql(id));
 
+		sqlite3_reset(statement);
 		return 0;
 	}
 
-	// Finalise statement
-	sqlite3_finalize(statement);
+	// Reset statement
+	sqlite3_reset(statement);
 
 	return i;
+}
+
+// Turn words into an FTS5 query matching all of them, quoting each so nothing is taken as syntax
+// Returns 0 if there are no words
+static int search_query(const char* words, char* query, size_t query_len)
+{
+	size_t len = 0;
+	int count = 0;
+
+	while (*words != 0)
+	{
+		// Skip spaces between words
+		while (*words == ' ' || *words == '\t')
+			words++;
 
+		if (*words == 0)
+			break;
+
+		// Leave room for the closing quote, a space and the terminator
+		if (len + 4 >= query_len)
+			break;
+
+		query[len++] = '"';
+
+		while (*words != 0 && *words != ' ' && *words != '\t' && len + 4 < query_len)
+		{
+			// Quotes are escaped by doubling them
+			if (*words == '"')
+				query[len++] = '"';
+
+			query[len++] = *words++;
+		}
+
+		query[len++] = '"';
+		query[len++] = ' ';
+		count++;
+
+		// Drop the rest of a word that didn't fit
+		while (*words != 0 && *words != ' ' && *words != '\t')
+			words++;
+	}
+
+	query[len] = 0;
+
+	return count;
 }
 
-int stats_get_last_topics(struct stats_message* topics, int count)
+int stats_search(int channel, const char* query, const char* nick, int by_rank, double after_rank, long long after_id,
+                 struct stats_search_result* results, int count)
 {
 	int i;                          // Counter
 	int rc;                         // Return code
+	int param;                      // Next parameter to bind
+	int nick_id = 0;                // Id of the main nick, 0 for any
+	long long message_id;           // Id of the match
+	enum statement_id id;           // Query for the order wanted
+	char match[STATS_SEARCH_LEN];   // FTS5 query
+	struct logline_slice main_nick; // Nick with aliases resolved
+	struct archive_message archived; // Match, if it's been archived
 	sqlite3_stmt* statement;        // Sqlite statement
+	sqlite3* reader = database_reader(&database);
+	struct statement_cache* statements = sc_thread_cache(reader);
 
-	// Create prepared statement
-	rc = sqlite3_prepare_v2(db, SELECT_LATEST_TOPICS, -1, &statement, NULL);
-	if (rc != SQLITE_OK)
+	if (!search_query(query, match, sizeof(match)))
+		return 0;
+
+	// Messages are stored under main nicks
+	if (nick != NULL)
 	{
-		fprintf(stderr, SQLITE_STATEMENT_PREPERATION_FAILURE, sqlite3_errmsg(db));
-		fprintf(stderr, SQLITE_PROBLEM_QUERY, SELECT_RANDOM_MESSAGES);
+		main_nick.ptr = nick;
+		main_nick.len = strlen(nick);
+		main_nick = alias_resolve(&store.aliases, main_nick);
 
-		return 0;
+		statement = sc_get(statements, STMT_SELECT_NICK_ID);
+		if (statement == NULL)
+			return 0;
+
+		sqlite3_bind_text(statement, 1, main_nick.ptr, main_nick.len, SQLITE_STATIC);
+
+		if (sqlite3_step(statement) == SQLITE_ROW)
+			nick_id = sqlite3_column_int(statement, 0);
+
+		sqlite3_reset(statement);
+
+		// Nobody by that name has said anything
+		if (nick_id == 0)
+			return 0;
 	}
 
+	// Get prepared statement
+	id = by_rank ? STMT_SELECT_SEARCH_RANKED : STMT_SELECT_SEARCH;
+
+	statement = sc_get(statements, id);
+	if (statement == NULL)
+		return 0;
+
 	// Bind parameters
-	sqlite3_bind_int(statement, 1, count);
+	sqlite3_bind_text(statement, 1, match, -1, SQLITE_STATIC);
+
+	if (by_rank)
+	{
+		sqlite3_bind_double(statement, 2, after_rank);
+		sqlite3_bind_int64(statement, 3, after_id);
+		param = 4;
+	}
+	else
+	{
+		sqlite3_bind_int64(statement, 2, after_id);
+		param = 3;
+	}
+
+	sqlite3_bind_int(statement, param, channel);
+
+	if (nick_id != 0)
+		sqlite3_bind_int(statement, param + 1, nick_id);
+
+	sqlite3_bind_int(statement, param + 2, count);
 
 	// Execute statement
 	i = 0;
-	rc = sqlite3_step(statement);
-	while (rc == SQLITE_ROW)
+	rc = SQLITE_DONE;
+	while (i < count && (rc = sqlite3_step(statement)) == SQLITE_ROW)
 	{
-		time_t time;
-		const char* nick;
+		const char* result_nick;
 		const char* message;
 
-		time = (time_t)sqlite3_column_int(statement, 0);
-		nick = (const char*)sqlite3_column_text(statement, 1);
-		message = (const char*)sqlite3_column_text(statement, 2);
+		message_id = sqlite3_column_int64(statement, 0);
 
-		// If a blank string is in the db sqlite will return NULL
-		if (nick == NULL)
-			nick = "";
-		if (message == NULL)
-			message = "";
+		if (sqlite3_column_int(statement, 2))
+		{
+			// Only a segment that can't be read leaves the page short
+			if (!stats_archived_message_at_id(reader, channel, message_id, &archived) ||
+			    archived.id != message_id)
+			{
+				continue;
+			}
 
-		topics[i].time = time;
-		strncpy(topics[i].nick, nick, STATS_NICK_LEN);
-		strncpy(topics[i].message, message, STATS_MESSAGE_LEN);
+			// Archived messages keep the nick they were written with
+			stats_nick_name(reader, archived.nick, results[i].nick, STATS_NICK_LEN);
+			results[i].time = archived.time;
+			strncpy(results[i].message, archived.message, STATS_MESSAGE_LEN);
+		}
+		else
+		{
+			result_nick = (const char*)sqlite3_column_text(statement, 4);
+			message = (const char*)sqlite3_column_text(statement, 5);
+
+			// If a blank string is in the db sqlite will return NULL
+			if (result_nick == NULL)
+				result_nick = "";
+			if (message == NULL)
+				message = "";
+
+			results[i].time = (time_t)sqlite3_column_int64(statement, 3);
+			strncpy(results[i].nick, result_nick, STATS_NICK_LEN);
+			strncpy(results[i].message, message, STATS_MESSAGE_LEN);
+		}
+
+		results[i].id = message_id;
+		results[i].rank = sqlite3_column_double(statement, 1);
+		results[i].nick[STATS_NICK_LEN - 1] = '\0';
+		results[i].message[STATS_MESSAGE_LEN - 1] = '\0';
 
 		i++;
-		rc = sqlite3_step(statement);
 	}
 
 	// Check if query done
-	if (rc != SQLITE_DONE)
+	if (i < count && rc != SQLITE_DONE)
 	{
-		fprintf(stderr, SQLITE_QUERY_FAILURE, sqlite3_errmsg(db));
-		fprintf(stderr, SQLITE_PROBLEM_QUERY, SELECT_RANDOM_MESSAGES);
+		fprintf(stderr, SQLITE_QUERY_FAILURE, sqlite3_errmsg(reader));
+		fprintf(stderr, SQLITE_PROBLEM_QUERY, sc_sql(id));
 
+		sqlite3_reset(statement);
 		return 0;
 	}
 
-	// Finalise statement
-	sqlite3_finalize(statement);
+	// Reset statement
+	sqlite3_reset(statement);
 
 	return i;
 }
 
+struct channel* find_channel(const char* name)
+{
+	int i;
+
+	if (channel_count == 0)
+		return NULL;
+
+	if (name == NULL)
+		return &channels[0];
+
+	for (i = 0; i < channel_count; ++i)
+	{
+		const char* channel_name = channels[i].name;
+
+		if (strcasecmp(channel_name, name) == 0)
+			return &channels[i];
+
+		// Allow the leading # to be left out, it has to be escaped in urls
+		if (channel_name[0] == '#' && strcasecmp(channel_name + 1, name) == 0)
+			return &channels[i];
+	}
+
+	return NULL;
+}
+
 int execute_sql(const char* sql)
 {
 	int rc;
@@ -1173,6 +1993,67 @@ int execute_sql(const char* sql)
 	return rc;
 }
 
+int migrate_database(int new_database)
+{
+	int rc;
+	int version = 0;
+	int migration_count = sizeof(migrations) / sizeof(migrations[0]);
+	char* sql;
+	sqlite3_stmt* statement;
+
+	// Tables were just created as they are now
+	if (new_database)
+	{
+		sql = sqlite3_mprintf(SET_SCHEMA_VERSION, migration_count);
+		rc = execute_sql(sql);
+		sqlite3_free(sql);
+
+		return rc;
+	}
+
+	// Get the database's schema version, 0 for databases from before versions were kept
+	rc = sqlite3_prepare_v2(db, SELECT_SCHEMA_VERSION, -1, &statement, NULL);
+	if (rc != SQLITE_OK)
+	{
+		fprintf(stderr, SQLITE_STATEMENT_PREPERATION_FAILURE, sqlite3_errmsg(db));
+		fprintf(stderr, SQLITE_PROBLEM_QUERY, SELECT_SCHEMA_VERSION);
+		return rc;
+	}
+
+	if (sqlite3_step(statement) == SQLITE_ROW)
+		version = sqlite3_column_int(statement, 0);
+
+	sqlite3_finalize(statement);
+
+	if (version >= migration_count)
+		return SQLITE_OK;
+
+	// Each migration bumps the version itself, and is undone completely if it fails
+	for (; version < migration_count; ++version)
+	{
+		printf("Migrating database to schema version %d...\n", version + 1);
+
+		execute_sql(BEGIN_TRANSACTION);
+
+		rc = execute_sql(migrations[version]);
+		if (rc != SQLITE_OK)
+		{
+			execute_sql(ROLLBACK_TRANSACTION);
+			return rc;
+		}
+
+		rc = execute_sql(COMMIT_TRANSACTION);
+		if (rc != SQLITE_OK)
+			return rc;
+	}
+
+	// Migrations rewrite whole tables, leaving the old pages free
+	printf("Compacting database...\n");
+	execute_sql(VACUUM);
+
+	return SQLITE_OK;
+}
+
 int convert_time_to_string(time_t time, char* buffer, size_t buffer_len, const char* format)
 {
 	struct tm* time_struct;
@@ -0,0 +1,183 @@
+#include <nicks.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "errors.h"
+#include "queries.h"
+
+#define NICK_DEFAULT_LENGTH  256
+
+// Find the slot for nick, either holding its id or empty
+static int* find_slot(const struct nick_table* table, const char* nick, size_t len)
+{
+	size_t slot = logline_nick_hash(nick, len) & (table->table_len - 1);
+	int id;
+
+	while ((id = table->table[slot]) != 0 &&
+	       !logline_nick_equal(table->nicks[id], table->nick_lens[id], nick, len))
+	{
+		slot = (slot + 1) & (table->table_len - 1);
+	}
+
+	return &table->table[slot];
+}
+
+static void grow_table(struct nick_table* table)
+{
+	int id;
+
+	free(table->table);
+	table->table_len *= 2;
+	table->table = calloc(table->table_len, sizeof(int));
+
+	for (id = 0; id < table->nick_max; ++id)
+	{
+		if (table->nicks[id] != NULL)
+			*find_slot(table, table->nicks[id], table->nick_lens[id]) = id;
+	}
+}
+
+static void grow_ids(struct nick_table* table, int id)
+{
+	int old_max = table->nick_max;
+
+	while (table->nick_max <= id)
+		table->nick_max *= 2;
+
+	table->nicks = realloc(table->nicks, sizeof(char*) * table->nick_max);
+	table->nick_lens = realloc(table->nick_lens, sizeof(size_t) * table->nick_max);
+
+	memset(table->nicks + old_max, 0, sizeof(char*) * (table->nick_max - old_max));
+	memset(table->nick_lens + old_max, 0, sizeof(size_t) * (table->nick_max - old_max));
+}
+
+struct nick_table nick_create()
+{
+	struct nick_table table;
+
+	table.nick_max = NICK_DEFAULT_LENGTH;
+	table.nicks = calloc(table.nick_max, sizeof(char*));
+	table.nick_lens = calloc(table.nick_max, sizeof(size_t));
+	table.table_len = NICK_DEFAULT_LENGTH * 2;
+	table.table = calloc(table.table_len, sizeof(int));
+	table.count = 0;
+
+	return table;
+}
+
+void nick_destroy(struct nick_table* table)
+{
+	if (table->nicks == NULL)
+		return;
+
+	nick_clear(table);
+
+	free(table->nicks);
+	free(table->nick_lens);
+	free(table->table);
+
+	table->nicks = NULL;
+	table->nick_lens = NULL;
+	table->table = NULL;
+	table->nick_max = 0;
+	table->table_len = 0;
+}
+
+void nick_clear(struct nick_table* table)
+{
+	int id;
+
+	for (id = 0; id < table->nick_max; ++id)
+	{
+		free(table->nicks[id]);
+		table->nicks[id] = NULL;
+		table->nick_lens[id] = 0;
+	}
+
+	memset(table->table, 0, sizeof(int) * table->table_len);
+	table->count = 0;
+}
+
+void nick_add(struct nick_table* table, int id, struct logline_slice nick)
+{
+	int* slot;
+
+	if (id <= 0)
+		return;
+
+	if (id >= table->nick_max)
+		grow_ids(table, id);
+
+	// Keep the table at most half full
+	if ((table->count + 1) * 2 > table->table_len)
+		grow_table(table);
+
+	slot = find_slot(table, nick.ptr, nick.len);
+
+	// Nicks are unique, so a nick already in the table keeps its id
+	if (*slot != 0 || table->nicks[id] != NULL)
+		return;
+
+	table->nicks[id] = strndup(nick.ptr, nick.len);
+	table->nick_lens[id] = nick.len;
+	*slot = id;
+
+	table->count++;
+}
+
+int nick_load(struct nick_table* table, sqlite3* db)
+{
+	int rc;
+	int count = 0;
+	sqlite3_stmt* statement;
+	struct logline_slice nick;
+
+	rc = sqlite3_prepare_v2(db, SELECT_NICKS, -1, &statement, NULL);
+	if (rc != SQLITE_OK)
+	{
+		fprintf(stderr, SQLITE_STATEMENT_PREPERATION_FAILURE, sqlite3_errmsg(db));
+		fprintf(stderr, SQLITE_PROBLEM_QUERY, SELECT_NICKS);
+
+		return 0;
+	}
+
+	while ((rc = sqlite3_step(statement)) == SQLITE_ROW)
+	{
+		nick.ptr = (const char*)sqlite3_column_text(statement, 1);
+		nick.len = sqlite3_column_bytes(statement, 1);
+
+		if (nick.ptr != NULL)
+		{
+			nick_add(table, sqlite3_column_int(statement, 0), nick);
+			count++;
+		}
+	}
+
+	if (rc != SQLITE_DONE)
+	{
+		fprintf(stderr, SQLITE_QUERY_FAILURE, sqlite3_errmsg(db));
+		fprintf(stderr, SQLITE_PROBLEM_QUERY, SELECT_NICKS);
+	}
+
+	sqlite3_finalize(statement);
+
+	return count;
+}
+
+int nick_find(const struct nick_table* table, struct logline_slice nick)
+{
+	if (table->count == 0)
+		return 0;
+
+	return *find_slot(table, nick.ptr, nick.len);
+}
+
+const char* nick_name(const struct nick_table* table, int id)
+{
+	if (id <= 0 || id >= table->nick_max)
+		return NULL;
+
+	return table->nicks[id];
+}
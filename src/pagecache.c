@@ -0,0 +1,361 @@
+#include <pagecache.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <zlib.h>
+
+// Stream headers in front of the deflate blocks, without a file name or time for gzip
+static const unsigned char gzip_header[] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 2, 3 };
+static const unsigned char zlib_header[] = { 0x78, 0xda };
+
+// Longest stored deflate block
+#define STORED_BLOCK_MAX  65535
+
+// Milliseconds from a to b
+static long elapsed_ms(const struct timespec* a, const struct timespec* b)
+{
+	return (b->tv_sec - a->tv_sec) * 1000 + (b->tv_nsec - a->tv_nsec) / 1000000;
+}
+
+struct page_cache page_cache_create(int entries, int min_refresh)
+{
+	struct page_cache cache;
+
+	memset(&cache, 0, sizeof(cache));
+
+	cache.min_refresh = min_refresh > 0 ? min_refresh : 0;
+	cache.len = entries > 0 ? entries : 0;
+	cache.entries = cache.len > 0 ? calloc(cache.len, sizeof(struct page_cache_entry)) : NULL;
+
+	pthread_mutex_init(&cache.lock, NULL);
+	atomic_init(&cache.hits, 0);
+	atomic_init(&cache.misses, 0);
+
+	return cache;
+}
+
+void page_cache_destroy(struct page_cache* cache)
+{
+	int i;
+
+	for (i = 0; i < cache->len; ++i)
+	{
+		free(cache->entries[i].data);
+		free(cache->entries[i].deflated);
+	}
+
+	free(cache->entries);
+	pthread_mutex_destroy(&cache->lock);
+
+	cache->entries = NULL;
+	cache->len = 0;
+}
+
+// Find key in the cache, lock must be held
+static struct page_cache_entry* page_cache_find(struct page_cache* cache, const char* key)
+{
+	int i;
+
+	for (i = 0; i < cache->len; ++i)
+	{
+		if (cache->entries[i].data != NULL && strcmp(cache->entries[i].key, key) == 0)
+			return &cache->entries[i];
+	}
+
+	return NULL;
+}
+
+// Add an entry to ss in encoder's encoding, lock must be held
+static void page_cache_copy(const struct page_cache_entry* entry, struct page_encoder* encoder, struct stringstream* ss)
+{
+	if (encoder->encoding != PAGE_IDENTITY && entry->deflated == NULL)
+		encoder->encoding = PAGE_IDENTITY;
+
+	if (encoder->encoding == PAGE_GZIP)
+	{
+		ss_add_len(ss, (const char*)gzip_header, sizeof(gzip_header));
+		encoder->check = entry->crc;
+	}
+	else if (encoder->encoding == PAGE_DEFLATE)
+	{
+		ss_add_len(ss, (const char*)zlib_header, sizeof(zlib_header));
+		encoder->check = entry->adler;
+	}
+
+	if (encoder->encoding == PAGE_IDENTITY)
+		ss_add_len(ss, entry->data, entry->length);
+	else
+		ss_add_len(ss, entry->deflated, entry->deflated_length);
+
+	encoder->length = entry->length;
+}
+
+int page_cache_read(struct page_cache* cache, const char* key, struct page_version* version,
+                    struct page_encoder* encoder, struct stringstream* ss)
+{
+	struct timespec now;
+	struct page_cache_entry* entry;
+
+	if (cache->len == 0)
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	pthread_mutex_lock(&cache->lock);
+
+	entry = page_cache_find(cache, key);
+	if (entry != NULL &&
+	    (entry->version.generation == version->generation || elapsed_ms(&entry->built, &now) < cache->min_refresh))
+	{
+		entry->used = ++cache->clock;
+		page_cache_copy(entry, encoder, ss);
+		*version = entry->version;
+
+		pthread_mutex_unlock(&cache->lock);
+		return 1;
+	}
+
+	pthread_mutex_unlock(&cache->lock);
+	return 0;
+}
+
+int page_cache_get(struct page_cache* cache, const char* key, struct page_version* version,
+                   struct page_encoder* encoder, struct stringstream* ss)
+{
+	if (cache->len == 0)
+		return 0;
+
+	if (page_cache_read(cache, key, version, encoder, ss))
+	{
+		atomic_fetch_add(&cache->hits, 1);
+		return 1;
+	}
+
+	atomic_fetch_add(&cache->misses, 1);
+	return 0;
+}
+
+// Compress a page as raw deflate blocks, ending in a sync flush so the stream can be carried on
+// Returns NULL on failure, with deflated_length 0
+static char* page_deflate(const char* data, size_t length, size_t* deflated_length)
+{
+	int rc;
+	size_t max_length;
+	char* deflated;
+	z_stream stream;
+
+	*deflated_length = 0;
+	memset(&stream, 0, sizeof(stream));
+
+	// Once per page, so take the time to compress it well
+	if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return NULL;
+
+	// The sync flush's empty stored block isn't counted by deflateBound
+	max_length = deflateBound(&stream, length) + 16;
+	deflated = malloc(max_length);
+
+	stream.next_in = (Bytef*)data;
+	stream.avail_in = length;
+	stream.next_out = (Bytef*)deflated;
+	stream.avail_out = max_length;
+
+	rc = deflate(&stream, Z_SYNC_FLUSH);
+
+	if (rc != Z_OK || stream.avail_in != 0)
+	{
+		free(deflated);
+		deflated = NULL;
+	}
+	else
+	{
+		*deflated_length = max_length - stream.avail_out;
+	}
+	deflateEnd(&stream);
+
+	return deflated;
+}
+
+void page_cache_put(struct page_cache* cache, const char* key, const struct page_version* version, const char* data, size_t length)
+{
+	int i;
+	char* copy;
+	char* deflated;
+	size_t deflated_length;
+	struct page_cache_entry* entry;
+
+	if (cache->len == 0 || strlen(key) >= PAGE_CACHE_KEY_LEN)
+		return;
+
+	// Copy and compress outside the lock, other threads only wait for the swap
+	copy = malloc(length + 1);
+	memcpy(copy, data, length);
+	copy[length] = '\0';
+
+	deflated = page_deflate(data, length, &deflated_length);
+
+	pthread_mutex_lock(&cache->lock);
+
+	// Replace an older rendering of the same page, or the least recently used page
+	entry = page_cache_find(cache, key);
+	if (entry == NULL)
+	{
+		entry = &cache->entries[0];
+
+		for (i = 1; i < cache->len; ++i)
+		{
+			if (cache->entries[i].used < entry->used)
+				entry = &cache->entries[i];
+		}
+	}
+	else if (entry->version.generation > version->generation)
+	{
+		// Someone already cached a newer one
+		pthread_mutex_unlock(&cache->lock);
+		free(copy);
+		free(deflated);
+		return;
+	}
+
+	free(entry->data);
+	free(entry->deflated);
+
+	strcpy(entry->key, key);
+	entry->data = copy;
+	entry->length = length;
+	entry->deflated = deflated;
+	entry->deflated_length = deflated_length;
+	entry->crc = crc32(0, (const Bytef*)data, length);
+	entry->adler = adler32(1, (const Bytef*)data, length);
+	entry->version = *version;
+	clock_gettime(CLOCK_MONOTONIC, &entry->built);
+	entry->used = ++cache->clock;
+
+	pthread_mutex_unlock(&cache->lock);
+}
+
+enum page_encoding page_encoding_accepted(const char* accept_encoding)
+{
+	const char* pos = accept_encoding;
+	const char* end;
+	const char* params;
+	size_t len;
+	int gzip = -1;
+	int deflate = -1;
+	int any = -1;
+	int accepted;
+
+	if (accept_encoding == NULL)
+		return PAGE_IDENTITY;
+
+	// A list of codings, each with an optional q value, q=0 turning it down
+	while (*pos != '\0')
+	{
+		pos += strspn(pos, " \t,");
+
+		end = pos + strcspn(pos, ",");
+		len = strcspn(pos, " \t;,");
+
+		params = memchr(pos, ';', end - pos);
+		accepted = 1;
+
+		if (params != NULL)
+		{
+			params = strstr(params, "q=");
+			if (params != NULL && params < end)
+				accepted = strtod(params + 2, NULL) > 0;
+		}
+
+		if ((len == 4 && strncasecmp(pos, "gzip", len) == 0) || (len == 6 && strncasecmp(pos, "x-gzip", len) == 0))
+			gzip = accepted;
+		else if (len == 7 && strncasecmp(pos, "deflate", len) == 0)
+			deflate = accepted;
+		else if (len == 1 && *pos == '*')
+			any = accepted;
+
+		pos = end;
+	}
+
+	// Codings that aren't listed are covered by *
+	if (gzip == 1 || (gzip == -1 && any == 1))
+		return PAGE_GZIP;
+
+	if (deflate == 1 || (deflate == -1 && any == 1))
+		return PAGE_DEFLATE;
+
+	return PAGE_IDENTITY;
+}
+
+const char* page_encoding_name(enum page_encoding encoding)
+{
+	if (encoding == PAGE_GZIP)
+		return "gzip";
+	else if (encoding == PAGE_DEFLATE)
+		return "deflate";
+
+	return NULL;
+}
+
+// Add a 32 bit value to ss, least significant byte first for gzip and most significant first for zlib
+static void add_uint32(struct stringstream* ss, unsigned long value, int big_endian)
+{
+	int i;
+	char bytes[4];
+
+	for (i = 0; i < 4; ++i)
+		bytes[big_endian ? 3 - i : i] = (char)((value >> (8 * i)) & 0xff);
+
+	ss_add_len(ss, bytes, sizeof(bytes));
+}
+
+void page_encoder_finish(struct page_encoder* encoder, struct stringstream* ss, const char* text)
+{
+	size_t len = strlen(text);
+	size_t remaining = len;
+	size_t block;
+	const char* pos = text;
+	char header[5];
+
+	if (encoder->encoding == PAGE_IDENTITY)
+	{
+		ss_add_len(ss, text, len);
+		return;
+	}
+
+	// The page's blocks end byte aligned, so text goes straight after them in stored
+	// blocks, the last of them (possibly empty) ending the stream
+	do
+	{
+		block = remaining < STORED_BLOCK_MAX ? remaining : STORED_BLOCK_MAX;
+
+		header[0] = block == remaining;
+		header[1] = block & 0xff;
+		header[2] = (block >> 8) & 0xff;
+		header[3] = ~block & 0xff;
+		header[4] = (~block >> 8) & 0xff;
+
+		ss_add_len(ss, header, sizeof(header));
+		ss_add_len(ss, pos, block);
+
+		pos += block;
+		remaining -= block;
+	}
+	while (remaining > 0);
+
+	if (encoder->encoding == PAGE_GZIP)
+	{
+		encoder->check = crc32_combine(encoder->check, crc32(0, (const Bytef*)text, len), len);
+		encoder->length += len;
+
+		add_uint32(ss, encoder->check, 0);
+		add_uint32(ss, encoder->length & 0xffffffff, 0);
+	}
+	else
+	{
+		encoder->check = adler32_combine(encoder->check, adler32(1, (const Bytef*)text, len), len);
+		encoder->length += len;
+
+		add_uint32(ss, encoder->check, 1);
+	}
+}
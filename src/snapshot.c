@@ -0,0 +1,198 @@
+#include <snapshot.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "errors.h"
+
+// Snapshots aren't useful until they're complete, so don't journal them
+#define SNAPSHOT_JOURNAL_OFF  "PRAGMA journal_mode=OFF;"
+
+struct snapshot snapshot_create(const char* filename, int interval, int step_pages)
+{
+	struct snapshot snapshot;
+
+	memset(&snapshot, 0, sizeof(snapshot));
+
+	if (filename != NULL)
+	{
+		snapshot.filename = strdup(filename);
+		snapshot.temp_filename = malloc(strlen(filename) + 5);
+		sprintf(snapshot.temp_filename, "%s.tmp", filename);
+	}
+
+	snapshot.interval = interval > 0 ? interval : SNAPSHOT_DEFAULT_INTERVAL;
+	snapshot.step_pages = step_pages > 0 || step_pages == SNAPSHOT_ALL_PAGES ? step_pages : SNAPSHOT_DEFAULT_STEP_PAGES;
+
+	// The first one is taken an interval after starting, by when any import is usually done
+	snapshot.last = time(NULL);
+
+	return snapshot;
+}
+
+// Give up on the snapshot in progress, keeping the last complete one
+static void snapshot_abandon(struct snapshot* snapshot)
+{
+	if (snapshot->backup != NULL)
+		sqlite3_backup_finish(snapshot->backup);
+
+	if (snapshot->file != NULL)
+	{
+		sqlite3_close(snapshot->file);
+		unlink(snapshot->temp_filename);
+	}
+
+	snapshot->backup = NULL;
+	snapshot->file = NULL;
+}
+
+void snapshot_destroy(struct snapshot* snapshot)
+{
+	snapshot_abandon(snapshot);
+
+	free(snapshot->filename);
+	free(snapshot->temp_filename);
+
+	snapshot->filename = NULL;
+	snapshot->temp_filename = NULL;
+}
+
+int snapshot_restore(const char* filename, sqlite3* db)
+{
+	int rc;
+	sqlite3* file;
+	sqlite3_backup* backup;
+
+	if (filename == NULL || access(filename, R_OK) != 0)
+		return 0;
+
+	rc = sqlite3_open_v2(filename, &file, SQLITE_OPEN_READONLY, NULL);
+	if (rc == SQLITE_OK)
+	{
+		// All in one step, nothing else is using either database yet
+		backup = sqlite3_backup_init(db, "main", file, "main");
+		if (backup != NULL)
+		{
+			rc = sqlite3_backup_step(backup, -1);
+			sqlite3_backup_finish(backup);
+		}
+		else
+		{
+			rc = sqlite3_errcode(db);
+		}
+	}
+
+	sqlite3_close(file);
+
+	if (rc != SQLITE_DONE)
+	{
+		fprintf(stderr, SNAPSHOT_RESTORE_FAILURE, filename, sqlite3_errstr(rc));
+		return 0;
+	}
+
+	return 1;
+}
+
+int snapshot_due(const struct snapshot* snapshot)
+{
+	if (snapshot->filename == NULL)
+		return 0;
+
+	return snapshot->backup != NULL || time(NULL) >= snapshot->last + snapshot->interval;
+}
+
+// Open a new temporary file and start copying db into it
+// Returns 1 on success
+static int snapshot_start(struct snapshot* snapshot, sqlite3* db)
+{
+	int rc;
+
+	unlink(snapshot->temp_filename);
+
+	rc = sqlite3_open_v2(snapshot->temp_filename, &snapshot->file, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
+	if (rc == SQLITE_OK)
+		rc = sqlite3_exec(snapshot->file, SNAPSHOT_JOURNAL_OFF, NULL, NULL, NULL);
+
+	if (rc == SQLITE_OK)
+	{
+		snapshot->backup = sqlite3_backup_init(snapshot->file, "main", db, "main");
+		if (snapshot->backup == NULL)
+			rc = sqlite3_errcode(snapshot->file);
+
+		snapshot->copied = 0;
+		snapshot->finish = snapshot->step_pages == SNAPSHOT_ALL_PAGES;
+	}
+
+	if (rc != SQLITE_OK)
+	{
+		fprintf(stderr, SNAPSHOT_FAILURE, snapshot->temp_filename, sqlite3_errstr(rc));
+		snapshot_abandon(snapshot);
+		return 0;
+	}
+
+	return 1;
+}
+
+void snapshot_step(struct snapshot* snapshot, sqlite3* db)
+{
+	int rc;
+	int finish_rc;
+	int copied;
+
+	if (snapshot->backup == NULL && !snapshot_start(snapshot, db))
+	{
+		snapshot->last = time(NULL);
+		return;
+	}
+
+	rc = sqlite3_backup_step(snapshot->backup, snapshot->finish ? SNAPSHOT_ALL_PAGES : snapshot->step_pages);
+
+	// More to copy, or something had a lock, try again next step
+	if (rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED)
+	{
+		copied = sqlite3_backup_pagecount(snapshot->backup) - sqlite3_backup_remaining(snapshot->backup);
+
+		// No further on than the last step means sqlite started over after a commit,
+		// which would keep happening under steady load, so finish it in one step
+		if (rc == SQLITE_OK && copied <= snapshot->copied)
+		{
+			snapshot->restarts++;
+			snapshot->finish = 1;
+			fprintf(stderr, SNAPSHOT_RESTARTED, snapshot->temp_filename);
+		}
+
+		snapshot->copied = copied;
+		return;
+	}
+
+	// Done (the last step syncs the file) or failed, either way the backup has to be
+	// finished before the file can be closed, and a failed step's error is the one to report
+	finish_rc = sqlite3_backup_finish(snapshot->backup);
+	snapshot->backup = NULL;
+
+	if (rc == SQLITE_DONE)
+		rc = finish_rc;
+
+	if (rc == SQLITE_OK)
+		rc = sqlite3_close(snapshot->file);
+
+	if (rc == SQLITE_OK)
+	{
+		snapshot->file = NULL;
+
+		// Replace the last snapshot in one go
+		if (rename(snapshot->temp_filename, snapshot->filename) == 0)
+			snapshot->count++;
+		else
+			fprintf(stderr, SNAPSHOT_FAILURE, snapshot->filename, "couldn't rename");
+	}
+	else
+	{
+		fprintf(stderr, SNAPSHOT_FAILURE, snapshot->temp_filename, sqlite3_errstr(rc));
+	}
+
+	snapshot_abandon(snapshot);
+	snapshot->last = time(NULL);
+}
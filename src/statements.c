@@ -0,0 +1,182 @@
+#include <statements.h>
+
+#include <stdio.h>
+#include <malloc.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "errors.h"
+#include "queries.h"
+
+// SQL for each statement id
+static const char* const statement_sql[STMT_COUNT] =
+{
+	[STMT_INSERT_CHANNEL]               = INSERT_CHANNEL,
+	[STMT_SELECT_CHANNEL]               = SELECT_CHANNEL,
+	[STMT_INSERT_MESSAGE]               = INSERT_MESSAGE,
+	[STMT_INSERT_SEARCH]                = INSERT_SEARCH,
+	[STMT_INSERT_TOPIC]                 = INSERT_TOPIC,
+	[STMT_INSERT_MESSAGE_COUNT]         = INSERT_MESSAGE_COUNT,
+	[STMT_SELECT_USERS]                 = SELECT_USERS,
+	[STMT_ADD_MESSAGE_COUNT]            = ADD_MESSAGE_COUNT,
+	[STMT_INSERT_ALIAS]                 = INSERT_ALIAS,
+	[STMT_UPDATE_ALIAS]                 = UPDATE_ALIAS,
+	[STMT_DELETE_ALIAS]                 = DELETE_ALIAS,
+	[STMT_INSERT_NICK]                  = INSERT_NICK,
+	[STMT_SELECT_MESSAGE_ID_RANGE]      = SELECT_MESSAGE_ID_RANGE,
+	[STMT_SELECT_MESSAGE_AT_ID]         = SELECT_MESSAGE_AT_ID,
+	[STMT_SELECT_USER_MESSAGE]          = SELECT_USER_MESSAGE,
+	[STMT_SELECT_LATEST_MESSAGES]       = SELECT_LATEST_MESSAGES,
+	[STMT_SELECT_MESSAGE_COUNT_AT_TIME] = SELECT_MESSAGE_COUNT_AT_TIME,
+	[STMT_ADD_ACTIVITY_HOUR]            = ADD_ACTIVITY_HOUR,
+	[STMT_ADD_ACTIVITY_DAY]             = ADD_ACTIVITY_DAY,
+	[STMT_SELECT_ACTIVITY_DAYS]         = SELECT_ACTIVITY_DAYS,
+	[STMT_SELECT_ACTIVITY_HOURS]        = SELECT_ACTIVITY_HOURS,
+	[STMT_SELECT_ACTIVITY_NICK]         = SELECT_ACTIVITY_NICK,
+	[STMT_SELECT_LATEST_TOPICS]         = SELECT_LATEST_TOPICS,
+	[STMT_SELECT_MESSAGE_COUNT]         = SELECT_MESSAGE_COUNT,
+	[STMT_SELECT_NICK]                  = SELECT_NICK,
+	[STMT_SELECT_NICK_ID]               = SELECT_NICK_ID,
+	[STMT_SELECT_ARCHIVE_LATEST]        = SELECT_ARCHIVE_LATEST,
+	[STMT_SELECT_ARCHIVE_BLOCK_AT_ID]   = SELECT_ARCHIVE_BLOCK_AT_ID,
+	[STMT_SELECT_ARCHIVE_USER_BLOCK]    = SELECT_ARCHIVE_USER_BLOCK,
+	[STMT_SELECT_OLDEST_MESSAGE]        = SELECT_OLDEST_MESSAGE,
+	[STMT_SELECT_ARCHIVE_MESSAGES]      = SELECT_ARCHIVE_MESSAGES,
+	[STMT_INSERT_ARCHIVE_SEGMENT]       = INSERT_ARCHIVE_SEGMENT,
+	[STMT_INSERT_ARCHIVE_BLOCK]         = INSERT_ARCHIVE_BLOCK,
+	[STMT_INSERT_ARCHIVE_USERS]         = INSERT_ARCHIVE_USERS,
+	[STMT_INSERT_ARCHIVED_MESSAGES]     = INSERT_ARCHIVED_MESSAGES,
+	[STMT_DELETE_ARCHIVED_MESSAGES]     = DELETE_ARCHIVED_MESSAGES,
+	[STMT_SELECT_SEARCH_BACKFILL]       = SELECT_SEARCH_BACKFILL,
+	[STMT_BACKFILL_SEARCH]              = BACKFILL_SEARCH,
+	[STMT_UPDATE_SEARCH_BACKFILL]       = UPDATE_SEARCH_BACKFILL,
+	[STMT_DELETE_SEARCH_BACKFILL]       = DELETE_SEARCH_BACKFILL,
+	[STMT_SELECT_SEARCH]                = SELECT_SEARCH,
+	[STMT_SELECT_SEARCH_RANKED]         = SELECT_SEARCH_RANKED,
+	[STMT_SELECT_CHECKPOINT]            = SELECT_CHECKPOINT,
+	[STMT_UPDATE_CHECKPOINT]            = UPDATE_CHECKPOINT,
+	[STMT_BEGIN_TRANSACTION]            = BEGIN_TRANSACTION,
+	[STMT_COMMIT_TRANSACTION]           = COMMIT_TRANSACTION,
+	[STMT_ROLLBACK_TRANSACTION]         = ROLLBACK_TRANSACTION,
+	[STMT_SAVEPOINT_ARCHIVE]            = SAVEPOINT_ARCHIVE,
+	[STMT_RELEASE_ARCHIVE]              = RELEASE_ARCHIVE,
+	[STMT_ROLLBACK_ARCHIVE]             = ROLLBACK_ARCHIVE,
+	[STMT_SELECT_USER_NICKS]            = SELECT_USER_NICKS,
+	[STMT_SELECT_USER]                  = SELECT_USER,
+	[STMT_DELETE_USER]                  = DELETE_USER,
+	[STMT_MOVE_MESSAGES]                = MOVE_MESSAGES,
+	[STMT_MOVE_UNCOUNTED_MESSAGES]      = MOVE_UNCOUNTED_MESSAGES,
+	[STMT_MOVE_ARCHIVE_BOUNDARY]        = MOVE_ARCHIVE_BOUNDARY,
+	[STMT_MOVE_ARCHIVE_BOUNDARY_RECORD] = MOVE_ARCHIVE_BOUNDARY_RECORD,
+	[STMT_MOVE_ARCHIVE_RECORDS]         = MOVE_ARCHIVE_RECORDS,
+	[STMT_DELETE_ARCHIVE_RECORDS]       = DELETE_ARCHIVE_RECORDS,
+	[STMT_MOVE_ARCHIVE_USERS]           = MOVE_ARCHIVE_USERS,
+	[STMT_MOVE_ACTIVITY_HOURS]          = MOVE_ACTIVITY_HOURS,
+	[STMT_DELETE_ACTIVITY_HOURS]        = DELETE_ACTIVITY_HOURS,
+	[STMT_MOVE_TOPICS]                  = MOVE_TOPICS,
+	[STMT_SAVEPOINT_REATTRIBUTE]        = SAVEPOINT_REATTRIBUTE,
+	[STMT_RELEASE_REATTRIBUTE]          = RELEASE_REATTRIBUTE,
+	[STMT_ROLLBACK_REATTRIBUTE]         = ROLLBACK_REATTRIBUTE,
+};
+
+// Key for per thread statement caches
+static pthread_key_t thread_cache_key;
+static pthread_once_t thread_cache_once = PTHREAD_ONCE_INIT;
+
+struct statement_cache sc_create(sqlite3* db)
+{
+	struct statement_cache sc;
+
+	// Statements are prepared lazily by sc_get
+	sc.db = db;
+	memset(sc.statements, 0, sizeof(sc.statements));
+
+	return sc;
+}
+
+void sc_destroy(struct statement_cache* sc)
+{
+	int i;
+
+	// Finalize all prepared statements
+	for (i = 0; i < STMT_COUNT; ++i)
+	{
+		sqlite3_finalize(sc->statements[i]);
+		sc->statements[i] = NULL;
+	}
+
+	sc->db = NULL;
+}
+
+sqlite3_stmt* sc_get(struct statement_cache* sc, enum statement_id id)
+{
+	int rc;
+	sqlite3_stmt* statement = sc->statements[id];
+
+	// Prepare the statement on first use
+	if (statement == NULL)
+	{
+		rc = sqlite3_prepare_v3(sc->db, statement_sql[id], -1, SQLITE_PREPARE_PERSISTENT, &statement, NULL);
+		if (rc != SQLITE_OK)
+		{
+			fprintf(stderr, SQLITE_STATEMENT_PREPERATION_FAILURE, sqlite3_errmsg(sc->db));
+			fprintf(stderr, SQLITE_PROBLEM_QUERY, statement_sql[id]);
+
+			sqlite3_finalize(statement);
+			return NULL;
+		}
+
+		sc->statements[id] = statement;
+	}
+
+	// Make sure the statement is ready to be bound and run again
+	sqlite3_reset(statement);
+	sqlite3_clear_bindings(statement);
+
+	return statement;
+}
+
+const char* sc_sql(enum statement_id id)
+{
+	return statement_sql[id];
+}
+
+static void thread_cache_free(void* ptr)
+{
+	struct statement_cache* sc = ptr;
+
+	sc_destroy(sc);
+	free(sc);
+}
+
+static void thread_cache_key_create()
+{
+	pthread_key_create(&thread_cache_key, thread_cache_free);
+}
+
+struct statement_cache* sc_thread_cache(sqlite3* db)
+{
+	struct statement_cache* sc;
+
+	pthread_once(&thread_cache_once, thread_cache_key_create);
+
+	sc = pthread_getspecific(thread_cache_key);
+
+	// Statements belong to a connection, so start again if it changed
+	if (sc != NULL && sc->db != db)
+	{
+		sc_destroy(sc);
+		*sc = sc_create(db);
+	}
+
+	// Create this thread's cache on first use
+	if (sc == NULL)
+	{
+		sc = malloc(sizeof(struct statement_cache));
+		*sc = sc_create(db);
+
+		pthread_setspecific(thread_cache_key, sc);
+	}
+
+	return sc;
+}
@@ -0,0 +1,1089 @@
+#include <store.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "errors.h"
+#include "statements.h"
+
+// Step a write statement, reporting any error, then reset it
+// Returns 1 if the statement completed
+static int run_write(sqlite3* db, sqlite3_stmt* statement, enum statement_id id)
+{
+	int rc;
+
+	rc = sqlite3_step(statement);
+	if (rc != SQLITE_DONE)
+	{
+		fprintf(stderr, SQLITE_QUERY_FAILURE, sqlite3_errmsg(db));
+		fprintf(stderr, SQLITE_PROBLEM_QUERY, sc_sql(id));
+	}
+
+	sqlite3_reset(statement);
+
+	return rc == SQLITE_DONE;
+}
+
+// Run a statement with no parameters
+static int run_simple(struct store* store, enum statement_id id)
+{
+	sqlite3_stmt* statement = sc_get(sc_thread_cache(store->db), id);
+
+	return statement != NULL && run_write(store->db, statement, id);
+}
+
+// Count a channel's users from the users table into its leaderboard
+static void load_users(struct store* store, int channel, struct leaderboard* leaderboard)
+{
+	int rc;
+	int nick;
+	const char* name;
+	sqlite3_stmt* statement;
+
+	leaderboard_clear(leaderboard);
+
+	statement = sc_get(sc_thread_cache(store->db), STMT_SELECT_USERS);
+	if (statement == NULL)
+		return;
+
+	sqlite3_bind_int(statement, 1, channel);
+
+	while ((rc = sqlite3_step(statement)) == SQLITE_ROW)
+	{
+		nick = sqlite3_column_int(statement, 0);
+		name = nick_name(&store->nicks, nick);
+
+		if (name != NULL)
+			leaderboard_add(leaderboard, nick, name, sqlite3_column_int(statement, 1), (time_t)sqlite3_column_int64(statement, 2));
+	}
+
+	if (rc != SQLITE_DONE)
+	{
+		fprintf(stderr, SQLITE_QUERY_FAILURE, sqlite3_errmsg(store->db));
+		fprintf(stderr, SQLITE_PROBLEM_QUERY, sc_sql(STMT_SELECT_USERS));
+	}
+
+	sqlite3_reset(statement);
+
+	leaderboard_publish(leaderboard);
+}
+
+// Find how far indexing older messages for search has got
+static void load_search_backfill(struct store* store)
+{
+	sqlite3_stmt* statement;
+
+	// Nothing left to do unless there's a row
+	store->search_next = 1;
+	store->search_end = 0;
+
+	statement = sc_get(sc_thread_cache(store->db), STMT_SELECT_SEARCH_BACKFILL);
+	if (statement == NULL)
+		return;
+
+	if (sqlite3_step(statement) == SQLITE_ROW)
+	{
+		store->search_next = sqlite3_column_int64(statement, 0);
+		store->search_end = sqlite3_column_int64(statement, 1);
+	}
+
+	sqlite3_reset(statement);
+}
+
+struct store store_create(sqlite3* db)
+{
+	struct store store;
+
+	store.db = db;
+	store.aliases = alias_create();
+	store.nicks = nick_create();
+	store.activity = activity_create();
+	store.search_first = 0;
+	store.search_last = 0;
+	store.archive = archive_create(NULL, 0, 0);
+	store.archive_checked = 0;
+	store.archive_retries = NULL;
+	store.snapshot = snapshot_create(NULL, 0, 0);
+	store.reattributions = NULL;
+	store.reattribution_count = 0;
+	store.reattribution_next = 0;
+	store.reattribute_moved = 0;
+	atomic_init(&store.reattribute_total, 0);
+	atomic_init(&store.reattribute_done, 0);
+	store.leaderboards = NULL;
+	store.leaderboard_count = 0;
+	atomic_init(&store.generation, 0);
+	atomic_init(&store.modified, time(NULL));
+
+	load_search_backfill(&store);
+
+	return store;
+}
+
+void store_destroy(struct store* store)
+{
+	int i;
+
+	alias_destroy(&store->aliases);
+	activity_destroy(&store->activity);
+	archive_destroy(&store->archive);
+	snapshot_destroy(&store->snapshot);
+	store->db = NULL;
+
+	free(store->reattributions);
+	store->reattributions = NULL;
+	store->reattribution_count = 0;
+
+	for (i = 0; i < store->leaderboard_count; ++i)
+	{
+		if (store->leaderboards[i] != NULL)
+		{
+			leaderboard_destroy(store->leaderboards[i]);
+			free(store->leaderboards[i]);
+		}
+	}
+
+	free(store->leaderboards);
+	store->leaderboards = NULL;
+	free(store->archive_retries);
+	store->archive_retries = NULL;
+	store->leaderboard_count = 0;
+
+	// Leaderboards point at nicks, so they go first
+	nick_destroy(&store->nicks);
+}
+
+int store_channel(struct store* store, const char* network, const char* name)
+{
+	int id = -1;
+	sqlite3_stmt* statement;
+	struct statement_cache* statements = sc_thread_cache(store->db);
+
+	// Add channel if it's new
+	statement = sc_get(statements, STMT_INSERT_CHANNEL);
+	if (statement == NULL)
+		return -1;
+
+	sqlite3_bind_text(statement, 1, network, -1, SQLITE_STATIC);
+	sqlite3_bind_text(statement, 2, name, -1, SQLITE_STATIC);
+
+	if (!run_write(store->db, statement, STMT_INSERT_CHANNEL))
+		return -1;
+
+	// Get its id
+	statement = sc_get(statements, STMT_SELECT_CHANNEL);
+	if (statement == NULL)
+		return -1;
+
+	sqlite3_bind_text(statement, 1, network, -1, SQLITE_STATIC);
+	sqlite3_bind_text(statement, 2, name, -1, SQLITE_STATIC);
+
+	if (sqlite3_step(statement) == SQLITE_ROW)
+		id = sqlite3_column_int(statement, 0);
+
+	sqlite3_reset(statement);
+
+	if (id < 0)
+		return id;
+
+	// Leaderboards are looked up by channel id
+	if (id >= store->leaderboard_count)
+	{
+		store->leaderboards = realloc(store->leaderboards, sizeof(struct leaderboard*) * (id + 1));
+		memset(store->leaderboards + store->leaderboard_count, 0,
+		       sizeof(struct leaderboard*) * (id + 1 - store->leaderboard_count));
+		store->archive_retries = realloc(store->archive_retries, sizeof(struct store_archive_retry) * (id + 1));
+		memset(store->archive_retries + store->leaderboard_count, 0,
+		       sizeof(struct store_archive_retry) * (id + 1 - store->leaderboard_count));
+		store->leaderboard_count = id + 1;
+	}
+
+	if (store->leaderboards[id] == NULL)
+	{
+		store->leaderboards[id] = malloc(sizeof(struct leaderboard));
+		*store->leaderboards[id] = leaderboard_create();
+	}
+
+	load_users(store, id, store->leaderboards[id]);
+
+	return id;
+}
+
+struct leaderboard* store_leaderboard(struct store* store, int channel)
+{
+	if (channel < 0 || channel >= store->leaderboard_count)
+		return NULL;
+
+	return store->leaderboards[channel];
+}
+
+void store_flush(struct store* store)
+{
+	size_t i;
+	sqlite3_stmt* statement;
+	struct activity_entry* entry;
+	struct statement_cache* statements = sc_thread_cache(store->db);
+
+	for (i = 0; i < store->activity.len && store->activity.count > 0; ++i)
+	{
+		entry = &store->activity.entries[i];
+		if (entry->nick == 0)
+			continue;
+
+		if (entry->nick == ACTIVITY_CHANNEL)
+		{
+			// Day by channel
+			statement = sc_get(statements, STMT_ADD_ACTIVITY_DAY);
+			if (statement == NULL)
+				break;
+
+			sqlite3_bind_int(statement, 1, entry->channel);
+			sqlite3_bind_int64(statement, 2, entry->start);
+			sqlite3_bind_int(statement, 3, entry->messages);
+
+			run_write(store->db, statement, STMT_ADD_ACTIVITY_DAY);
+		}
+		else
+		{
+			// Hour by user
+			statement = sc_get(statements, STMT_ADD_ACTIVITY_HOUR);
+			if (statement == NULL)
+				break;
+
+			sqlite3_bind_int(statement, 1, entry->channel);
+			sqlite3_bind_int64(statement, 2, entry->start);
+			sqlite3_bind_int(statement, 3, entry->nick);
+			sqlite3_bind_int(statement, 4, entry->messages);
+
+			run_write(store->db, statement, STMT_ADD_ACTIVITY_HOUR);
+		}
+	}
+
+	activity_clear(&store->activity);
+
+	// Index the new messages for search in one go, they have consecutive ids
+	if (store->search_first != 0)
+	{
+		statement = sc_get(statements, STMT_INSERT_SEARCH);
+		if (statement != NULL)
+		{
+			sqlite3_bind_int64(statement, 1, store->search_first);
+			sqlite3_bind_int64(statement, 2, store->search_last);
+
+			run_write(store->db, statement, STMT_INSERT_SEARCH);
+		}
+
+		store->search_first = 0;
+		store->search_last = 0;
+	}
+}
+
+void store_publish(struct store* store)
+{
+	int i;
+
+	atomic_fetch_add(&store->reattribute_done, store->reattribute_moved);
+	store->reattribute_moved = 0;
+
+	for (i = 0; i < store->leaderboard_count; ++i)
+	{
+		if (store->leaderboards[i] != NULL)
+			leaderboard_publish(store->leaderboards[i]);
+	}
+
+	// Pages rendered before this are out of date, readers load modified before the
+	// generation so they never pair an old generation with a newer time
+	atomic_fetch_add(&store->generation, 1);
+	atomic_store(&store->modified, time(NULL));
+}
+
+void store_reload(struct store* store)
+{
+	int i;
+
+	// Counts and messages for the rolled back transaction are gone with it
+	activity_clear(&store->activity);
+	store->search_first = 0;
+	store->search_last = 0;
+	store->reattribute_moved = 0;
+
+	// Nicks added by the rolled back transaction are gone
+	nick_clear(&store->nicks);
+	nick_load(&store->nicks, store->db);
+
+	load_search_backfill(store);
+
+	for (i = 0; i < store->leaderboard_count; ++i)
+	{
+		if (store->leaderboards[i] != NULL)
+			load_users(store, i, store->leaderboards[i]);
+	}
+}
+
+int store_search_backlog(struct store* store)
+{
+	return store->search_next <= store->search_end;
+}
+
+void store_backfill_search(struct store* store)
+{
+	long long end;
+	enum statement_id id;
+	sqlite3_stmt* statement;
+	struct statement_cache* statements = sc_thread_cache(store->db);
+
+	if (!store_search_backlog(store))
+		return;
+
+	// Index a range of ids, which may hold fewer messages if ids are sparse
+	end = store->search_next + STORE_SEARCH_BACKFILL_CHUNK;
+
+	statement = sc_get(statements, STMT_BACKFILL_SEARCH);
+	if (statement != NULL)
+	{
+		sqlite3_bind_int64(statement, 1, store->search_next);
+		sqlite3_bind_int64(statement, 2, end);
+		sqlite3_bind_int64(statement, 3, store->search_end);
+
+		if (run_write(store->db, statement, STMT_BACKFILL_SEARCH))
+		{
+			// Remember how far it got, or that it's finished
+			id = end > store->search_end ? STMT_DELETE_SEARCH_BACKFILL : STMT_UPDATE_SEARCH_BACKFILL;
+
+			statement = sc_get(statements, id);
+			if (statement != NULL)
+			{
+				if (id == STMT_UPDATE_SEARCH_BACKFILL)
+					sqlite3_bind_int64(statement, 1, end);
+
+				if (run_write(store->db, statement, id))
+				{
+					store->search_next = end;
+					return;
+				}
+			}
+		}
+	}
+
+	// Stop trying until the next restart rather than failing over and over
+	fprintf(stderr, SEARCH_BACKFILL_FAILURE, store->search_next);
+	store->search_next = store->search_end + 1;
+}
+
+long long store_find_reattributions(struct store* store)
+{
+	int rc;
+	int alias;
+	int max = 0;
+	long long total = 0;
+	struct logline_slice nick;
+	struct logline_slice main_nick;
+	struct reattribution* reattribution;
+	sqlite3_stmt* statement;
+
+	statement = sc_get(sc_thread_cache(store->db), STMT_SELECT_USER_NICKS);
+	if (statement == NULL)
+		return 0;
+
+	// Any user whose nick is now an alias, there are only as many users as nicks per channel
+	while ((rc = sqlite3_step(statement)) == SQLITE_ROW)
+	{
+		alias = sqlite3_column_int(statement, 1);
+
+		nick.ptr = nick_name(&store->nicks, alias);
+		if (nick.ptr == NULL)
+			continue;
+
+		nick.len = strlen(nick.ptr);
+		main_nick = alias_resolve(&store->aliases, nick);
+		if (main_nick.ptr == nick.ptr)
+			continue;
+
+		if (store->reattribution_count == max)
+		{
+			max = max > 0 ? max * 2 : 16;
+			store->reattributions = realloc(store->reattributions, sizeof(struct reattribution) * max);
+		}
+
+		reattribution = &store->reattributions[store->reattribution_count++];
+		reattribution->channel = sqlite3_column_int(statement, 0);
+		reattribution->alias = alias;
+		reattribution->nick = main_nick;
+		reattribution->messages = sqlite3_column_int64(statement, 2);
+		reattribution->phase = REATTRIBUTE_ACTIVITY;
+
+		total += reattribution->messages;
+	}
+
+	if (rc != SQLITE_DONE)
+	{
+		fprintf(stderr, SQLITE_QUERY_FAILURE, sqlite3_errmsg(store->db));
+		fprintf(stderr, SQLITE_PROBLEM_QUERY, sc_sql(STMT_SELECT_USER_NICKS));
+	}
+
+	sqlite3_reset(statement);
+
+	atomic_store(&store->reattribute_total, total);
+	atomic_store(&store->reattribute_done, 0);
+
+	return total;
+}
+
+int store_reattribute_backlog(struct store* store)
+{
+	return store->reattribution_next < store->reattribution_count;
+}
+
+// Run one of the re-attribution statements, which take their parameters by name
+// Returns 1 if it completed
+static int run_reattribution(struct store* store, enum statement_id id, const struct reattribution* reattribution,
+                             int nick, long long shift, long long first)
+{
+	sqlite3_stmt* statement = sc_get(sc_thread_cache(store->db), id);
+
+	if (statement == NULL)
+		return 0;
+
+	// Parameters a statement doesn't have are left alone
+	sqlite3_bind_int(statement, sqlite3_bind_parameter_index(statement, "$channel"), reattribution->channel);
+	sqlite3_bind_int(statement, sqlite3_bind_parameter_index(statement, "$alias"), reattribution->alias);
+	sqlite3_bind_int(statement, sqlite3_bind_parameter_index(statement, "$nickid"), nick);
+	sqlite3_bind_int64(statement, sqlite3_bind_parameter_index(statement, "$shift"), shift);
+	sqlite3_bind_int64(statement, sqlite3_bind_parameter_index(statement, "$first"), first);
+	sqlite3_bind_int(statement, sqlite3_bind_parameter_index(statement, "$limit"), STORE_REATTRIBUTE_CHUNK);
+
+	return run_write(store->db, statement, id);
+}
+
+// Move the alias's messages with userids from first up to the main nick's, whose own start at base
+// Returns 1 on success
+static int reattribute_chunk(struct store* store, const struct reattribution* reattribution, int nick,
+                             long long first, long long base)
+{
+	int i;
+	long long shift = base - first;
+
+	// Archived messages keep the nick and userid they were written with in
+	// their blocks, so archive_user_records remembers them for moved rows.
+	// Records are copied before the rows they belong to move
+	static const enum statement_id moves[] =
+	{
+		STMT_MOVE_ARCHIVE_BOUNDARY_RECORD,
+		STMT_MOVE_ARCHIVE_BOUNDARY,
+		STMT_MOVE_ARCHIVE_RECORDS,
+		STMT_DELETE_ARCHIVE_RECORDS,
+		STMT_MOVE_ARCHIVE_USERS,
+		STMT_MOVE_MESSAGES,
+	};
+
+	for (i = 0; i < (int)(sizeof(moves) / sizeof(moves[0])); ++i)
+	{
+		if (!run_reattribution(store, moves[i], reattribution, nick, shift, first))
+			return 0;
+	}
+
+	return 1;
+}
+
+// Move the next chunk of the alias's activity hours, topics or uncounted messages
+// Returns 1 on success
+static int reattribute_rows(struct store* store, struct reattribution* reattribution, int nick)
+{
+	int rc;
+	int moved;
+
+	if (!run_simple(store, STMT_SAVEPOINT_REATTRIBUTE))
+		return 0;
+
+	if (reattribution->phase == REATTRIBUTE_ACTIVITY)
+	{
+		// Add the hours to the main nick's, then take the same ones off the alias
+		rc = run_reattribution(store, STMT_MOVE_ACTIVITY_HOURS, reattribution, nick, 0, 0) &&
+		     run_reattribution(store, STMT_DELETE_ACTIVITY_HOURS, reattribution, nick, 0, 0);
+	}
+	else if (reattribution->phase == REATTRIBUTE_TOPICS)
+	{
+		rc = run_reattribution(store, STMT_MOVE_TOPICS, reattribution, nick, 0, 0);
+	}
+	else
+	{
+		rc = run_reattribution(store, STMT_MOVE_UNCOUNTED_MESSAGES, reattribution, nick, 0, 0);
+	}
+
+	moved = sqlite3_changes(store->db);
+
+	if (!rc)
+	{
+		run_simple(store, STMT_ROLLBACK_REATTRIBUTE);
+		run_simple(store, STMT_RELEASE_REATTRIBUTE);
+		return 0;
+	}
+
+	run_simple(store, STMT_RELEASE_REATTRIBUTE);
+
+	// A short chunk was the last of them
+	if (moved < STORE_REATTRIBUTE_CHUNK)
+		reattribution->phase++;
+
+	return 1;
+}
+
+// Give up on the alias being moved, with remaining messages left under it
+static void reattribute_skip(struct store* store, long long remaining)
+{
+	atomic_fetch_sub(&store->reattribute_total, remaining);
+	store->reattribution_next++;
+}
+
+void store_reattribute(struct store* store)
+{
+	int rc;
+	int nick;
+	int count;
+	long long messages;
+	long long first;
+	long long base;
+	time_t lastseen;
+	sqlite3_stmt* statement;
+	struct leaderboard* leaderboard;
+	struct reattribution* reattribution;
+
+	if (!store_reattribute_backlog(store))
+		return;
+
+	reattribution = &store->reattributions[store->reattribution_next];
+	leaderboard = store_leaderboard(store, reattribution->channel);
+
+	// Channels that aren't followed have no leaderboard to keep in step, so they're left alone
+	nick = leaderboard != NULL ? store_nick(store, reattribution->nick) : 0;
+	if (nick == 0 || nick == reattribution->alias)
+	{
+		reattribute_skip(store, reattribution->messages);
+		return;
+	}
+
+	// Everything but the counted messages is moved in chunks of rows
+	if (reattribution->phase != REATTRIBUTE_MESSAGES)
+	{
+		if (!reattribute_rows(store, reattribution, nick))
+		{
+			fprintf(stderr, REATTRIBUTE_FAILURE, nick_name(&store->nicks, reattribution->alias), reattribution->channel);
+			reattribute_skip(store, reattribution->phase < REATTRIBUTE_MESSAGES ? reattribution->messages : 0);
+			return;
+		}
+
+		if (reattribution->phase > REATTRIBUTE_UNCOUNTED)
+		{
+			printf("Moved messages from %s to %.*s in channel %d (%lld of %lld so far)\n",
+			       nick_name(&store->nicks, reattribution->alias), (int)reattribution->nick.len, reattribution->nick.ptr,
+			       reattribution->channel, atomic_load(&store->reattribute_done) + store->reattribute_moved,
+			       atomic_load(&store->reattribute_total));
+
+			store->reattribution_next++;
+		}
+
+		return;
+	}
+
+	// How many messages the alias has left
+	rc = SQLITE_ERROR;
+	messages = 0;
+	lastseen = 0;
+
+	statement = sc_get(sc_thread_cache(store->db), STMT_SELECT_USER);
+	if (statement != NULL)
+	{
+		sqlite3_bind_int(statement, 1, reattribution->channel);
+		sqlite3_bind_int(statement, 2, reattribution->alias);
+
+		rc = sqlite3_step(statement);
+		if (rc == SQLITE_ROW)
+		{
+			messages = sqlite3_column_int64(statement, 0);
+			lastseen = (time_t)sqlite3_column_int64(statement, 1);
+		}
+
+		sqlite3_reset(statement);
+	}
+
+	// Counted messages already moved, though there could be uncounted ones left
+	if (rc == SQLITE_DONE)
+	{
+		reattribution->phase = REATTRIBUTE_UNCOUNTED;
+		return;
+	}
+
+	count = messages < STORE_REATTRIBUTE_CHUNK ? (int)messages : STORE_REATTRIBUTE_CHUNK;
+	first = messages - count;
+
+	// All of the chunk or none of it
+	if (rc != SQLITE_ROW || !run_simple(store, STMT_SAVEPOINT_REATTRIBUTE))
+	{
+		fprintf(stderr, REATTRIBUTE_FAILURE, nick_name(&store->nicks, reattribution->alias), reattribution->channel);
+		reattribute_skip(store, rc == SQLITE_ROW ? messages : reattribution->messages);
+		return;
+	}
+
+	// The main nick's count before is where the moved messages' userids start
+	base = store_add_messages(store, reattribution->channel, nick, count, lastseen);
+
+	rc = base != STORE_NO_USERID && reattribute_chunk(store, reattribution, nick, first, base);
+
+	// Then take them off the alias
+	if (rc)
+	{
+		leaderboard_add(leaderboard, reattribution->alias, NULL, -count, 0);
+
+		if (first > 0)
+		{
+			statement = sc_get(sc_thread_cache(store->db), STMT_ADD_MESSAGE_COUNT);
+			rc = statement != NULL;
+
+			if (rc)
+			{
+				sqlite3_bind_int(statement, 1, -count);
+				sqlite3_bind_int(statement, 2, 0);
+				sqlite3_bind_int(statement, 3, reattribution->channel);
+				sqlite3_bind_int(statement, 4, reattribution->alias);
+
+				rc = run_write(store->db, statement, STMT_ADD_MESSAGE_COUNT);
+			}
+		}
+		else
+		{
+			rc = run_reattribution(store, STMT_DELETE_USER, reattribution, nick, 0, 0);
+		}
+	}
+
+	if (!rc)
+	{
+		run_simple(store, STMT_ROLLBACK_REATTRIBUTE);
+		run_simple(store, STMT_RELEASE_REATTRIBUTE);
+
+		// Put the leaderboard back how the database has it
+		load_users(store, reattribution->channel, leaderboard);
+
+		fprintf(stderr, REATTRIBUTE_FAILURE, nick_name(&store->nicks, reattribution->alias), reattribution->channel);
+		reattribute_skip(store, messages);
+		return;
+	}
+
+	run_simple(store, STMT_RELEASE_REATTRIBUTE);
+	store->reattribute_moved += count;
+
+	// Then any messages left under the alias without a userid
+	if (first == 0)
+		reattribution->phase = REATTRIBUTE_UNCOUNTED;
+}
+
+int store_archive_backlog(struct store* store)
+{
+	return archive_enabled(&store->archive) && time(NULL) >= store->archive_checked + STORE_ARCHIVE_INTERVAL;
+}
+
+// Write a channel's messages from first_id on that are still in day to a segment, and index it
+// Returns 1 on success
+static int archive_segment(struct store* store, int channel, time_t day, long long first_id)
+{
+	int i;
+	int rc;
+	int messages = 0;
+	long long last_id = 0;
+	time_t message_time;
+	time_t last_time = 0;
+	int last_count = 0;
+	struct logline_slice message;
+	struct archive_segment segment;
+	sqlite3_stmt* statement;
+	struct statement_cache* statements = sc_thread_cache(store->db);
+
+	if (!archive_segment_open(&store->archive, &segment, channel, day, first_id))
+	{
+		archive_segment_destroy(&segment);
+		return 0;
+	}
+
+	statement = sc_get(statements, STMT_SELECT_ARCHIVE_MESSAGES);
+	if (statement == NULL)
+	{
+		archive_segment_destroy(&segment);
+		return 0;
+	}
+
+	sqlite3_bind_int(statement, 1, channel);
+	sqlite3_bind_int64(statement, 2, first_id);
+
+	// Ids run in time order, so stop at the first message from a later day
+	rc = 1;
+	while (rc && sqlite3_step(statement) == SQLITE_ROW)
+	{
+		message_time = (time_t)sqlite3_column_int64(statement, 1);
+		if (message_time >= day + ARCHIVE_DAY)
+			break;
+
+		message.ptr = (const char*)sqlite3_column_text(statement, 4);
+		message.len = sqlite3_column_bytes(statement, 4);
+		if (message.ptr == NULL)
+			message.ptr = "";
+
+		last_id = sqlite3_column_int64(statement, 0);
+		rc = archive_segment_add(&segment, last_id, message_time, sqlite3_column_int64(statement, 2),
+		                         sqlite3_column_int(statement, 3), message);
+
+		// Resuming a logfile skips the messages already stored at its latest time
+		last_count = message_time == last_time ? last_count + 1 : 1;
+		last_time = message_time;
+		messages++;
+	}
+
+	sqlite3_reset(statement);
+
+	if (!rc || messages == 0 || !archive_segment_finish(&segment))
+	{
+		archive_segment_destroy(&segment);
+		return 0;
+	}
+
+	// Index each block, and the users in it
+	for (i = 0; i < segment.block_count && rc; ++i)
+	{
+		const struct archive_block* block = &segment.blocks[i];
+
+		statement = sc_get(statements, STMT_INSERT_ARCHIVE_BLOCK);
+		rc = statement != NULL;
+		if (rc)
+		{
+			sqlite3_bind_int(statement, 1, channel);
+			sqlite3_bind_int64(statement, 2, block->last_id);
+			sqlite3_bind_int64(statement, 3, block->first_id);
+			sqlite3_bind_int64(statement, 4, block->day);
+			sqlite3_bind_int64(statement, 5, block->segment);
+			sqlite3_bind_int64(statement, 6, block->offset);
+			sqlite3_bind_int(statement, 7, block->size);
+			sqlite3_bind_int(statement, 8, block->length);
+
+			rc = run_write(store->db, statement, STMT_INSERT_ARCHIVE_BLOCK);
+		}
+
+		statement = rc ? sc_get(statements, STMT_INSERT_ARCHIVE_USERS) : NULL;
+		rc = statement != NULL;
+		if (rc)
+		{
+			sqlite3_bind_int64(statement, 1, block->last_id);
+			sqlite3_bind_int(statement, 2, channel);
+			sqlite3_bind_int64(statement, 3, block->first_id);
+
+			rc = run_write(store->db, statement, STMT_INSERT_ARCHIVE_USERS);
+		}
+	}
+
+	archive_segment_destroy(&segment);
+
+	// Then the segment, and take its messages out of the database
+	statement = rc ? sc_get(statements, STMT_INSERT_ARCHIVE_SEGMENT) : NULL;
+	if (statement == NULL)
+		return 0;
+
+	sqlite3_bind_int(statement, 1, channel);
+	sqlite3_bind_int64(statement, 2, first_id);
+	sqlite3_bind_int64(statement, 3, last_id);
+	sqlite3_bind_int64(statement, 4, day);
+	sqlite3_bind_int(statement, 5, messages);
+	sqlite3_bind_int64(statement, 6, last_time);
+	sqlite3_bind_int(statement, 7, last_count);
+
+	if (!run_write(store->db, statement, STMT_INSERT_ARCHIVE_SEGMENT))
+		return 0;
+
+	// Keep each message's channel and nick, so searches can tell which archived matches they want
+	statement = sc_get(statements, STMT_INSERT_ARCHIVED_MESSAGES);
+	if (statement == NULL)
+		return 0;
+
+	sqlite3_bind_int(statement, 1, channel);
+	sqlite3_bind_int64(statement, 2, first_id);
+	sqlite3_bind_int64(statement, 3, last_id);
+
+	if (!run_write(store->db, statement, STMT_INSERT_ARCHIVED_MESSAGES))
+		return 0;
+
+	statement = sc_get(statements, STMT_DELETE_ARCHIVED_MESSAGES);
+	if (statement == NULL)
+		return 0;
+
+	sqlite3_bind_int(statement, 1, channel);
+	sqlite3_bind_int64(statement, 2, first_id);
+	sqlite3_bind_int64(statement, 3, last_id);
+
+	return run_write(store->db, statement, STMT_DELETE_ARCHIVED_MESSAGES);
+}
+
+void store_archive_day(struct store* store)
+{
+	int channel;
+	long long first_id;
+	time_t now;
+	time_t cutoff;
+	time_t day;
+	int backoff;
+	sqlite3_stmt* statement;
+	struct statement_cache* statements = sc_thread_cache(store->db);
+
+	// Days that ended at least age days before today are old enough
+	now = time(NULL);
+	cutoff = now - now % ARCHIVE_DAY - (time_t)store->archive.age * ARCHIVE_DAY;
+
+	for (channel = 0; channel < store->leaderboard_count; ++channel)
+	{
+		struct store_archive_retry* retry = &store->archive_retries[channel];
+
+		// Channels that failed wait their turn, so the rest still get archived
+		if (store->leaderboards[channel] == NULL || now < retry->retry)
+			continue;
+
+		statement = sc_get(statements, STMT_SELECT_OLDEST_MESSAGE);
+		if (statement == NULL)
+			break;
+
+		sqlite3_bind_int(statement, 1, channel);
+
+		if (sqlite3_step(statement) != SQLITE_ROW || (time_t)sqlite3_column_int64(statement, 1) >= cutoff)
+		{
+			sqlite3_reset(statement);
+			continue;
+		}
+
+		first_id = sqlite3_column_int64(statement, 0);
+		day = (time_t)sqlite3_column_int64(statement, 1);
+		day -= day % ARCHIVE_DAY;
+
+		sqlite3_reset(statement);
+
+		// One segment at a time, so new lines never wait long
+		if (!run_simple(store, STMT_SAVEPOINT_ARCHIVE))
+			break;
+
+		if (archive_segment(store, channel, day, first_id))
+		{
+			run_simple(store, STMT_RELEASE_ARCHIVE);
+			retry->failures = 0;
+			return;
+		}
+
+		run_simple(store, STMT_ROLLBACK_ARCHIVE);
+		run_simple(store, STMT_RELEASE_ARCHIVE);
+
+		// Back off, doubling each time it fails again
+		retry->failures++;
+		backoff = STORE_ARCHIVE_INTERVAL << (retry->failures < 7 ? retry->failures - 1 : 6);
+		if (backoff > STORE_ARCHIVE_MAX_BACKOFF)
+			backoff = STORE_ARCHIVE_MAX_BACKOFF;
+		retry->retry = now + backoff;
+
+		fprintf(stderr, ARCHIVE_FAILURE, channel, backoff);
+	}
+
+	// Nothing (more) to do for now
+	store->archive_checked = now;
+}
+
+int store_nick(struct store* store, struct logline_slice nick)
+{
+	int id;
+	sqlite3_stmt* statement;
+
+	id = nick_find(&store->nicks, nick);
+	if (id != 0)
+		return id;
+
+	// New nick, add it and keep the id it was given
+	statement = sc_get(sc_thread_cache(store->db), STMT_INSERT_NICK);
+	if (statement == NULL)
+		return 0;
+
+	sqlite3_bind_text(statement, 1, nick.ptr, nick.len, SQLITE_STATIC);
+
+	if (!run_write(store->db, statement, STMT_INSERT_NICK))
+		return 0;
+
+	id = (int)sqlite3_last_insert_rowid(store->db);
+	nick_add(&store->nicks, id, nick);
+
+	return id;
+}
+
+int store_topic(struct store* store, int channel, struct logline_slice nick, struct logline_slice topic, time_t time)
+{
+	int id;
+	sqlite3_stmt* statement;
+
+	id = store_nick(store, alias_resolve(&store->aliases, nick));
+	if (id == 0)
+		return 0;
+
+	// Add topic to database
+	statement = sc_get(sc_thread_cache(store->db), STMT_INSERT_TOPIC);
+	if (statement == NULL)
+		return 0;
+
+	// Bind values
+	sqlite3_bind_int(statement, 1, channel);
+	sqlite3_bind_int(statement, 2, (int)time);
+	sqlite3_bind_int(statement, 3, id);
+	sqlite3_bind_text(statement, 4, topic.ptr, topic.len, SQLITE_STATIC);
+
+	return run_write(store->db, statement, STMT_INSERT_TOPIC);
+}
+
+int store_message(struct store* store, int channel, struct logline_slice nick, struct logline_slice message, time_t time)
+{
+	int id;
+	long long userid;
+
+	id = store_nick(store, alias_resolve(&store->aliases, nick));
+	if (id == 0)
+		return 0;
+
+	// Increment message count for user, the message's userid is the count before it
+	userid = store_add_messages(store, channel, id, 1, time);
+
+	return store_message_userid(store, channel, id, message, time, userid);
+}
+
+int store_message_userid(struct store* store, int channel, int nick,
+                         struct logline_slice message, time_t time, long long userid)
+{
+	sqlite3_stmt* statement;
+
+	// Add message to database
+	statement = sc_get(sc_thread_cache(store->db), STMT_INSERT_MESSAGE);
+	if (statement == NULL)
+		return 0;
+
+	// Bind values
+	sqlite3_bind_int(statement, 1, channel);
+
+	if (userid == STORE_NO_USERID)
+		sqlite3_bind_null(statement, 2);
+	else
+		sqlite3_bind_int64(statement, 2, userid);
+
+	sqlite3_bind_int(statement, 3, nick);
+	sqlite3_bind_text(statement, 4, message.ptr, message.len, SQLITE_STATIC);
+	sqlite3_bind_int(statement, 5, time);
+
+	if (!run_write(store->db, statement, STMT_INSERT_MESSAGE))
+		return 0;
+
+	// Indexed for search along with the rest of the transaction's messages when it's flushed
+	if (store->search_first == 0)
+		store->search_first = sqlite3_last_insert_rowid(store->db);
+
+	store->search_last = sqlite3_last_insert_rowid(store->db);
+
+	// Counted towards the rollups when the transaction is flushed
+	activity_add(&store->activity, channel, nick, time, 1);
+
+	return 1;
+}
+
+long long store_add_messages(struct store* store, int channel, int nick, int count, time_t lastseen)
+{
+	int rc;
+	long long previous;
+	const char* name;
+	sqlite3_stmt* statement;
+	struct leaderboard* leaderboard;
+	struct statement_cache* statements = sc_thread_cache(store->db);
+
+	leaderboard = store_leaderboard(store, channel);
+	name = nick_name(&store->nicks, nick);
+	if (leaderboard == NULL || name == NULL)
+		return STORE_NO_USERID;
+
+	// The leaderboard knows every user's count, so there's no need to look it up
+	previous = leaderboard_add(leaderboard, nick, name, count, lastseen);
+
+	// Add to existing user, or create them
+	if (previous >= 0)
+	{
+		statement = sc_get(statements, STMT_ADD_MESSAGE_COUNT);
+		if (statement != NULL)
+		{
+			sqlite3_bind_int(statement, 1, count);
+			sqlite3_bind_int(statement, 2, lastseen);
+			sqlite3_bind_int(statement, 3, channel);
+			sqlite3_bind_int(statement, 4, nick);
+		}
+
+		rc = statement != NULL && run_write(store->db, statement, STMT_ADD_MESSAGE_COUNT);
+	}
+	else
+	{
+		statement = sc_get(statements, STMT_INSERT_MESSAGE_COUNT);
+		if (statement != NULL)
+		{
+			sqlite3_bind_int(statement, 1, channel);
+			sqlite3_bind_int(statement, 2, nick);
+			sqlite3_bind_int(statement, 3, count);
+			sqlite3_bind_int(statement, 4, lastseen);
+		}
+
+		rc = statement != NULL && run_write(store->db, statement, STMT_INSERT_MESSAGE_COUNT);
+
+		previous = 0;
+	}
+
+	// The database didn't take the count, so the leaderboard mustn't either
+	if (!rc)
+	{
+		leaderboard_add(leaderboard, nick, name, -count, 0);
+		return STORE_NO_USERID;
+	}
+
+	return previous;
+}
+
+int store_save_checkpoint(struct store* store, int channel, const struct checkpoint* checkpoint)
+{
+	sqlite3_stmt* statement;
+
+	statement = sc_get(sc_thread_cache(store->db), STMT_UPDATE_CHECKPOINT);
+	if (statement == NULL)
+		return 0;
+
+	sqlite3_bind_int(statement, 1, channel);
+	sqlite3_bind_int64(statement, 2, checkpoint->inode);
+	sqlite3_bind_int64(statement, 3, checkpoint->size);
+	sqlite3_bind_int64(statement, 4, checkpoint->offset);
+	sqlite3_bind_int64(statement, 5, checkpoint->day);
+
+	return run_write(store->db, statement, STMT_UPDATE_CHECKPOINT);
+}
+
+int store_load_checkpoint(struct store* store, int channel, struct checkpoint* checkpoint)
+{
+	int found = 0;
+	sqlite3_stmt* statement;
+
+	statement = sc_get(sc_thread_cache(store->db), STMT_SELECT_CHECKPOINT);
+	if (statement == NULL)
+		return 0;
+
+	sqlite3_bind_int(statement, 1, channel);
+
+	if (sqlite3_step(statement) == SQLITE_ROW)
+	{
+		checkpoint->inode = sqlite3_column_int64(statement, 0);
+		checkpoint->size = sqlite3_column_int64(statement, 1);
+		checkpoint->offset = sqlite3_column_int64(statement, 2);
+		checkpoint->day = (time_t)sqlite3_column_int64(statement, 3);
+
+		found = 1;
+	}
+
+	sqlite3_reset(statement);
+
+	return found;
+}
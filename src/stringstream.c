@@ -1,5 +1,6 @@
 #include <stringstream.h>
 
+#include <stdio.h>
 #include <malloc.h>
 #include <string.h>
 
@@ -30,24 +31,64 @@ void ss_destroy(struct stringstream *ss)
 }
 
 void ss_add(struct stringstream* ss, const char* string)
+{
+	ss_add_len(ss, string, strlen(string));
+}
+
+void ss_add_len(struct stringstream* ss, const char* data, size_t len)
 {
 	// If this stringstream hasn't already been destroyed
 	if (ss->buffer != NULL)
 	{
-		size_t str_len = strlen(string);
-		size_t space_remaining = ss->max_len - ss->len;
-
-		while (str_len > space_remaining)
+		// Leave room for the terminator too
+		while (len >= ss->max_len - ss->len)
 		{
 			ss->max_len *= SS_GROWTH_CONSTANT;
 			ss->buffer = realloc(ss->buffer, ss->max_len);
-
-			space_remaining = ss->max_len - ss->len;
 		}
 
-		strcpy(ss->buffer + ss->len, string);
-		ss->len += str_len;
+		memcpy(ss->buffer + ss->len, data, len);
+		ss->len += len;
+		ss->buffer[ss->len] = 0;
+	}
+}
+
+void ss_add_json(struct stringstream* ss, const char* string)
+{
+	char* escaped;
+	char* out;
+	unsigned char c;
+
+	// Every character takes at most 6 (\u00XX), plus quotes and terminator
+	escaped = malloc(strlen(string) * 6 + 3);
+	out = escaped;
+
+	*out++ = '"';
+
+	for (; *string != 0; ++string)
+	{
+		c = (unsigned char)*string;
+
+		if (c == '"' || c == '\\')
+		{
+			*out++ = '\\';
+			*out++ = c;
+		}
+		else if (c < 0x20)
+		{
+			out += sprintf(out, "\\u%04x", c);
+		}
+		else
+		{
+			*out++ = c;
+		}
 	}
+
+	*out++ = '"';
+	*out = 0;
+
+	ss_add(ss, escaped);
+	free(escaped);
 }
 
 void ss_clear(struct stringstream* ss)
@@ -60,6 +101,7 @@ void ss_clear(struct stringstream* ss)
 		{
 			// Set the first character to 0, effectively clearing the string
 			ss->buffer[0] = 0;
+			ss->len = 0;
 		}
 	}
 }
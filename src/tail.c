@@ -0,0 +1,279 @@
+#include <tail.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+
+// Feed complete lines in the buffer to the batch and keep the incomplete one
+static void tail_lines(struct tail* tail)
+{
+	const char* start = tail->buffer;
+	const char* end = tail->buffer + tail->used;
+	const char* newline;
+
+	while ((newline = memchr(start, '\n', end - start)) != NULL)
+	{
+		ingest_line(tail->batch, start, newline - start + 1);
+		start = newline + 1;
+	}
+
+	tail->used = end - start;
+	memmove(tail->buffer, start, tail->used);
+}
+
+// Start again from the beginning of a truncated file
+static void tail_truncated(struct tail* tail)
+{
+	printf("Logfile was truncated, reading it from the start\n");
+
+	lseek(tail->fd, 0, SEEK_SET);
+	tail->position = 0;
+	tail->used = 0;
+
+	ingest_track(tail->batch, tail->fd, 0, tail->batch->day);
+}
+
+// Read and ingest everything written since the last read
+static void tail_read(struct tail* tail)
+{
+	ssize_t data_read;              // Bytes read by read()
+	size_t space;                   // Free space in buffer
+	struct stat file_stat;          // For spotting truncation
+	int checked = 0;                // Whether truncation has been checked for
+
+	for (;;)
+	{
+		// Grow the buffer if a single line doesn't fit
+		if (tail->used == tail->buffer_len)
+		{
+			tail->buffer_len *= 2;
+			tail->buffer = realloc(tail->buffer, tail->buffer_len);
+		}
+
+		space = tail->buffer_len - tail->used;
+
+		data_read = read(tail->fd, tail->buffer + tail->used, space);
+		if (data_read < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			break;
+		}
+
+		if (data_read == 0)
+		{
+			// A change with nothing new to read can mean the file shrank
+			if (!checked && fstat(tail->fd, &file_stat) == 0 && file_stat.st_size < tail->position)
+			{
+				tail_truncated(tail);
+				checked = 1;
+				continue;
+			}
+
+			break;
+		}
+
+		checked = 1;
+		tail->position += data_read;
+		tail->used += data_read;
+
+		tail_lines(tail);
+
+		// A short read means we've caught up with the writer
+		if ((size_t)data_read < space)
+			break;
+	}
+}
+
+// Switch to a new file at path, if there is one
+static void tail_switch(struct tail* tail)
+{
+	int fd;
+	struct stat file_stat;
+
+	fd = open(tail->path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	// Still the same file
+	if (fstat(fd, &file_stat) != 0 || (tail->fd >= 0 && file_stat.st_ino == tail->inode))
+	{
+		close(fd);
+		return;
+	}
+
+	printf("Logfile was rotated, following the new file\n");
+
+	// Finish anything written to the old file before it was replaced
+	if (tail->fd >= 0)
+	{
+		tail_read(tail);
+		close(tail->fd);
+	}
+
+	// Move the watch over to the new file
+	if (tail->file_wd >= 0)
+		inotify_rm_watch(tail->inotify_fd, tail->file_wd);
+
+	tail->file_wd = inotify_add_watch(tail->inotify_fd, tail->path,
+	                                  IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+
+	tail_attach(tail, fd, 0, tail->batch);
+	tail_read(tail);
+}
+
+// Drain every pending inotify event
+// Returns 1 if the logfile may have been replaced
+static int tail_events(struct tail* tail)
+{
+	char events[TAIL_EVENT_BUFFER_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event* event;
+	ssize_t len;
+	char* pos;
+	int replaced = 0;
+
+	while ((len = read(tail->inotify_fd, events, sizeof(events))) > 0)
+	{
+		for (pos = events; pos < events + len; pos += sizeof(struct inotify_event) + event->len)
+		{
+			event = (const struct inotify_event*)pos;
+
+			if (event->mask & IN_Q_OVERFLOW)
+			{
+				// Events were lost, check everything
+				replaced = 1;
+			}
+			else if (event->wd == tail->file_wd)
+			{
+				// Watch removed when the file was deleted
+				if (event->mask & IN_IGNORED)
+					tail->file_wd = -1;
+
+				// Moved, deleted, or unlinked (IN_ATTRIB) while we hold it open
+				if (event->mask & (IN_MOVE_SELF | IN_DELETE_SELF | IN_ATTRIB | IN_IGNORED))
+					replaced = 1;
+			}
+			else if (event->wd == tail->dir_wd && event->len > 0 && strcmp(event->name, tail->name) == 0)
+			{
+				// Something was created or moved in at path
+				replaced = 1;
+			}
+		}
+	}
+
+	return replaced;
+}
+
+struct tail tail_create(const char* path)
+{
+	struct tail tail;
+	struct epoll_event watch;
+	char* dir;
+	char* slash;
+
+	tail.path = strdup(path);
+	slash = strrchr(tail.path, '/');
+	tail.name = slash != NULL ? slash + 1 : tail.path;
+
+	tail.fd = -1;
+	tail.inode = 0;
+	tail.position = 0;
+	tail.file_wd = -1;
+	tail.dir_wd = -1;
+	tail.epoll_fd = -1;
+
+	tail.buffer_len = TAIL_BUFFER_SIZE;
+	tail.buffer = malloc(tail.buffer_len);
+	tail.used = 0;
+	tail.batch = NULL;
+
+	tail.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (tail.inotify_fd < 0)
+		return tail;
+
+	tail.file_wd = inotify_add_watch(tail.inotify_fd, path,
+	                                 IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+
+	// Watch the directory to see the logfile recreated after rotation
+	if (slash == NULL)
+		dir = strdup(".");
+	else if (slash == tail.path)
+		dir = strdup("/");
+	else
+		dir = strndup(tail.path, slash - tail.path);
+
+	tail.dir_wd = inotify_add_watch(tail.inotify_fd, dir, IN_CREATE | IN_MOVED_TO);
+	free(dir);
+
+	tail.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+	watch.events = EPOLLIN;
+	watch.data.fd = tail.inotify_fd;
+	epoll_ctl(tail.epoll_fd, EPOLL_CTL_ADD, tail.inotify_fd, &watch);
+
+	return tail;
+}
+
+void tail_destroy(struct tail* tail)
+{
+	if (tail->fd >= 0)
+		close(tail->fd);
+	if (tail->epoll_fd >= 0)
+		close(tail->epoll_fd);
+	if (tail->inotify_fd >= 0)
+		close(tail->inotify_fd);
+
+	free(tail->buffer);
+	free(tail->path);
+
+	tail->fd = -1;
+	tail->epoll_fd = -1;
+	tail->inotify_fd = -1;
+	tail->buffer = NULL;
+	tail->path = NULL;
+}
+
+void tail_attach(struct tail* tail, int fd, off_t offset, struct ingest_batch* batch)
+{
+	struct stat file_stat;
+
+	tail->fd = fd;
+	tail->inode = fstat(fd, &file_stat) == 0 ? file_stat.st_ino : 0;
+	tail->position = offset;
+	tail->used = 0;
+	tail->batch = batch;
+
+	lseek(fd, offset, SEEK_SET);
+
+	ingest_track(batch, fd, offset, batch->day);
+}
+
+int tail_wait(struct tail* tail, int timeout)
+{
+	int rc;
+	struct epoll_event ready;
+
+	rc = epoll_wait(tail->epoll_fd, &ready, 1, timeout);
+	if (rc == 0)
+		return 0;
+	else if (rc < 0)
+		return errno == EINTR ? 1 : -1;
+
+	// Everything queued up is handled with one pass over the file
+	rc = tail_events(tail);
+
+	if (tail->fd >= 0)
+		tail_read(tail);
+
+	if (rc)
+		tail_switch(tail);
+
+	return 1;
+}
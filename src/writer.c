@@ -0,0 +1,640 @@
+#include <writer.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "errors.h"
+#include "statements.h"
+
+// Longest anyone sleeps without rechecking the queue (ms)
+#define WRITER_MAX_SLEEP  1000
+
+// Milliseconds elapsed since start
+static int elapsed_ms(const struct timespec* start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (int)((now.tv_sec - start->tv_sec) * 1000 +
+	             (now.tv_nsec - start->tv_nsec) / 1000000);
+}
+
+// Wait on cond for up to timeout ms, lock must be held
+static void timed_wait(pthread_cond_t* cond, pthread_mutex_t* lock, int timeout)
+{
+	struct timespec until;
+
+	clock_gettime(CLOCK_REALTIME, &until);
+	until.tv_sec += timeout / 1000;
+	until.tv_nsec += (timeout % 1000) * 1000000L;
+	if (until.tv_nsec >= 1000000000L)
+	{
+		until.tv_sec++;
+		until.tv_nsec -= 1000000000L;
+	}
+
+	pthread_cond_timedwait(cond, lock, &until);
+}
+
+// Run a transaction control statement, returns the sqlite return code
+static int run_statement(struct writer* writer, enum statement_id id)
+{
+	int rc;
+	sqlite3_stmt* statement;
+
+	statement = sc_get(sc_thread_cache(writer->store->db), id);
+	if (statement == NULL)
+		return SQLITE_ERROR;
+
+	rc = sqlite3_step(statement);
+	if (rc != SQLITE_DONE)
+	{
+		fprintf(stderr, SQLITE_QUERY_FAILURE, sqlite3_errmsg(writer->store->db));
+		fprintf(stderr, SQLITE_PROBLEM_QUERY, sc_sql(id));
+	}
+
+	sqlite3_reset(statement);
+
+	return rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+
+// Claim the next free slot, or NULL if the queue is full
+static struct writer_slot* queue_claim(struct writer* writer, size_t* pos)
+{
+	struct writer_slot* slot;
+	size_t seq;
+	long diff;
+
+	*pos = atomic_load_explicit(&writer->enqueue_pos, memory_order_relaxed);
+
+	for (;;)
+	{
+		slot = &writer->slots[*pos & (writer->queue_size - 1)];
+		seq = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+		diff = (long)seq - (long)*pos;
+
+		if (diff == 0)
+		{
+			// Free on this lap, try to take it
+			if (atomic_compare_exchange_weak_explicit(&writer->enqueue_pos, pos, *pos + 1,
+			                                          memory_order_relaxed, memory_order_relaxed))
+			{
+				return slot;
+			}
+		}
+		else if (diff < 0)
+		{
+			// Still holding a record from the last lap
+			return NULL;
+		}
+		else
+		{
+			// Another producer took it
+			*pos = atomic_load_explicit(&writer->enqueue_pos, memory_order_relaxed);
+		}
+	}
+}
+
+// Claim a slot, waiting for the writer to make space if the queue is full
+static struct writer_record* queue_reserve(struct writer* writer, size_t* pos)
+{
+	struct writer_slot* slot;
+
+	while ((slot = queue_claim(writer, pos)) == NULL)
+	{
+		atomic_fetch_add(&writer->full_waits, 1);
+
+		pthread_mutex_lock(&writer->lock);
+		atomic_fetch_add(&writer->producers_waiting, 1);
+
+		// Recheck now the writer can see we're waiting
+		if ((slot = queue_claim(writer, pos)) == NULL)
+			timed_wait(&writer->space, &writer->lock, WRITER_MAX_SLEEP);
+
+		atomic_fetch_sub(&writer->producers_waiting, 1);
+		pthread_mutex_unlock(&writer->lock);
+
+		if (slot != NULL)
+			break;
+	}
+
+	return &slot->record;
+}
+
+// Hand a filled slot over to the writer
+static void queue_publish(struct writer* writer, size_t pos)
+{
+	struct writer_slot* slot = &writer->slots[pos & (writer->queue_size - 1)];
+	size_t depth;
+	size_t max_depth;
+
+	atomic_store_explicit(&slot->sequence, pos + 1, memory_order_seq_cst);
+	atomic_fetch_add_explicit(&writer->records, 1, memory_order_relaxed);
+
+	// dequeue_pos may be stale, so depth can only be an estimate
+	depth = pos + 1 - atomic_load_explicit(&writer->dequeue_pos, memory_order_relaxed);
+	if (depth > writer->queue_size)
+		depth = writer->queue_size;
+
+	max_depth = atomic_load_explicit(&writer->max_depth, memory_order_relaxed);
+	while (depth > max_depth &&
+	       !atomic_compare_exchange_weak_explicit(&writer->max_depth, &max_depth, depth,
+	                                              memory_order_relaxed, memory_order_relaxed))
+	{
+	}
+
+	// Wake the writer if it's asleep
+	if (atomic_load(&writer->writer_sleeping))
+	{
+		pthread_mutex_lock(&writer->lock);
+		pthread_cond_signal(&writer->ready);
+		pthread_mutex_unlock(&writer->lock);
+	}
+}
+
+// The next record to write, or NULL if the queue is empty (writer thread only)
+static struct writer_record* queue_peek(struct writer* writer)
+{
+	size_t pos = atomic_load_explicit(&writer->dequeue_pos, memory_order_relaxed);
+	struct writer_slot* slot = &writer->slots[pos & (writer->queue_size - 1)];
+
+	if (atomic_load_explicit(&slot->sequence, memory_order_seq_cst) != pos + 1)
+		return NULL;
+
+	return &slot->record;
+}
+
+// Give the slot from queue_peek back to the producers (writer thread only)
+static void queue_release(struct writer* writer)
+{
+	size_t pos = atomic_load_explicit(&writer->dequeue_pos, memory_order_relaxed);
+	struct writer_slot* slot = &writer->slots[pos & (writer->queue_size - 1)];
+
+	atomic_store_explicit(&slot->sequence, pos + writer->queue_size, memory_order_release);
+	atomic_store_explicit(&writer->dequeue_pos, pos + 1, memory_order_seq_cst);
+
+	// Wake producers waiting for space once half the queue is free, so they
+	// refill it in one go rather than waking for every slot
+	if (atomic_load(&writer->producers_waiting) &&
+	    atomic_load(&writer->enqueue_pos) - (pos + 1) <= writer->queue_size / 2)
+	{
+		pthread_mutex_lock(&writer->lock);
+		pthread_cond_broadcast(&writer->space);
+		pthread_mutex_unlock(&writer->lock);
+	}
+}
+
+// Fill in the parts of a record every kind has
+static void record_fill(struct writer_record* record, enum writer_record_kind kind, int channel,
+                        int lines, const struct checkpoint* checkpoint)
+{
+	record->kind = kind;
+	record->channel = channel;
+	record->lines = lines;
+
+	if (checkpoint != NULL)
+		record->checkpoint = *checkpoint;
+	else
+		record->checkpoint.inode = 0;
+}
+
+// Remember a channel's checkpoint to save with the open transaction
+static void note_checkpoint(struct writer* writer, int channel, const struct checkpoint* checkpoint)
+{
+	int i;
+
+	for (i = 0; i < writer->checkpoint_count; ++i)
+	{
+		if (writer->checkpoints[i].channel == channel)
+			break;
+	}
+
+	if (i == writer->checkpoint_count)
+	{
+		writer->checkpoints = realloc(writer->checkpoints, sizeof(struct writer_checkpoint) * (i + 1));
+		writer->checkpoints[i].channel = channel;
+		writer->checkpoint_count++;
+	}
+
+	writer->checkpoints[i].checkpoint = *checkpoint;
+	writer->checkpoints[i].pending = 1;
+}
+
+static void writer_begin(struct writer* writer)
+{
+	if (writer->in_transaction)
+		return;
+
+	// Falls back to autocommit if a transaction can't be opened
+	if (run_statement(writer, STMT_BEGIN_TRANSACTION) != SQLITE_OK)
+		return;
+
+	writer->in_transaction = 1;
+	clock_gettime(CLOCK_MONOTONIC, &writer->opened);
+}
+
+// Check if a record's text is kept in the record itself
+static int record_inline(const struct writer_record* record)
+{
+	return record->kind != WRITER_CALL && record->nick_len + record->message_len <= WRITER_INLINE_TEXT;
+}
+
+// Let go of a record once it's in the database
+static void record_finish(struct writer_record* record)
+{
+	if (record->kind == WRITER_CALL && record->done != NULL)
+		record->done(record->arg);
+	else if (record->kind != WRITER_CALL && !record_inline(record))
+		free(record->text);
+}
+
+// Keep a record written in the open transaction until it's committed
+static void journal_add(struct writer* writer, const struct writer_record* record)
+{
+	if (writer->journal_count == writer->journal_max)
+	{
+		writer->journal_max = writer->journal_max > 0 ? writer->journal_max * 2 : 64;
+		writer->journal = realloc(writer->journal, sizeof(struct writer_record) * writer->journal_max);
+	}
+
+	// Inline text is copied with the record, other text now belongs to the journal
+	writer->journal[writer->journal_count++] = *record;
+}
+
+// Write a record
+static void writer_write(struct writer* writer, struct writer_record* record)
+{
+	struct logline_slice nick;
+	struct logline_slice message;
+
+	nick.ptr = record->text;
+	nick.len = record->nick_len;
+	message.ptr = record->text + record->nick_len;
+	message.len = record->message_len;
+
+	if (record->kind == WRITER_TOPIC)
+		store_topic(writer->store, record->channel, nick, message, record->time);
+	else if (record->kind == WRITER_MESSAGE)
+		store_message(writer->store, record->channel, nick, message, record->time);
+	else if (record->kind == WRITER_CALL)
+		record->call(writer->store, record->arg);
+
+	if (record->checkpoint.inode != 0)
+		note_checkpoint(writer, record->channel, &record->checkpoint);
+
+	writer->lines += record->lines;
+}
+
+// Write the journal again in a new transaction, after the last one was rolled back
+// Returns 0 if a transaction couldn't be opened
+static int writer_replay(struct writer* writer)
+{
+	int i;
+	struct writer_record* record;
+
+	if (run_statement(writer, STMT_BEGIN_TRANSACTION) != SQLITE_OK)
+		return 0;
+
+	writer->lines = 0;
+
+	for (i = 0; i < writer->journal_count; ++i)
+	{
+		record = &writer->journal[i];
+
+		// The journal may have moved since the record was copied into it
+		if (record_inline(record))
+			record->text = record->inline_text;
+
+		writer_write(writer, record);
+	}
+
+	return 1;
+}
+
+// Commit the open transaction, returns the sqlite return code
+static int writer_try_commit(struct writer* writer)
+{
+	int i;
+	int rc;
+	int tries = 0;
+
+	// Record how far through each logfile this transaction takes us
+	for (i = 0; i < writer->checkpoint_count; ++i)
+	{
+		if (writer->checkpoints[i].pending)
+		{
+			store_save_checkpoint(writer->store, writer->checkpoints[i].channel, &writer->checkpoints[i].checkpoint);
+			writer->checkpoints[i].pending = 0;
+		}
+	}
+
+	// Rollups go in the same transaction as the messages they count
+	store_flush(writer->store);
+
+	// Readers can hold a commit up past the busy timeout without WAL, but the
+	// transaction is still good, so keep at it
+	while ((rc = run_statement(writer, STMT_COMMIT_TRANSACTION)) == SQLITE_BUSY)
+		fprintf(stderr, WRITER_COMMIT_BUSY, ++tries);
+
+	return rc;
+}
+
+static void writer_commit(struct writer* writer)
+{
+	int i;
+	int rc;
+	int wait = WRITER_REPLAY_WAIT;
+
+	if (!writer->in_transaction)
+		return;
+
+	for (;;)
+	{
+		rc = writer_try_commit(writer);
+		if (rc == SQLITE_OK)
+			break;
+
+		// Don't leave a failed transaction open
+		if (!sqlite3_get_autocommit(writer->store->db))
+			run_statement(writer, STMT_ROLLBACK_TRANSACTION);
+
+		// Forget counts that didn't make it into the database
+		store_reload(writer->store);
+
+		// Idle work is picked up again from where the database has it, and records that
+		// aren't written by the time we stop are read again from the last checkpoint
+		if (writer->journal_count == 0)
+			break;
+
+		if (atomic_load(&writer->stopping))
+		{
+			fprintf(stderr, WRITER_COMMIT_DROPPED, writer->lines);
+			break;
+		}
+
+		fprintf(stderr, WRITER_COMMIT_REPLAYED, writer->lines, sqlite3_errstr(rc), wait);
+
+		// The queue fills up meanwhile, holding the producers back
+		do
+		{
+			usleep(wait * 1000);
+			wait = wait * 2 < WRITER_MAX_REPLAY_WAIT ? wait * 2 : WRITER_MAX_REPLAY_WAIT;
+		}
+		while (!writer_replay(writer));
+	}
+
+	if (rc == SQLITE_OK)
+	{
+		atomic_fetch_add(&writer->commits, 1);
+		atomic_fetch_add(&writer->lines_committed, writer->lines);
+
+		// Readers can see the new counts now they're in the database
+		store_publish(writer->store);
+	}
+
+	// Records given up on while stopping are let go of too
+	for (i = 0; i < writer->journal_count; ++i)
+		record_finish(&writer->journal[i]);
+
+	writer->journal_count = 0;
+	writer->lines = 0;
+	writer->in_transaction = 0;
+}
+
+// Write a record from the queue, keeping it in the journal until it's committed
+static void writer_apply(struct writer* writer, struct writer_record* record)
+{
+	writer_write(writer, record);
+
+	if (writer->in_transaction)
+		journal_add(writer, record);
+	else
+		record_finish(record);
+}
+
+static void* writer_run(void* arg)
+{
+	struct writer* writer = arg;
+	struct writer_record* record;
+	int timeout;
+
+	for (;;)
+	{
+		record = queue_peek(writer);
+
+		if (record == NULL)
+		{
+			// Caught up, so there's no reason to hold the transaction open
+			writer_commit(writer);
+
+			if (atomic_load(&writer->stopping))
+				break;
+
+			// Index older messages for search while there's nothing new to write,
+			// a chunk per transaction so new lines never wait long
+			if (store_search_backlog(writer->store))
+			{
+				writer_begin(writer);
+				store_backfill_search(writer->store);
+				writer_commit(writer);
+
+				continue;
+			}
+
+			// Move messages from aliases added since they were written over to their
+			// main nicks, a chunk per transaction
+			if (store_reattribute_backlog(writer->store))
+			{
+				writer_begin(writer);
+				store_reattribute(writer->store);
+				writer_commit(writer);
+
+				continue;
+			}
+
+			// Then move days that have got old enough out to the archive, a segment at a time
+			if (store_archive_backlog(writer->store))
+			{
+				writer_begin(writer);
+				store_archive_day(writer->store);
+				writer_commit(writer);
+
+				continue;
+			}
+
+			// Copy the in-memory database out to its snapshot file while idle,
+			// a step at a time so a new line never waits for more than one
+			if (snapshot_due(&writer->store->snapshot))
+			{
+				snapshot_step(&writer->store->snapshot, writer->store->db);
+
+				continue;
+			}
+
+			// Sleep until a producer publishes something
+			pthread_mutex_lock(&writer->lock);
+			atomic_store(&writer->writer_sleeping, 1);
+
+			if (queue_peek(writer) == NULL && !atomic_load(&writer->stopping))
+				timed_wait(&writer->ready, &writer->lock, WRITER_MAX_SLEEP);
+
+			atomic_store(&writer->writer_sleeping, 0);
+			pthread_mutex_unlock(&writer->lock);
+
+			continue;
+		}
+
+		writer_begin(writer);
+		writer_apply(writer, record);
+		queue_release(writer);
+
+		// Without a transaction each write is committed as it's made
+		if (!writer->in_transaction)
+		{
+			store_flush(writer->store);
+			store_publish(writer->store);
+		}
+
+		// Commit if the batch is full or has been open too long
+		if (writer->in_transaction)
+		{
+			timeout = writer->flush_interval - elapsed_ms(&writer->opened);
+
+			if (writer->lines >= writer->batch_size || timeout <= 0)
+			{
+				writer_commit(writer);
+
+				// Keep a snapshot moving under constant load too, a step between batches
+				if (snapshot_due(&writer->store->snapshot))
+					snapshot_step(&writer->store->snapshot, writer->store->db);
+			}
+		}
+	}
+
+	return NULL;
+}
+
+struct writer writer_create(struct store* store, int batch_size, int flush_interval, int queue_size)
+{
+	struct writer writer;
+
+	memset(&writer, 0, sizeof(writer));
+
+	writer.store = store;
+	writer.batch_size = batch_size > 0 ? batch_size : WRITER_DEFAULT_BATCH_SIZE;
+	writer.flush_interval = flush_interval >= 0 ? flush_interval : WRITER_DEFAULT_FLUSH_INTERVAL;
+
+	// Round the queue up to a power of two
+	writer.queue_size = 2;
+	while (writer.queue_size < (size_t)(queue_size > 0 ? queue_size : WRITER_DEFAULT_QUEUE_SIZE))
+		writer.queue_size *= 2;
+
+	writer.slots = malloc(sizeof(struct writer_slot) * writer.queue_size);
+
+	return writer;
+}
+
+void writer_destroy(struct writer* writer)
+{
+	free(writer->slots);
+	free(writer->checkpoints);
+	free(writer->journal);
+
+	writer->slots = NULL;
+	writer->checkpoints = NULL;
+	writer->checkpoint_count = 0;
+	writer->journal = NULL;
+	writer->journal_count = 0;
+	writer->journal_max = 0;
+}
+
+int writer_start(struct writer* writer)
+{
+	size_t i;
+
+	// Every slot starts free for the first lap
+	for (i = 0; i < writer->queue_size; ++i)
+		atomic_init(&writer->slots[i].sequence, i);
+
+	atomic_init(&writer->enqueue_pos, 0);
+	atomic_init(&writer->dequeue_pos, 0);
+	atomic_init(&writer->writer_sleeping, 0);
+	atomic_init(&writer->producers_waiting, 0);
+	atomic_init(&writer->stopping, 0);
+	atomic_init(&writer->records, 0);
+	atomic_init(&writer->full_waits, 0);
+	atomic_init(&writer->max_depth, 0);
+	atomic_init(&writer->commits, 0);
+	atomic_init(&writer->lines_committed, 0);
+
+	pthread_mutex_init(&writer->lock, NULL);
+	pthread_cond_init(&writer->ready, NULL);
+	pthread_cond_init(&writer->space, NULL);
+
+	return pthread_create(&writer->thread, NULL, writer_run, writer);
+}
+
+void writer_stop(struct writer* writer)
+{
+	pthread_mutex_lock(&writer->lock);
+	atomic_store(&writer->stopping, 1);
+	pthread_cond_signal(&writer->ready);
+	pthread_mutex_unlock(&writer->lock);
+
+	pthread_join(writer->thread, NULL);
+
+	pthread_cond_destroy(&writer->space);
+	pthread_cond_destroy(&writer->ready);
+	pthread_mutex_destroy(&writer->lock);
+}
+
+void writer_line(struct writer* writer, enum writer_record_kind kind, int channel, time_t time,
+                 struct logline_slice nick, struct logline_slice message,
+                 int lines, const struct checkpoint* checkpoint)
+{
+	struct writer_record* record;
+	size_t pos;
+
+	record = queue_reserve(writer, &pos);
+	record_fill(record, kind, channel, lines, checkpoint);
+
+	record->time = time;
+	record->nick_len = nick.len;
+	record->message_len = message.len;
+
+	// The line's buffer is reused as soon as we return, so keep a copy
+	if (nick.len + message.len <= WRITER_INLINE_TEXT)
+		record->text = record->inline_text;
+	else
+		record->text = malloc(nick.len + message.len);
+
+	memcpy(record->text, nick.ptr, nick.len);
+	memcpy(record->text + nick.len, message.ptr, message.len);
+
+	queue_publish(writer, pos);
+}
+
+void writer_call(struct writer* writer, int channel, void (*call)(struct store* store, void* arg),
+                 void (*done)(void* arg), void* arg, int lines, const struct checkpoint* checkpoint)
+{
+	struct writer_record* record;
+	size_t pos;
+
+	record = queue_reserve(writer, &pos);
+	record_fill(record, WRITER_CALL, channel, lines, checkpoint);
+
+	record->call = call;
+	record->done = done;
+	record->arg = arg;
+
+	queue_publish(writer, pos);
+}
+
+size_t writer_depth(struct writer* writer)
+{
+	return atomic_load(&writer->enqueue_pos) - atomic_load(&writer->dequeue_pos);
+}